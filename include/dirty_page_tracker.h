@@ -0,0 +1,119 @@
+#ifndef __DIRTY_PAGE_TRACKER_H__
+#define __DIRTY_PAGE_TRACKER_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Tracks which pages of a memory region have been written, so that snapshots of the region only need to copy the pages
+// that changed since the previous one.
+//
+// The region is write protected, and the first write to each page after that faults. The fault handler marks the page
+// as dirty and makes it writable again, so every later write to the page runs at full speed until the next call to
+// take_dirty_pages protects it again. The region must be page aligned, and it must not be written by system calls
+// (e.g. reading a file directly into it), since those fail on protected pages instead of faulting.
+//
+// If the region can't be protected, every page is reported as dirty, so snapshots still work but copy everything.
+class DirtyPageTracker {
+public:
+    DirtyPageTracker();
+    ~DirtyPageTracker();
+    DirtyPageTracker(const DirtyPageTracker&) = delete;
+    DirtyPageTracker& operator=(const DirtyPageTracker&) = delete;
+
+    // Starts tracking the given region, with every page initially dirty. Returns false if the region can't be write
+    // protected, in which case the tracker falls back to reporting every page.
+    bool start(uint8_t* base, size_t size);
+    // Stops tracking and makes the whole region writable again.
+    void stop();
+
+    bool is_started() const {
+        return region.load(std::memory_order_relaxed) != nullptr;
+    }
+
+    bool is_protected() const {
+        return write_protected.load(std::memory_order_relaxed);
+    }
+
+    uint8_t* base() const {
+        return region.load(std::memory_order_relaxed);
+    }
+
+    size_t page_size() const {
+        return page_bytes;
+    }
+
+    size_t num_pages() const {
+        return (region_size.load(std::memory_order_relaxed) + page_bytes - 1) / page_bytes;
+    }
+
+    // Number of write faults taken since tracking started.
+    uint64_t fault_count() const {
+        return num_faults.load(std::memory_order_relaxed);
+    }
+
+    // Appends the indices of the pages written since the last take_dirty_pages to out, without clearing them.
+    void peek_dirty_pages(std::vector<uint32_t>& out) const;
+    // Appends the indices of the pages written since the last take_dirty_pages to out, clears them and write protects
+    // those pages again. Writes that land after this returns are reported by the next call, so copying the returned
+    // pages afterwards captures every write made before it.
+    void take_dirty_pages(std::vector<uint32_t>& out);
+
+    // Page-aligned memory suitable for tracking, for benchmarks.
+    static uint8_t* allocate_region(size_t size);
+    static void free_region(uint8_t* base, size_t size);
+
+    // Called by the fault handler. Returns true if the address belongs to this tracker's region.
+    bool on_write_fault(uintptr_t address);
+private:
+    // The fault handler can run on any thread while start or stop runs on the owning one, so everything it reads is
+    // atomic. start publishes the region before write_protected, and the handler checks write_protected first.
+    std::atomic<uint8_t*> region = nullptr;
+    std::atomic_size_t region_size = 0;
+    const size_t page_bytes;
+    std::atomic_bool write_protected = false;
+    // One bit per page. An array is never freed before the tracker is destroyed, since a handler may still be using it
+    // after stop: a start that needs more bits than the current array holds moves to a bigger one and keeps the old one.
+    std::atomic<std::atomic_uint64_t*> dirty_bits = nullptr;
+    std::atomic_size_t dirty_words = 0;
+    std::vector<std::unique_ptr<std::atomic_uint64_t[]>> bit_arrays{};
+    std::atomic_uint64_t num_faults = 0;
+
+    size_t num_words() const {
+        return (num_pages() + 63) / 64;
+    }
+};
+
+// An in-memory copy of a region that's kept up to date with a DirtyPageTracker. The first save copies the whole region,
+// later saves only copy the pages written since the previous save or restore, and a restore only copies back the pages
+// written since then.
+class PageSnapshot {
+public:
+    // Copies the region into the snapshot. The region must stay the same until reset is called.
+    void save(uint8_t* base, size_t size);
+    // Copies the snapshot back into the region. Does nothing if nothing has been saved.
+    void restore();
+    // Drops the copy and stops tracking the region.
+    void reset();
+
+    bool valid() const {
+        return saved;
+    }
+
+    // Number of pages copied by the last save or restore.
+    size_t last_page_count() const {
+        return pages.size();
+    }
+private:
+    DirtyPageTracker tracker;
+    std::vector<uint8_t> copy;
+    std::vector<uint32_t> pages;
+    std::vector<uint32_t> restored_pages;
+    bool saved = false;
+
+    void copy_pages(uint8_t* dst, const uint8_t* src);
+};
+
+#endif
@@ -0,0 +1,634 @@
+#ifndef __FLAT_U32_MAP_H__
+#define __FLAT_U32_MAP_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <bit>
+#include <utility>
+#include <vector>
+
+// Position of a resumable iteration over a FlatU32Map, AdaptiveU32Set or slot map. A zeroed cursor starts a new
+// iteration.
+struct U32IterationCursor {
+    uint32_t position = 0;
+    bool key_order = false; // position is a key rather than a hash, see AdaptiveU32Set::visit_from.
+    bool finished = false;
+};
+
+// Open-addressing hash map with u32 keys, used as the backend of the mod data API's maps and sets.
+//
+// Entries are stored inline in a single power-of-two sized array and placed with Robin Hood linear probing: an entry
+// that's further from its home slot takes the place of one that's closer to its own. This keeps probe sequences short
+// and lets a lookup stop as soon as it reaches an entry that's closer to home than the key would be. Erasing shifts the
+// following entries back by one instead of leaving tombstones, so maps that see constant inserts and erases don't
+// degrade over time.
+template <typename ValueType>
+class FlatU32Map {
+public:
+    struct Slot {
+        uint32_t key;
+        uint32_t dist; // Distance from the key's home slot plus one, or 0 if the slot is empty.
+        ValueType value;
+    };
+
+    ValueType* find(uint32_t key) {
+        Slot* slot = find_slot(key);
+        return slot != nullptr ? &slot->value : nullptr;
+    }
+
+    bool contains(uint32_t key) {
+        return find_slot(key) != nullptr;
+    }
+
+    // Returns true if the key was newly inserted, false if an existing value was replaced.
+    bool insert_or_assign(uint32_t key, const ValueType& value) {
+        if (Slot* slot = find_slot(key)) {
+            slot->value = value;
+            return false;
+        }
+
+        reserve(count + 1);
+        insert_new(key, value);
+        count++;
+        return true;
+    }
+
+    bool erase(uint32_t key) {
+        Slot* slot = find_slot(key);
+        if (slot == nullptr) {
+            return false;
+        }
+
+        erase_at(static_cast<size_t>(slot - slots.data()));
+        return true;
+    }
+
+    void clear() {
+        for (Slot& slot : slots) {
+            slot = Slot{};
+        }
+        count = 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // Grows the table so that it can hold the given number of entries without exceeding the maximum load factor.
+    void reserve(size_t num_entries) {
+        size_t new_capacity = slots.empty() ? min_capacity : slots.size();
+        while (num_entries * max_load_den > new_capacity * max_load_num) {
+            new_capacity *= 2;
+        }
+        if (new_capacity != slots.size()) {
+            rehash(new_capacity);
+        }
+    }
+
+    // Slot-level access for iteration. Slot indices are only stable until the next insert or erase.
+    size_t capacity() const {
+        return slots.size();
+    }
+
+    const Slot& slot_at(size_t index) const {
+        return slots[index];
+    }
+
+    // Raw slot access for snapshots. When ValueType is trivially copyable, so is Slot, and a table can be saved and
+    // restored with a single copy of its slots.
+    const Slot* raw_slots() const {
+        return slots.data();
+    }
+
+    // Replaces the contents with a copy of slots previously read through raw_slots. Returns false and leaves the map
+    // empty if the slots don't describe a valid table.
+    bool assign_raw_slots(const Slot* raw, size_t capacity, size_t num_entries) {
+        clear_and_release();
+        if (capacity == 0) {
+            return num_entries == 0;
+        }
+        if (capacity < min_capacity || capacity > (size_t{1} << 31) || (capacity & (capacity - 1)) != 0) {
+            return false;
+        }
+
+        size_t num_occupied = 0;
+        for (size_t i = 0; i < capacity; i++) {
+            if (raw[i].dist > capacity) {
+                return false;
+            }
+            num_occupied += raw[i].dist != 0;
+        }
+        if (num_occupied != num_entries) {
+            return false;
+        }
+
+        slots.assign(raw, raw + capacity);
+        set_capacity_bits(capacity);
+        count = num_entries;
+        return true;
+    }
+
+    void erase_at(size_t index) {
+        // Backward shift: move every following entry that isn't in its home slot back by one.
+        while (true) {
+            size_t next = (index + 1) & mask;
+            Slot& next_slot = slots[next];
+            if (next_slot.dist <= 1) {
+                slots[index] = Slot{};
+                break;
+            }
+            slots[index] = std::move(next_slot);
+            slots[index].dist--;
+            index = next;
+        }
+        count--;
+    }
+
+    template <typename Func>
+    void for_each(Func&& func) const {
+        for (const Slot& slot : slots) {
+            if (slot.dist != 0) {
+                func(slot.key, slot.value);
+            }
+        }
+    }
+
+    // Keys are ordered by this hash for resumable iteration. It's a bijection on u32, so no two keys share a hash.
+    static uint32_t hash(uint32_t key) {
+        return key * 0x9E3779B9u;
+    }
+
+    // Visits up to max_count entries whose hash is at least start_hash, in increasing hash order, and returns the number
+    // visited. Sets next_hash to the position to resume from, or sets finished once every remaining entry was visited.
+    // The order doesn't depend on where entries are stored, so resuming visits every key that stayed in the map exactly
+    // once even if other keys were inserted or erased, or the table was rehashed, in between.
+    template <typename Func>
+    size_t visit_from_hash(uint32_t start_hash, size_t max_count, uint32_t& next_hash, bool& finished, Func&& func) const {
+        next_hash = start_hash;
+        finished = count == 0;
+        if (count == 0 || max_count == 0) {
+            return 0;
+        }
+
+        // Entries are stored in order of their home slot, except for the ones at the start of the table that wrapped
+        // around from the end. Collect entries from start_hash's home slot onwards, stopping once there are enough and
+        // the next entry's home slot is past the last collected one, since that entry and everything after it will
+        // have a higher hash.
+        std::vector<std::pair<uint32_t, size_t>> candidates;
+        candidates.reserve(max_count);
+        size_t last_home = start_hash >> shift;
+        bool scanned_all = true;
+        auto consider = [&](size_t index) {
+            const Slot& slot = slots[index];
+            uint32_t slot_hash = hash(slot.key);
+            size_t home = slot_hash >> shift;
+            if (candidates.size() >= max_count && home > last_home) {
+                return false;
+            }
+            if (slot_hash >= start_hash) {
+                candidates.emplace_back(slot_hash, index);
+                last_home = home;
+            }
+            return true;
+        };
+
+        for (size_t index = start_hash >> shift; index < slots.size() && scanned_all; index++) {
+            const Slot& slot = slots[index];
+            // Wrapped entries are handled below.
+            if (slot.dist != 0 && slot.dist - 1 <= index) {
+                scanned_all = consider(index);
+            }
+        }
+        for (size_t index = 0; index < slots.size() && scanned_all; index++) {
+            const Slot& slot = slots[index];
+            if (slot.dist == 0 || slot.dist - 1 <= index) {
+                break;
+            }
+            scanned_all = consider(index);
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+        size_t num_visited = std::min(max_count, candidates.size());
+        for (size_t i = 0; i < num_visited; i++) {
+            const Slot& slot = slots[candidates[i].second];
+            func(slot.key, slot.value);
+        }
+
+        if (num_visited == 0) {
+            finished = true;
+        }
+        else if (candidates[num_visited - 1].first == UINT32_MAX) {
+            finished = true;
+        }
+        else {
+            next_hash = candidates[num_visited - 1].first + 1;
+            finished = scanned_all && candidates.size() <= max_count;
+        }
+        return num_visited;
+    }
+
+private:
+    static constexpr size_t min_capacity = 16;
+    // Maximum load factor of 7/8, which Robin Hood probing handles without long probe sequences.
+    static constexpr size_t max_load_num = 7;
+    static constexpr size_t max_load_den = 8;
+
+    std::vector<Slot> slots{};
+    size_t count = 0;
+    size_t mask = 0;
+    uint32_t shift = 32;
+
+    size_t home_slot(uint32_t key) const {
+        // Fibonacci hashing: the top bits of the product are well mixed even for sequential keys.
+        return hash(key) >> shift;
+    }
+
+    Slot* find_slot(uint32_t key) {
+        if (count == 0) {
+            return nullptr;
+        }
+
+        size_t index = home_slot(key);
+        for (uint32_t dist = 1; ; dist++) {
+            Slot& slot = slots[index];
+            // An empty slot, or an entry closer to its home than the key would be, means the key isn't present.
+            if (slot.dist < dist) {
+                return nullptr;
+            }
+            if (slot.key == key) {
+                return &slot;
+            }
+            index = (index + 1) & mask;
+        }
+    }
+
+    void insert_new(uint32_t key, ValueType value) {
+        Slot cur{ key, 1, std::move(value) };
+        size_t index = home_slot(key);
+        while (true) {
+            Slot& slot = slots[index];
+            if (slot.dist == 0) {
+                slot = std::move(cur);
+                return;
+            }
+            if (slot.dist < cur.dist) {
+                std::swap(slot, cur);
+            }
+            cur.dist++;
+            index = (index + 1) & mask;
+        }
+    }
+
+    void set_capacity_bits(size_t capacity) {
+        mask = capacity - 1;
+        shift = 32;
+        for (size_t i = capacity; i > 1; i >>= 1) {
+            shift--;
+        }
+    }
+
+    void clear_and_release() {
+        slots.clear();
+        slots.shrink_to_fit();
+        count = 0;
+        mask = 0;
+        shift = 32;
+    }
+
+    void rehash(size_t new_capacity) {
+        std::vector<Slot> old_slots = std::move(slots);
+        slots.assign(new_capacity, Slot{});
+        set_capacity_bits(new_capacity);
+
+        for (Slot& slot : old_slots) {
+            if (slot.dist != 0) {
+                insert_new(slot.key, std::move(slot.value));
+            }
+        }
+    }
+};
+
+struct FlatU32SetEmpty {};
+
+// Set of u32 keys with the same layout and behavior as FlatU32Map.
+class FlatU32Set {
+private:
+    FlatU32Map<FlatU32SetEmpty> map{};
+public:
+    using Slot = FlatU32Map<FlatU32SetEmpty>::Slot;
+
+    bool contains(uint32_t key) {
+        return map.contains(key);
+    }
+
+    bool insert(uint32_t key) {
+        return map.insert_or_assign(key, FlatU32SetEmpty{});
+    }
+
+    bool erase(uint32_t key) {
+        return map.erase(key);
+    }
+
+    void clear() {
+        map.clear();
+    }
+
+    size_t size() const {
+        return map.size();
+    }
+
+    void reserve(size_t num_entries) {
+        map.reserve(num_entries);
+    }
+
+    size_t capacity() const {
+        return map.capacity();
+    }
+
+    bool occupied_at(size_t index) const {
+        return map.slot_at(index).dist != 0;
+    }
+
+    uint32_t key_at(size_t index) const {
+        return map.slot_at(index).key;
+    }
+
+    const Slot* raw_slots() const {
+        return map.raw_slots();
+    }
+
+    bool assign_raw_slots(const Slot* raw, size_t capacity, size_t num_entries) {
+        return map.assign_raw_slots(raw, capacity, num_entries);
+    }
+
+    template <typename Func>
+    void for_each(Func&& func) const {
+        map.for_each([&func](uint32_t key, const FlatU32SetEmpty&) { func(key); });
+    }
+
+    template <typename Func>
+    size_t visit_from_hash(uint32_t start_hash, size_t max_count, uint32_t& next_hash, bool& finished, Func&& func) const {
+        return map.visit_from_hash(start_hash, max_count, next_hash, finished,
+            [&func](uint32_t key, const FlatU32SetEmpty&) { func(key); });
+    }
+};
+
+// Set of u32 keys that's stored as a bitset while its keys are small and dense, and as a FlatU32Set otherwise.
+//
+// Sets start out as an empty bitset. A key past the end of the bitset grows it to the next power of two number of words,
+// as long as the key is below dense_key_limit and the bitset stays within max_dense_bytes_per_key bytes per key, which
+// is about what a FlatU32Set would need. Any other key converts the set to a FlatU32Set, and it stays one until it's
+// emptied. Contains, insert and erase are a single word operation in bitset mode.
+class AdaptiveU32Set {
+public:
+    static constexpr uint32_t dense_key_limit = 1u << 16;
+    // A FlatU32Set has at least 16 eight-byte slots, so a bitset of the same size is never worse.
+    static constexpr size_t min_dense_words = 16;
+    static constexpr size_t max_dense_bytes_per_key = 16;
+
+    bool contains(uint32_t key) {
+        if (!dense) {
+            return flat.contains(key);
+        }
+        size_t word = key / 64;
+        return word < bits.size() && (bits[word] >> (key % 64) & 1) != 0;
+    }
+
+    bool insert(uint32_t key) {
+        if (!dense) {
+            return flat.insert(key);
+        }
+
+        size_t word = key / 64;
+        if (word >= bits.size()) {
+            size_t num_words = std::bit_ceil(std::max(word + 1, min_dense_words));
+            size_t max_bytes = std::max(min_dense_words * sizeof(uint64_t), (count + 1) * max_dense_bytes_per_key);
+            if (key >= dense_key_limit || num_words * sizeof(uint64_t) > max_bytes) {
+                convert_to_flat();
+                return flat.insert(key);
+            }
+            bits.resize(num_words, 0);
+        }
+
+        uint64_t mask = uint64_t{1} << (key % 64);
+        if ((bits[word] & mask) != 0) {
+            return false;
+        }
+        bits[word] |= mask;
+        count++;
+        return true;
+    }
+
+    bool erase(uint32_t key) {
+        if (!dense) {
+            bool erased = flat.erase(key);
+            if (flat.size() == 0) {
+                clear();
+            }
+            return erased;
+        }
+
+        size_t word = key / 64;
+        uint64_t mask = uint64_t{1} << (key % 64);
+        if (word >= bits.size() || (bits[word] & mask) == 0) {
+            return false;
+        }
+        bits[word] &= ~mask;
+        count--;
+        return true;
+    }
+
+    void clear() {
+        flat = FlatU32Set{};
+        bits.clear();
+        bits.shrink_to_fit();
+        count = 0;
+        dense = true;
+    }
+
+    size_t size() const {
+        return dense ? count : flat.size();
+    }
+
+    // Only reserves space once the set is hashed, since a bitset's size depends on its keys rather than their number.
+    void reserve(size_t num_entries) {
+        if (!dense) {
+            flat.reserve(num_entries);
+        }
+    }
+
+    template <typename Func>
+    void for_each(Func&& func) const {
+        if (!dense) {
+            flat.for_each(func);
+            return;
+        }
+        for_each_dense(func);
+    }
+
+    // Resumable iteration. A hashed set is visited in hash order (see FlatU32Map::visit_from_hash) and a bitset in key
+    // order, walking the bits from the cursor, so a batch only costs the words it covers. The cursor records which order
+    // it's in, and resuming still visits every key that stayed in the set exactly once when the set changes mode:
+    // - A key order cursor on a hashed set means the set grew out of its bitset mid-iteration. It stays in key order,
+    //   picking the lowest remaining keys out of the hash table, which is a pass over the table per batch but only
+    //   happens for iterations that straddle the conversion.
+    // - A hash order cursor past the start on a bitset means the set was emptied since, which is the only way back to a
+    //   bitset, so none of the keys stayed and the iteration is finished.
+    template <typename Func>
+    size_t visit_from(U32IterationCursor& cursor, size_t max_count, Func&& func) const {
+        if (!cursor.key_order) {
+            if (!dense) {
+                return flat.visit_from_hash(cursor.position, max_count, cursor.position, cursor.finished, func);
+            }
+            if (cursor.position != 0) {
+                cursor.finished = true;
+                return 0;
+            }
+            cursor.key_order = true;
+        }
+        return dense ? visit_dense_from(cursor, max_count, func) : visit_flat_in_key_order(cursor, max_count, func);
+    }
+
+    // Access to the underlying storage for snapshots.
+    bool is_dense() const {
+        return dense;
+    }
+
+    const std::vector<uint64_t>& dense_words() const {
+        return bits;
+    }
+
+    const FlatU32Set& flat_set() const {
+        return flat;
+    }
+
+    // Replaces the contents with a bitset previously read through dense_words. Returns false and leaves the set empty
+    // if the bitset is too large to have been produced by this class.
+    bool assign_dense_words(std::vector<uint64_t> words) {
+        clear();
+        if (words.size() > dense_key_limit / 64) {
+            return false;
+        }
+        for (uint64_t word : words) {
+            count += std::popcount(word);
+        }
+        bits = std::move(words);
+        return true;
+    }
+
+    // Replaces the contents with hashed slots previously read through flat_set().raw_slots.
+    bool assign_raw_slots(const FlatU32Set::Slot* raw, size_t capacity, size_t num_entries) {
+        clear();
+        // Emptied sets always go back to being bitsets, so hashed slots must hold at least one key.
+        if (num_entries == 0) {
+            return false;
+        }
+        dense = false;
+        if (!flat.assign_raw_slots(raw, capacity, num_entries)) {
+            clear();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<uint64_t> bits{};
+    FlatU32Set flat{};
+    size_t count = 0;
+    bool dense = true;
+
+    template <typename Func>
+    void for_each_dense(Func&& func) const {
+        for (size_t word = 0; word < bits.size(); word++) {
+            uint64_t remaining = bits[word];
+            while (remaining != 0) {
+                func(static_cast<uint32_t>(word * 64 + std::countr_zero(remaining)));
+                remaining &= remaining - 1;
+            }
+        }
+    }
+
+    // Index of the first set bit at or after key, or bits.size() * 64 if there's none.
+    size_t next_dense_key(size_t key) const {
+        size_t word = key / 64;
+        if (word >= bits.size()) {
+            return bits.size() * 64;
+        }
+        uint64_t remaining = bits[word] & (~uint64_t{0} << (key % 64));
+        while (remaining == 0) {
+            if (++word == bits.size()) {
+                return bits.size() * 64;
+            }
+            remaining = bits[word];
+        }
+        return word * 64 + std::countr_zero(remaining);
+    }
+
+    template <typename Func>
+    size_t visit_dense_from(U32IterationCursor& cursor, size_t max_count, Func&& func) const {
+        size_t num_visited = 0;
+        size_t key = next_dense_key(cursor.position);
+        size_t end = bits.size() * 64;
+        while (key < end && num_visited < max_count) {
+            func(static_cast<uint32_t>(key));
+            num_visited++;
+            key = next_dense_key(key + 1);
+        }
+
+        // Stop at the next key, so finished is set as soon as the last key has been visited.
+        cursor.position = static_cast<uint32_t>(std::min(key, end));
+        cursor.finished = key >= end;
+        return num_visited;
+    }
+
+    template <typename Func>
+    size_t visit_flat_in_key_order(U32IterationCursor& cursor, size_t max_count, Func&& func) const {
+        if (max_count == 0) {
+            return 0;
+        }
+
+        // Keep the lowest max_count keys at or after the cursor in a max-heap.
+        std::vector<uint32_t> lowest;
+        lowest.reserve(std::min(max_count, flat.size()));
+        size_t num_remaining = 0;
+        flat.for_each([&](uint32_t key) {
+            if (key < cursor.position) {
+                return;
+            }
+            num_remaining++;
+            if (lowest.size() < max_count) {
+                lowest.push_back(key);
+                std::push_heap(lowest.begin(), lowest.end());
+            }
+            else if (key < lowest.front()) {
+                std::pop_heap(lowest.begin(), lowest.end());
+                lowest.back() = key;
+                std::push_heap(lowest.begin(), lowest.end());
+            }
+        });
+
+        std::sort_heap(lowest.begin(), lowest.end());
+        for (uint32_t key : lowest) {
+            func(key);
+        }
+
+        if (num_remaining <= lowest.size() || lowest.back() == UINT32_MAX) {
+            cursor.finished = true;
+        }
+        else {
+            cursor.position = lowest.back() + 1;
+        }
+        return lowest.size();
+    }
+
+    void convert_to_flat() {
+        flat.reserve(count + 1);
+        for_each_dense([this](uint32_t key) { flat.insert(key); });
+        bits.clear();
+        bits.shrink_to_fit();
+        dense = false;
+    }
+};
+
+#endif
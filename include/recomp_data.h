@@ -1,6 +1,11 @@
 #ifndef __RECOMP_DATA_H__
 #define __RECOMP_DATA_H__
 
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
 namespace recomputil {
     /*
     void init_extended_actor_data();
@@ -8,6 +13,28 @@ namespace recomputil {
     */
 
     void register_data_api_exports();
+
+    // Appends a snapshot of every data API container to out. Handles and slotmap keys stay valid across a save and
+    // load. Memory maps point into RDRAM, so a snapshot must be loaded together with the RDRAM from the same moment.
+    void save_data_snapshot(std::vector<uint8_t>& out);
+    // Replaces every data API container with the contents of a snapshot. Must be called while the game isn't running
+    // mod code. Returns false if the snapshot is invalid, in which case the containers are left in an unspecified state.
+    bool load_data_snapshot(std::span<const uint8_t> data);
+
+    struct DataContainerStats {
+        const char* type;
+        size_t containers;
+        size_t total_entries;
+        size_t max_entries;
+    };
+
+    // Returns the number of live containers of each type and how many entries they hold.
+    std::vector<DataContainerStats> get_data_container_stats();
+
+    // Compares the data API's map backend against std::unordered_map, prints the results and returns a short summary.
+    std::string benchmark_data_containers();
+    // Measures read throughput of the data API containers from multiple threads, prints the results and returns a short summary.
+    std::string benchmark_data_contention();
 }
 
 #endif
@@ -1,7 +1,9 @@
 #ifndef __RECOMP_INPUT_H__
 #define __RECOMP_INPUT_H__
 
+#include <array>
 #include <cstdint>
+#include <filesystem>
 #include <variant>
 #include <vector>
 #include <type_traits>
@@ -43,7 +45,8 @@ namespace recomp {
     #define DEFINE_RECOMP_UI_INPUTS() \
         DEFINE_INPUT(TOGGLE_MENU, 0, "Toggle Menu") \
         DEFINE_INPUT(ACCEPT_MENU, 0, "Accept (Menu)") \
-        DEFINE_INPUT(APPLY_MENU, 0, "Apply (Menu)")
+        DEFINE_INPUT(APPLY_MENU, 0, "Apply (Menu)") \
+        DEFINE_INPUT(REWIND, 0, "Rewind")
 
     #define DEFINE_ALL_INPUTS() \
         DEFINE_N64_BUTTON_INPUTS() \
@@ -119,6 +122,7 @@ namespace recomp {
         std::vector<InputField> toggle_menu;
         std::vector<InputField> accept_menu;
         std::vector<InputField> apply_menu;
+        std::vector<InputField> rewind;
     };
 
     inline const std::vector<InputField>& get_default_mapping_for_input(const DefaultN64Mappings& defaults, const GameInput input) {
@@ -145,6 +149,7 @@ namespace recomp {
             case GameInput::TOGGLE_MENU: return defaults.toggle_menu;
             case GameInput::ACCEPT_MENU: return defaults.accept_menu;
             case GameInput::APPLY_MENU: return defaults.apply_menu;
+            case GameInput::REWIND: return defaults.rewind;
             default: return empty_input_field;
         }
     }
@@ -174,6 +179,11 @@ namespace recomp {
     void set_input_controller_guid(int controller_num, const ControllerGUID& guid);
     ControllerGUID get_input_controller_guid(int controller_num);
 
+    // Controller assignments are cached and only rebuilt when controllers are added or removed, or when the configured
+    // controller GUIDs change. Invalidating defers the rebuild to the next poll, refreshing rebuilds immediately.
+    void invalidate_controller_assignments();
+    void refresh_controller_assignments();
+
     struct ControllerOption {
         std::string name;
         ControllerGUID guid;
@@ -183,8 +193,21 @@ namespace recomp {
     const std::vector<ControllerOption>& get_controller_options();
 
     bool get_n64_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out);
+
+    // The N64 bindings of each player are compiled into flat tables (key and controller button to N64 button bits, axis
+    // lists for the stick) whenever they change, so get_n64_input costs a few mask operations instead of a walk over
+    // every bound InputField. Compiling and reading must happen on the same thread.
+    using InputFieldSpans = std::array<std::span<const InputField>, static_cast<size_t>(GameInput::COUNT)>;
+    void compile_n64_bindings(int controller_num, const InputFieldSpans& keyboard_fields, const InputFieldSpans& controller_fields);
+    void get_compiled_n64_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out);
+    // Times get_n64_input through the compiled tables against evaluating every InputField, on private bindings and
+    // generated input snapshots so it can run on any thread. Returns a readable summary.
+    std::string benchmark_n64_input(int controller_num, int iterations);
+    std::string benchmark_compiled_n64_input(int controller_num, const InputFieldSpans& keyboard_fields, const InputFieldSpans& controller_fields, int iterations);
     void set_rumble(int controller_num, bool);
+    // Called once per VI. Rumble is sent to the controllers from a worker thread, stop it once the game has exited.
     void update_rumble();
+    void stop_rumble_worker();
     void handle_events();
 
     // Opens all currently connected controllers (useful at startup, since hotplug events alone may miss pre-connected devices).
@@ -233,6 +256,42 @@ namespace recomp {
     BackgroundInputMode get_background_input_mode();
     void set_background_input_mode(BackgroundInputMode mode);
 
+    // Recording and replay of the N64 controller data the game reads. The logged_ functions wrap the input callbacks:
+    // each poll samples all four ports once, from live input or from the replay, and reads return that sample until the
+    // next poll. They pass straight through to live input when nothing is being recorded or replayed.
+    bool start_input_recording(const std::filesystem::path& path);
+    bool start_input_replay(const std::filesystem::path& path);
+    void stop_input_log();
+    void poll_logged_inputs();
+    bool get_logged_n64_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out);
+    ultramodern::input::connected_device_info_t get_logged_device_info(int controller_num);
+
+    // Delay-based netplay. Every instance runs the game and exchanges controller data over UDP with the other players,
+    // either directly (2 players) or through netplay_relay. The local controller plays as local_player (0-based), and
+    // its input reaches the game input_delay polls after it's sampled on every instance. Used by the logged_ functions,
+    // so a netplay session can also be recorded. Waits for every other player to start before returning, and fails if
+    // they don't in time. Player 1 sends save to the others, whose save is replaced with it.
+    bool start_netplay(uint32_t local_player, uint32_t num_players, const std::string& remote_address, uint16_t local_port,
+        uint32_t input_delay, std::vector<uint8_t>& save);
+    void stop_netplay();
+    bool netplay_active();
+    // Exchanges inputs for the next frame, waiting for the other players if needed.
+    void netplay_on_poll();
+    // The input for a port on the current frame. Ports past the player count aren't present.
+    bool get_netplay_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out);
+    std::string get_netplay_stats();
+
+    // Input latency measurement mode. Injects synthetic presses of the given N64 button(s) on port 1 at random times and
+    // reports how long each takes to reach the game's poll, the game's controller read, the game's handling of the press
+    // (recomp_input_latency_on_pad_update, hooked into the game), the display list of that frame and the screen update
+    // that shows it. The hooks below are called at each of those points and do nothing when it isn't running.
+    void start_input_latency_measurement(uint16_t button);
+    void stop_input_latency_measurement();
+    void input_latency_on_poll();
+    void input_latency_on_read(int controller_num, uint16_t* buttons);
+    void input_latency_on_send_dl();
+    void input_latency_on_present();
+
     
     bool get_single_controller_mode();
     void set_single_controller_mode(bool single_controller);
@@ -0,0 +1,109 @@
+#ifndef __RECOMP_TELEMETRY_H__
+#define __RECOMP_TELEMETRY_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "librecomp/helpers.hpp"
+#include "librecomp/overlays.hpp"
+
+// Optional counters for the exports that mods call (the recomputil_* data API and the recompui_* UI API).
+//
+// Exports are registered through register_timed_export, which registers a wrapper that forwards to the export. While
+// telemetry is off the wrapper only checks a flag. While it's on, every call is counted under the export's name and the
+// address it was called from (the return address in ra), which lies in the calling mod's code. For each pair the call
+// count, total and longest time spent in the export and the time spent waiting on data API locks are recorded.
+namespace recomputil {
+    extern std::atomic_bool api_telemetry_active;
+
+    uint32_t add_telemetry_export(const char* name);
+    void record_export_call(uint32_t export_id, uint32_t caller, uint64_t elapsed_ns, uint64_t lock_wait_ns);
+
+    // Time spent by the current thread waiting for data API locks, accumulated by TimedMutex.
+    inline thread_local uint64_t lock_wait_ns = 0;
+
+    template <recomp_func_t* Func>
+    inline uint32_t timed_export_id = 0;
+
+    template <recomp_func_t* Func>
+    void timed_export(uint8_t* rdram, recomp_context* ctx) {
+        if (!api_telemetry_active.load(std::memory_order_relaxed)) {
+            Func(rdram, ctx);
+            return;
+        }
+
+        // Read ra before the call, since the export is free to clobber it.
+        uint32_t caller = static_cast<uint32_t>(ctx->r31);
+        // Exports can run mod callbacks that call other exports, so the outer call's lock wait includes the inner one's.
+        uint64_t outer_lock_wait_ns = lock_wait_ns;
+        lock_wait_ns = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        Func(rdram, ctx);
+
+        uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        uint64_t call_lock_wait_ns = lock_wait_ns;
+        lock_wait_ns = outer_lock_wait_ns + call_lock_wait_ns;
+        record_export_call(timed_export_id<Func>, caller, elapsed_ns, call_lock_wait_ns);
+    }
+
+    template <recomp_func_t* Func>
+    void register_timed_export(const char* name) {
+        timed_export_id<Func> = add_telemetry_export(name);
+        recomp::overlays::register_base_export(name, timed_export<Func>);
+    }
+
+    // Mutex wrapper that adds the time spent blocked on the lock to lock_wait_ns. Uncontended acquisitions only cost
+    // the try_lock, so the timing is always on and telemetry decides whether to report it.
+    template <typename MutexType>
+    class TimedMutex {
+    private:
+        MutexType mutex{};
+
+        static void add_wait(std::chrono::steady_clock::time_point start) {
+            lock_wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+    public:
+        void lock() {
+            if (!mutex.try_lock()) {
+                auto start = std::chrono::steady_clock::now();
+                mutex.lock();
+                add_wait(start);
+            }
+        }
+
+        bool try_lock() {
+            return mutex.try_lock();
+        }
+
+        void unlock() {
+            mutex.unlock();
+        }
+
+        void lock_shared() {
+            if (!mutex.try_lock_shared()) {
+                auto start = std::chrono::steady_clock::now();
+                mutex.lock_shared();
+                add_wait(start);
+            }
+        }
+
+        bool try_lock_shared() {
+            return mutex.try_lock_shared();
+        }
+
+        void unlock_shared() {
+            mutex.unlock_shared();
+        }
+    };
+
+    // Clears the counters and starts counting export calls.
+    void start_api_telemetry();
+    // Stops counting, prints a report, writes the counters and current data API container sizes to api_telemetry.json
+    // in the app folder and returns a short summary.
+    std::string stop_api_telemetry();
+}
+
+#endif
@@ -125,6 +125,8 @@ namespace recompui {
     void get_window_size(int& width, int& height);
     void set_cursor_visible(bool visible);
     void update_supported_options();
+    // Shows the result of a debug tab benchmark once its worker thread is done. Called from the UI thread every frame.
+    void update_debug_benchmarks();
     void toggle_fullscreen();
 
     bool get_cont_active(void);
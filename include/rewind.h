@@ -0,0 +1,27 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "librecomp/helpers.hpp"
+
+// Hooks between the rewind buffer and the quicksave handshake, which captures and restores the game's threads.
+namespace zelda64 {
+    using ThreadContexts = std::vector<std::pair<int32_t, recomp_context>>;
+
+    // Asks the handshake to capture a rewind snapshot, or to restore one with the given thread contexts. Return false
+    // if another quicksave action is already pending.
+    bool request_rewind_capture();
+    bool request_rewind_step(const ThreadContexts& contexts);
+
+    // Called by the main thread of the handshake once every other thread has saved or restored its context.
+    void rewind_capture(uint8_t* rdram, const std::unordered_map<int32_t, recomp_context>& contexts);
+    void rewind_step(uint8_t* rdram);
+    // Called instead of rewind_step when the handshake gives up on a requested step.
+    void rewind_step_cancelled();
+}
+
+#endif
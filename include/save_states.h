@@ -0,0 +1,74 @@
+#ifndef __SAVE_STATES_H__
+#define __SAVE_STATES_H__
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "librecomp/helpers.hpp"
+
+// Save-state files.
+//
+// The quicksave handshake captures the game's state into a SaveStateImage, which is handed to a background thread that
+// compresses it and writes it to disk, so the game thread only pays for copying RDRAM into memory. Loading reads the
+// small parts of the file up front and decompresses RDRAM block by block directly into RDRAM during the handshake.
+//
+// File format (host byte order, only loaded by builds with the same recomp_context layout):
+//   header:   char[8] "DM64SST", u32 version, u32 sizeof(recomp_context), u64 ROM hash, u32 RDRAM size,
+//             u32 block size, u32 context count, u32 data API snapshot size
+//   contexts: for each permanent thread: i32 thread id, recomp_context
+//   data:     the data API snapshot
+//   RDRAM:    for each block: u32 compressed size (top bit set if the block is stored uncompressed), block data
+// Blocks are compressed independently with an LZ4-style compressor, so they can be decompressed as they're read.
+namespace zelda64 {
+    struct SaveStateImage {
+        std::vector<uint8_t> rdram;
+        std::vector<std::pair<int32_t, recomp_context>> contexts;
+        std::vector<uint8_t> data;
+    };
+
+    // Returns an image to fill in, reusing the buffers of images that have already been written.
+    std::unique_ptr<SaveStateImage> acquire_save_state_image();
+    // Queues an image to be compressed and written to the given path on the save-state writer thread.
+    void queue_save_state_write(const std::filesystem::path& path, std::unique_ptr<SaveStateImage> image);
+    // Writes every queued save state and stops the writer thread. Called on exit.
+    void stop_save_state_writer();
+
+    class SaveStateReader {
+    public:
+        // Reads and validates everything up to the RDRAM blocks. Returns false if the file is missing or invalid.
+        bool open(const std::filesystem::path& path);
+        // Decompresses the RDRAM blocks into rdram. Returns false if the file is truncated or corrupt, in which case
+        // rdram is left untouched.
+        bool read_rdram(uint8_t* rdram, size_t rdram_size);
+
+        const std::vector<std::pair<int32_t, recomp_context>>& contexts() const {
+            return saved_contexts;
+        }
+
+        std::span<const uint8_t> data() const {
+            return saved_data;
+        }
+    private:
+        std::ifstream file;
+        uint32_t saved_rdram_size = 0;
+        uint32_t block_size = 0;
+        std::vector<std::pair<int32_t, recomp_context>> saved_contexts;
+        std::vector<uint8_t> saved_data;
+    };
+
+    // Compresses src with the save-state block compressor. dst must hold at least max_compressed_size(src.size())
+    // bytes. hash_table is scratch space, passed in so that compressing many blocks only allocates it once. Returns the
+    // compressed size.
+    size_t compress_block(std::span<const uint8_t> src, uint8_t* dst, std::vector<uint32_t>& hash_table);
+    size_t max_compressed_size(size_t src_size);
+    // Decompresses a block produced by compress_block into dst, which must be exactly the original size. Returns false
+    // if the block is corrupt.
+    bool decompress_block(std::span<const uint8_t> src, std::span<uint8_t> dst);
+}
+
+#endif
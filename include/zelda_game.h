@@ -2,12 +2,46 @@
 #define __ZELDA_GAME_H__
 
 #include <cstdint>
+#include <filesystem>
 #include <span>
+#include <string>
 #include <vector>
 
 namespace zelda64 {
+    // Hash of the supported ROM, stored in save states to reject ones made with a different game.
+    constexpr uint64_t rom_hash = 0x960e3703f29d996dULL;
+
     void quicksave_save();
     void quicksave_load();
+    // Saves the game's state to a compressed file in the background. Returns false if another quicksave action is
+    // already pending.
+    bool save_state_to_file(const std::filesystem::path& path);
+    // Loads the game's state from a file written by save_state_to_file. Returns false if the file is invalid or another
+    // quicksave action is already pending.
+    bool load_state_from_file(const std::filesystem::path& path);
+    // Measures full and incremental quicksave times on a simulated frame, prints the results and returns a short summary.
+    std::string benchmark_quicksave();
+    // Measures the per-frame snapshot and restore cost that running 1 to 3 frames ahead would add, prints the results and
+    // returns a short summary. Run-ahead itself isn't implemented.
+    std::string benchmark_run_ahead();
+    // Rewind keeps a few seconds of the game's history in memory while enabled, and steps back through it while the
+    // rewind button is held. rewind_on_vi drives it from the VI thread.
+    void set_rewind_enabled(bool enabled);
+    bool get_rewind_enabled();
+    void set_rewind_held(bool held);
+    void rewind_on_vi();
+    // Seconds of history held, memory used and capture and step times.
+    std::string get_rewind_stats();
+    // Checks the ROM stored in the app folder, skipping the full hash if it's unchanged since it was last verified.
+    bool is_stored_rom_valid(const std::u8string& game_id);
+    // Remembers the stored ROM as verified, after the runtime has checked it.
+    void record_verified_rom(const std::u8string& game_id);
+    // Flushes the EEPROM cache and stops its writer thread. Called on exit.
+    void stop_eeprom_cache();
+    // The EEPROM contents, loading the game's save file if needed.
+    std::vector<uint8_t> get_eeprom_image(const std::u8string& game_id);
+    // Replaces the EEPROM contents with image for this session without ever writing it to the save file.
+    void use_temporary_eeprom_image(const std::u8string& game_id, const std::vector<uint8_t>& image);
     // std::vector<uint8_t> decompress_mm(std::span<const uint8_t> compressed_rom);
 };
 
@@ -0,0 +1,255 @@
+#include "patches.h"
+#include "misc_funcs.h"
+#include "rt64_extended_gbi.h"
+#include "theboy181_workspace.h"
+
+/*
+ * Texture atlases for SAnimeState character and virus animations.
+ *
+ * The original animeState_draw picks a TiTexData per frame and reloads both its CI4 texels and the TLUT every time,
+ * so each animation frame is a different texture as far as the renderer is concerned. Instead, every frame of a
+ * character is copied the first time it's shown into a single CI4 atlas (one per character), with the frames stacked
+ * vertically. Drawing a frame is then a tile load at a V offset of the same resident image, which keeps the texture
+ * address and width stable across frames for RT64's texture cache and interpolation. Frames taller than TMEM allows
+ * are loaded and drawn in bands like any other large CI4 texture. When a draw directly follows another one, the TLUT
+ * and texels that are still in TMEM from it aren't loaded again, which is the common case for a character drawn
+ * more than once in a row with the same frame.
+ *
+ * The atlas is filled lazily instead of ahead of time because the frame count of a character isn't stored anywhere
+ * in SAnimeState; frames that don't fit in the atlas are drawn straight from their TiTexData like before.
+ *
+ * Characters are loaded into shared segment buffers, so the same texArray can hold a different character after a
+ * scene change. The runtime counts calls to animeState_load (hooked in drmario64.us.toml), and all atlases are thrown
+ * away once whenever that count changes, so drawing never has to look at the source texels again.
+ */
+
+#define ANIME_ATLAS_COUNT 8
+#define ANIME_ATLAS_SIZE 0x20000
+#define ANIME_ATLAS_MAX_FRAMES 96
+// CI4 texture rows need to be 8 byte aligned, so the atlas width is a multiple of 16 pixels.
+#define ANIME_ATLAS_WIDTH_ALIGN 16
+// The TLUT takes the upper half of TMEM, leaving 2 KB for CI4 texels.
+#define ANIME_TMEM_TEXEL_BYTES 0x800
+
+typedef struct AnimeAtlasFrame {
+    u16 v;
+    u16 height;
+    u16 width;
+    u8 packed;
+} AnimeAtlasFrame;
+
+typedef struct AnimeAtlas {
+    TiTexData *tex_array;
+    CharAnimeMode anime_mode;
+    u32 last_used;
+    s32 width;
+    s32 used_rows;
+    AnimeAtlasFrame frames[ANIME_ATLAS_MAX_FRAMES];
+    u8 texels[ANIME_ATLAS_SIZE] __attribute__((aligned(8)));
+} AnimeAtlas;
+
+static AnimeAtlas anime_atlases[ANIME_ATLAS_COUNT];
+static u32 anime_atlas_clock = 0;
+static u32 anime_atlas_load_generation = 0;
+
+// What the last draw left in TMEM, valid while the display list continues right where that draw ended.
+static Gfx *anime_tmem_end = NULL;
+static const void *anime_tmem_tlut = NULL;
+static const void *anime_tmem_texels = NULL;
+static s32 anime_tmem_width;
+static s32 anime_tmem_height;
+static s32 anime_tmem_row;
+static s32 anime_tmem_row_end;
+
+static void anime_atlas_reset(AnimeAtlas *atlas) {
+    s32 i;
+
+    atlas->width = 0;
+    atlas->used_rows = 0;
+    if (anime_tmem_texels == atlas->texels) {
+        anime_tmem_texels = NULL;
+    }
+    for (i = 0; i < ANIME_ATLAS_MAX_FRAMES; i++) {
+        atlas->frames[i].packed = false;
+    }
+}
+
+static AnimeAtlas *anime_atlas_find(SAnimeState *animeState) {
+    TiTexData *tex_array = animeState->texArray;
+    AnimeAtlas *oldest = &anime_atlases[0];
+    s32 i;
+
+    anime_atlas_clock++;
+
+    // A character was loaded since the last draw, possibly over the buffers of one that's cached.
+    if (recomp_get_anime_load_generation() != anime_atlas_load_generation) {
+        anime_atlas_load_generation = recomp_get_anime_load_generation();
+        for (i = 0; i < ANIME_ATLAS_COUNT; i++) {
+            anime_atlases[i].tex_array = NULL;
+            anime_atlases[i].last_used = 0;
+        }
+        anime_tmem_end = NULL;
+    }
+
+    for (i = 0; i < ANIME_ATLAS_COUNT; i++) {
+        AnimeAtlas *atlas = &anime_atlases[i];
+        if (atlas->tex_array == tex_array && atlas->anime_mode == animeState->animeMode) {
+            atlas->last_used = anime_atlas_clock;
+            return atlas;
+        }
+        if (atlas->last_used < oldest->last_used) {
+            oldest = atlas;
+        }
+    }
+
+    // Not cached, so recycle the least recently used atlas.
+    oldest->tex_array = tex_array;
+    oldest->anime_mode = animeState->animeMode;
+    oldest->last_used = anime_atlas_clock;
+    anime_atlas_reset(oldest);
+    return oldest;
+}
+
+/* Returns the atlas frame for the given texture, copying it into the atlas first if needed. NULL if it doesn't fit. */
+static AnimeAtlasFrame *anime_atlas_pack(AnimeAtlas *atlas, s32 texture_no) {
+    AnimeAtlasFrame *frame;
+    TiTexData *tex;
+    s32 width, height, src_row_bytes, dst_row_bytes;
+    const u8 *src;
+    u8 *dst;
+    s32 row, b;
+
+    if (texture_no < 0 || texture_no >= ANIME_ATLAS_MAX_FRAMES) {
+        return NULL;
+    }
+
+    frame = &atlas->frames[texture_no];
+    tex = &atlas->tex_array[texture_no];
+    if (frame->packed) {
+        return frame;
+    }
+
+    width = tex->info[TI_INFO_IDX_WIDTH];
+    height = tex->info[TI_INFO_IDX_HEIGHT];
+
+    // The first frame decides the atlas width; all frames of a character share the same canvas size in practice.
+    if (atlas->width == 0) {
+        atlas->width = (width + ANIME_ATLAS_WIDTH_ALIGN - 1) & ~(ANIME_ATLAS_WIDTH_ALIGN - 1);
+    }
+    if (width > atlas->width) {
+        return NULL;
+    }
+
+    dst_row_bytes = atlas->width / 2;
+    if ((atlas->used_rows + height) * dst_row_bytes > ANIME_ATLAS_SIZE) {
+        return NULL;
+    }
+
+    src_row_bytes = (width + 1) / 2;
+    src = tex->texs[TI_TEX_TEX];
+    dst = &atlas->texels[atlas->used_rows * dst_row_bytes];
+    for (row = 0; row < height; row++) {
+        for (b = 0; b < src_row_bytes; b++) {
+            dst[b] = src[b];
+        }
+        src += src_row_bytes;
+        dst += dst_row_bytes;
+    }
+    osWritebackDCache(&atlas->texels[atlas->used_rows * dst_row_bytes], height * dst_row_bytes);
+
+    frame->v = atlas->used_rows;
+    frame->width = width;
+    frame->height = height;
+    frame->packed = true;
+    atlas->used_rows += height;
+
+    return frame;
+}
+
+RECOMP_PATCH void animeState_draw(SAnimeState *animeState, Gfx **gfxP, f32 x, f32 y, f32 scaleX, f32 scaleY) {
+    Gfx *gfx = *gfxP;
+    TiTexData *tex = &animeState->texArray[animeState->animeSeq.textureNo];
+    AnimeAtlas *atlas = anime_atlas_find(animeState);
+    AnimeAtlasFrame *frame = anime_atlas_pack(atlas, animeState->animeSeq.textureNo);
+    s32 width = tex->info[TI_INFO_IDX_WIDTH];
+    s32 height = tex->info[TI_INFO_IDX_HEIGHT];
+    // Bytes per TMEM line of a loaded tile, which is padded to 8 bytes.
+    s32 line_bytes = ((width + 15) / 16) * 8;
+    s32 band_rows = ANIME_TMEM_TEXEL_BYTES / line_bytes;
+    f32 left, right, base_y;
+    s32 s, dsdx, dtdy;
+    s32 row;
+    // Anything else emitted since the last draw may have replaced what it left in TMEM.
+    s32 follows_last_draw = (gfx == anime_tmem_end);
+
+    gDPSetPrimColor(gfx++, 0, 0, animeState->primColor[0], animeState->primColor[1], animeState->primColor[2],
+                    animeState->primColor[3]);
+    if (!follows_last_draw || anime_tmem_tlut != tex->texs[TI_TEX_TLUT]) {
+        gDPLoadTLUT_pal16(gfx++, 0, tex->texs[TI_TEX_TLUT]);
+        anime_tmem_tlut = tex->texs[TI_TEX_TLUT];
+    }
+    if (!follows_last_draw) {
+        anime_tmem_texels = NULL;
+    }
+
+    left = x - animeState->center.cx * scaleX;
+    right = left + width * scaleX;
+    s = 0;
+    dsdx = (s32)((1 << 10) / scaleX);
+    dtdy = (s32)((1 << 10) / scaleY);
+
+    // Mirrored frames: swap the edges and walk the texture backwards from the far side.
+    if (scaleX < 0.0f) {
+        f32 tmp = left;
+        left = right;
+        right = tmp;
+        s = (width - 1) << 5;
+    }
+
+    // Screen Y of texture row 0. Each band covers rows [row, row_end) of the frame.
+    base_y = y - animeState->center.cy * scaleY;
+    for (row = 0; row < height; row += band_rows) {
+        s32 row_end = (row + band_rows < height) ? row + band_rows : height;
+        f32 band_top = base_y + row * scaleY;
+        f32 band_bottom = base_y + row_end * scaleY;
+        s32 v = (frame != NULL) ? frame->v : 0;
+        const void *texels = (frame != NULL) ? (const void *)atlas->texels : (const void *)tex->texs[TI_TEX_TEX];
+        s32 t;
+
+        // Only a single band frame can still be resident, since every band replaces the previous one.
+        if (anime_tmem_texels != texels || anime_tmem_width != width || anime_tmem_height != height ||
+            anime_tmem_row != v + row || anime_tmem_row_end != v + row_end) {
+            if (frame != NULL) {
+                gDPLoadTextureTile_4b(gfx++, atlas->texels, G_IM_FMT_CI, atlas->width, atlas->used_rows,
+                                      0, v + row, width - 1, v + row_end - 1, 0,
+                                      G_TX_NOMIRROR | G_TX_CLAMP, G_TX_NOMIRROR | G_TX_CLAMP,
+                                      G_TX_NOMASK, G_TX_NOMASK, G_TX_NOLOD, G_TX_NOLOD);
+            }
+            else {
+                gDPLoadTextureTile_4b(gfx++, tex->texs[TI_TEX_TEX], G_IM_FMT_CI, width, height,
+                                      0, row, width - 1, row_end - 1, 0,
+                                      G_TX_NOMIRROR | G_TX_CLAMP, G_TX_NOMIRROR | G_TX_CLAMP,
+                                      G_TX_NOMASK, G_TX_NOMASK, G_TX_NOLOD, G_TX_NOLOD);
+            }
+            anime_tmem_texels = texels;
+            anime_tmem_width = width;
+            anime_tmem_height = height;
+            anime_tmem_row = v + row;
+            anime_tmem_row_end = v + row_end;
+        }
+
+        t = (v + row) << 5;
+        if (scaleY < 0.0f) {
+            f32 tmp = band_top;
+            band_top = band_bottom;
+            band_bottom = tmp;
+            t = (v + row_end - 1) << 5;
+        }
+
+        gSPScisTextureRectangle(gfx++, (s32)(left * 4), (s32)(band_top * 4), (s32)(right * 4), (s32)(band_bottom * 4),
+                                G_TX_RENDERTILE, s, t, dsdx, dtdy);
+    }
+
+    anime_tmem_end = gfx;
+    *gfxP = gfx;
+}
@@ -0,0 +1,31 @@
+#include "patches.h"
+#include "misc_funcs.h"
+#include "PR/os_eeprom.h"
+
+/*
+ * EEPROM access through the native write-back cache (src/game/eeprom_cache.cpp).
+ *
+ * The game's libultra EEPROM functions are reimplemented by the runtime rather than recompiled, so they're force
+ * patched here to hand every access to the cache instead. The message queue is only used by the original to talk to
+ * the SI, so it's ignored.
+ */
+
+RECOMP_FORCE_PATCH s32 osEepromProbe(OSMesgQueue *mq) {
+    return recomp_eeprom_probe();
+}
+
+RECOMP_FORCE_PATCH s32 osEepromRead(OSMesgQueue *mq, u8 address, u8 *buffer) {
+    return recomp_eeprom_read(address, buffer, EEPROM_BLOCK_SIZE);
+}
+
+RECOMP_FORCE_PATCH s32 osEepromWrite(OSMesgQueue *mq, u8 address, u8 *buffer) {
+    return recomp_eeprom_write(address, buffer, EEPROM_BLOCK_SIZE);
+}
+
+RECOMP_FORCE_PATCH s32 osEepromLongRead(OSMesgQueue *mq, u8 address, u8 *buffer, int length) {
+    return recomp_eeprom_read(address, buffer, length);
+}
+
+RECOMP_FORCE_PATCH s32 osEepromLongWrite(OSMesgQueue *mq, u8 address, u8 *buffer, int length) {
+    return recomp_eeprom_write(address, buffer, length);
+}
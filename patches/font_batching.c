@@ -0,0 +1,387 @@
+#include "patches.h"
+#include "misc_funcs.h"
+#include "rt64_extended_gbi.h"
+
+/*
+ * Font atlases for the in-game text renderer.
+ *
+ * The original fontXX_drawID/fontAsc_drawID load the glyph's own texture and draw one rectangle for every character.
+ * Every piece of text goes through them one glyph at a time: the string functions (fontXX_draw, fontAsc_draw), story
+ * dialogue (msgWnd_draw) and the VS HUD (draw_count_number, scoreNums_draw), so dialogue and the score HUD end up
+ * generating hundreds of texture loads per frame.
+ *
+ * The first time a font is drawn, its glyphs are copied once into an atlas made of TMEM-sized I4 pages, with a blank
+ * texel gutter around each glyph so filtering never picks up a neighbour. Drawing a glyph is then a texture rectangle
+ * into the page that holds it, and the page is only loaded when it isn't already the last thing loaded into TMEM. This
+ * is checked by looking at the display list itself: if everything emitted since the last page load is a sync, a color
+ * change or a texture rectangle, the page is still loaded. That way per-character color and alpha (set by the callers
+ * between glyphs) don't break up the batch, and anything else that touches TMEM or the tiles does. The atlas pages
+ * never move or change, so RT64 sees the same few textures every frame.
+ *
+ * The rectangle covers the same pixels and maps the same texels as the original, so output at native resolution is
+ * unchanged. fontXX_drawID2/fontAsc_drawID2 (used by the _draw2 string functions) are patched the same way. They take
+ * the same arguments, and the _draw2 look comes from the render state the caller sets up with font16_initDL2, which is
+ * left alone.
+ *
+ * On top of that, a string's glyphs are merged into strips. When a glyph is drawn at native size right after the
+ * previous one (same font, same line, the next position along it, and nothing else emitted in between), it's appended
+ * to the previous glyph's strip instead: its texels are copied next to the others in a strip texture, and the strip's
+ * load and rectangle are emitted again in place, one glyph wider. A run of text ends up as one load and one
+ * rectangle. Per-character color changes emit commands between glyphs, so they start a new strip, and scaled
+ * or fractional positions fall back to drawing from the atlas.
+ *
+ * A run reuses any strip that starts with its glyphs, so a string drawn every frame keeps the same strip and texture
+ * address, and a string that grows a character at a time only appends to it. A strip is only recycled once it hasn't been drawn for FONT_STRIP_MIN_AGE, so the RDP has
+ * long finished with any display list that still points at it.
+ */
+
+#define FONT_ATLAS_PAGE_WIDTH 128
+#define FONT_ATLAS_PAGE_HEIGHT 64
+#define FONT_ATLAS_PAGE_SIZE (FONT_ATLAS_PAGE_WIDTH * FONT_ATLAS_PAGE_HEIGHT / 2)
+// Blank texels to the right of and below each glyph. The horizontal one is a whole byte so glyphs stay byte aligned.
+#define FONT_ATLAS_GUTTER_X 2
+#define FONT_ATLAS_GUTTER_Y 1
+// How far back from the current display list position a previous page load is still looked for.
+#define FONT_ATLAS_MAX_SCAN 256
+
+#define FONT_STRIP_COUNT 64
+#define FONT_STRIP_MAX_GLYPHS 48
+// Bytes per strip texture row, enough for FONT_STRIP_MAX_GLYPHS of the widest font. A whole strip still fits in TMEM.
+#define FONT_STRIP_ROW_BYTES (FONT_STRIP_MAX_GLYPHS * 12 / 2)
+#define FONT_STRIP_SIZE (FONT_STRIP_ROW_BYTES * 12)
+// 0.1 s in CPU counter ticks.
+#define FONT_STRIP_MIN_AGE (46875000 / 10)
+
+// Glyph counts follow from the size of the texture symbols in the game's data.
+#define FONT_XX_GLYPH_W 12
+#define FONT_XX_GLYPH_H 12
+#define FONT_XX_GLYPH_COUNT 644
+#define FONT_XX_CELLS_X (FONT_ATLAS_PAGE_WIDTH / (FONT_XX_GLYPH_W + FONT_ATLAS_GUTTER_X))
+#define FONT_XX_CELLS_Y (FONT_ATLAS_PAGE_HEIGHT / (FONT_XX_GLYPH_H + FONT_ATLAS_GUTTER_Y))
+#define FONT_XX_PAGES ((FONT_XX_GLYPH_COUNT + FONT_XX_CELLS_X * FONT_XX_CELLS_Y - 1) / (FONT_XX_CELLS_X * FONT_XX_CELLS_Y))
+
+#define FONT_ASC_GLYPH_W 8
+#define FONT_ASC_GLYPH_H 12
+#define FONT_ASC_GLYPH_COUNT 483
+#define FONT_ASC_CELLS_X (FONT_ATLAS_PAGE_WIDTH / (FONT_ASC_GLYPH_W + FONT_ATLAS_GUTTER_X))
+#define FONT_ASC_CELLS_Y (FONT_ATLAS_PAGE_HEIGHT / (FONT_ASC_GLYPH_H + FONT_ATLAS_GUTTER_Y))
+#define FONT_ASC_PAGES ((FONT_ASC_GLYPH_COUNT + FONT_ASC_CELLS_X * FONT_ASC_CELLS_Y - 1) / (FONT_ASC_CELLS_X * FONT_ASC_CELLS_Y))
+
+typedef struct FontAtlas {
+    const u8 *tex;
+    s32 glyph_w;
+    s32 glyph_h;
+    s32 glyph_count;
+    s32 cells_x;
+    s32 cells_y;
+    u8 *pages;
+    s32 built;
+} FontAtlas;
+
+typedef struct FontStrip {
+    const FontAtlas *atlas;
+    s32 count;
+    u64 last_drawn;
+    s16 indices[FONT_STRIP_MAX_GLYPHS];
+    u8 texels[FONT_STRIP_SIZE] __attribute__((aligned(8)));
+} FontStrip;
+
+u64 osGetTime(void);
+
+extern u8 font_2_tex[];
+extern u8 font_a_tex[];
+
+static u8 font_xx_pages[FONT_XX_PAGES][FONT_ATLAS_PAGE_SIZE] __attribute__((aligned(8)));
+static u8 font_asc_pages[FONT_ASC_PAGES][FONT_ATLAS_PAGE_SIZE] __attribute__((aligned(8)));
+
+static FontAtlas font_xx_atlas = {
+    font_2_tex, FONT_XX_GLYPH_W, FONT_XX_GLYPH_H, FONT_XX_GLYPH_COUNT, FONT_XX_CELLS_X, FONT_XX_CELLS_Y,
+    &font_xx_pages[0][0], 0
+};
+static FontAtlas font_asc_atlas = {
+    font_a_tex, FONT_ASC_GLYPH_W, FONT_ASC_GLYPH_H, FONT_ASC_GLYPH_COUNT, FONT_ASC_CELLS_X, FONT_ASC_CELLS_Y,
+    &font_asc_pages[0][0], 0
+};
+
+// The last page load emitted, used to skip reloading the same page.
+static Gfx *font_atlas_load_start = NULL;
+static Gfx *font_atlas_load_end = NULL;
+static u8 *font_atlas_loaded_page = NULL;
+
+static FontStrip font_strips[FONT_STRIP_COUNT];
+// The last run of native size glyphs, from font_strip_start to font_strip_end in the display list. A run of one glyph
+// is drawn from the atlas. Longer runs are drawn from font_strip_drawn, a strip whose first glyphs are the run's.
+static FontAtlas *font_strip_atlas = NULL;
+static s32 font_strip_variant;
+static s16 font_strip_indices[FONT_STRIP_MAX_GLYPHS];
+static s32 font_strip_count = 0;
+static FontStrip *font_strip_drawn = NULL;
+static Gfx *font_strip_start;
+static Gfx *font_strip_end;
+static f32 font_strip_x;
+static f32 font_strip_next_x;
+static f32 font_strip_y;
+
+static void font_atlas_build(FontAtlas *atlas) {
+    s32 glyph_row_bytes = atlas->glyph_w / 2;
+    s32 glyph_bytes = glyph_row_bytes * atlas->glyph_h;
+    s32 glyphs_per_page = atlas->cells_x * atlas->cells_y;
+    s32 page_count = (atlas->glyph_count + glyphs_per_page - 1) / glyphs_per_page;
+    s32 i, row, b;
+
+    // The page arrays are in bss, so the gutters are already blank.
+    for (i = 0; i < atlas->glyph_count; i++) {
+        s32 cell = i % glyphs_per_page;
+        const u8 *glyph = &atlas->tex[i * glyph_bytes];
+        u8 *dst = &atlas->pages[(i / glyphs_per_page) * FONT_ATLAS_PAGE_SIZE];
+
+        dst += (cell / atlas->cells_x) * (atlas->glyph_h + FONT_ATLAS_GUTTER_Y) * (FONT_ATLAS_PAGE_WIDTH / 2);
+        dst += (cell % atlas->cells_x) * (atlas->glyph_w + FONT_ATLAS_GUTTER_X) / 2;
+        for (row = 0; row < atlas->glyph_h; row++) {
+            for (b = 0; b < glyph_row_bytes; b++) {
+                dst[b] = glyph[b];
+            }
+            glyph += glyph_row_bytes;
+            dst += FONT_ATLAS_PAGE_WIDTH / 2;
+        }
+    }
+    osWritebackDCache(atlas->pages, page_count * FONT_ATLAS_PAGE_SIZE);
+    atlas->built = 1;
+}
+
+/* Returns whether the last page load in the display list before gfx is still the given page. */
+static s32 font_atlas_page_loaded(u8 *page, Gfx *gfx) {
+    Gfx *cmd;
+
+    if (font_atlas_loaded_page != page || font_atlas_load_start == NULL ||
+        gfx < font_atlas_load_end || gfx - font_atlas_load_start > FONT_ATLAS_MAX_SCAN) {
+        return 0;
+    }
+    // The display list buffer may have been reused for a later frame since the load was emitted.
+    if ((font_atlas_load_start->words.w0 >> 24) != G_SETTIMG || font_atlas_load_start->words.w1 != (u32)page) {
+        return 0;
+    }
+    for (cmd = font_atlas_load_end; cmd < gfx; cmd++) {
+        switch (cmd->words.w0 >> 24) {
+            case G_NOOP:
+            case G_RDPPIPESYNC:
+            case G_SETPRIMCOLOR:
+            case G_SETENVCOLOR:
+            case G_TEXRECT:
+            case G_RDPHALF_1:
+            case G_RDPHALF_2:
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Draws a glyph straight from its atlas page. */
+static s32 font_atlas_draw(Gfx **gfxP, FontAtlas *atlas, f32 x, f32 y, f32 w, f32 h, s32 index) {
+    Gfx *gfx = *gfxP;
+    s32 glyphs_per_page = atlas->cells_x * atlas->cells_y;
+    s32 cell;
+    s32 s, t;
+    u8 *page;
+
+    if (index < 0 || index >= atlas->glyph_count) {
+        return 0;
+    }
+    if (!atlas->built) {
+        font_atlas_build(atlas);
+    }
+
+    page = &atlas->pages[(index / glyphs_per_page) * FONT_ATLAS_PAGE_SIZE];
+    cell = index % glyphs_per_page;
+    s = (cell % atlas->cells_x) * (atlas->glyph_w + FONT_ATLAS_GUTTER_X);
+    t = (cell / atlas->cells_x) * (atlas->glyph_h + FONT_ATLAS_GUTTER_Y);
+
+    if (!font_atlas_page_loaded(page, gfx)) {
+        font_atlas_load_start = gfx;
+        gDPLoadTextureBlock_4b(gfx++, page, G_IM_FMT_I, FONT_ATLAS_PAGE_WIDTH, FONT_ATLAS_PAGE_HEIGHT, 0,
+                               G_TX_NOMIRROR | G_TX_CLAMP, G_TX_NOMIRROR | G_TX_CLAMP,
+                               G_TX_NOMASK, G_TX_NOMASK, G_TX_NOLOD, G_TX_NOLOD);
+        font_atlas_load_end = gfx;
+        font_atlas_loaded_page = page;
+    }
+
+    gSPScisTextureRectangle(gfx++, (s32)(x * 4.0f), (s32)(y * 4.0f), (s32)((x + w) * 4.0f), (s32)((y + h) * 4.0f),
+                            G_TX_RENDERTILE, s << 5, t << 5,
+                            (s32)((f32)(atlas->glyph_w << 10) / w), (s32)((f32)(atlas->glyph_h << 10) / h));
+
+    *gfxP = gfx;
+    return 1;
+}
+
+/* Returns whether the strip starts with the first count glyphs of the current run. */
+static s32 font_strip_has_run(const FontStrip *strip, s32 count) {
+    s32 i;
+
+    if (strip->atlas != font_strip_atlas || strip->count < count) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        if (strip->indices[i] != font_strip_indices[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* The least recently drawn strip that's old enough to overwrite, or NULL if they're all in use. */
+static FontStrip *font_strip_alloc(u64 now) {
+    FontStrip *oldest = NULL;
+    s32 i;
+
+    for (i = 0; i < FONT_STRIP_COUNT; i++) {
+        FontStrip *strip = &font_strips[i];
+        if (strip->count != 0 && now - strip->last_drawn < FONT_STRIP_MIN_AGE) {
+            continue;
+        }
+        if (oldest == NULL || strip->last_drawn < oldest->last_drawn) {
+            oldest = strip;
+        }
+    }
+    return oldest;
+}
+
+/*
+ * Copies a glyph into the next column of a strip. Only columns past the strip's count are written, which no load reads,
+ * so this is safe on a strip that's still in use.
+ */
+static void font_strip_append(FontStrip *strip, s32 index) {
+    const FontAtlas *atlas = strip->atlas;
+    s32 glyph_row_bytes = atlas->glyph_w / 2;
+    const u8 *glyph = &atlas->tex[index * glyph_row_bytes * atlas->glyph_h];
+    u8 *dst = &strip->texels[strip->count * glyph_row_bytes];
+    s32 row, b;
+
+    for (row = 0; row < atlas->glyph_h; row++) {
+        for (b = 0; b < glyph_row_bytes; b++) {
+            dst[b] = glyph[b];
+        }
+        glyph += glyph_row_bytes;
+        dst += FONT_STRIP_ROW_BYTES;
+    }
+    osWritebackDCache(strip->texels, FONT_STRIP_SIZE);
+
+    strip->indices[strip->count++] = index;
+}
+
+/* Finds or makes a strip that starts with the current run. NULL if every strip is in use. */
+static FontStrip *font_strip_get(u64 now) {
+    FontStrip *strip = font_strip_drawn;
+    s32 i;
+
+    // Usually the strip used so far either already continues with this glyph or ends right before it.
+    if (strip != NULL && strip->count == font_strip_count - 1 && font_strip_has_run(strip, font_strip_count - 1)) {
+        font_strip_append(strip, font_strip_indices[font_strip_count - 1]);
+        return strip;
+    }
+    if (strip != NULL && font_strip_has_run(strip, font_strip_count)) {
+        return strip;
+    }
+
+    for (i = 0; i < FONT_STRIP_COUNT; i++) {
+        if (font_strips[i].count != 0 && font_strip_has_run(&font_strips[i], font_strip_count)) {
+            return &font_strips[i];
+        }
+    }
+
+    strip = font_strip_alloc(now);
+    if (strip != NULL) {
+        strip->atlas = font_strip_atlas;
+        strip->count = 0;
+        for (i = 0; i < font_strip_count; i++) {
+            font_strip_append(strip, font_strip_indices[i]);
+        }
+    }
+    return strip;
+}
+
+/* Emits the load and rectangle of the run's strip at font_strip_start, replacing what the run emitted so far. */
+static void font_strip_emit(void) {
+    Gfx *gfx = font_strip_start;
+    s32 width = font_strip_count * font_strip_atlas->glyph_w;
+    s32 height = font_strip_atlas->glyph_h;
+    s32 x = (s32)font_strip_x;
+    s32 y = (s32)font_strip_y;
+
+    gDPLoadTextureTile_4b(gfx++, font_strip_drawn->texels, G_IM_FMT_I, FONT_STRIP_ROW_BYTES * 2, height,
+                          0, 0, width - 1, height - 1, 0,
+                          G_TX_NOMIRROR | G_TX_CLAMP, G_TX_NOMIRROR | G_TX_CLAMP,
+                          G_TX_NOMASK, G_TX_NOMASK, G_TX_NOLOD, G_TX_NOLOD);
+    gSPScisTextureRectangle(gfx++, x * 4, y * 4, (x + width) * 4, (y + height) * 4,
+                            G_TX_RENDERTILE, 0, 0, 1 << 10, 1 << 10);
+    font_strip_end = gfx;
+}
+
+/* Appends a glyph to the last run if it continues it. Returns 0 if it has to be drawn on its own instead. */
+static s32 font_strip_extend(Gfx **gfxP, FontAtlas *atlas, s32 variant, f32 x, f32 y, f32 w, s32 index) {
+    u64 now;
+    FontStrip *strip;
+
+    if (font_strip_atlas != atlas || font_strip_variant != variant || *gfxP != font_strip_end ||
+        y != font_strip_y || x != font_strip_next_x || font_strip_count == FONT_STRIP_MAX_GLYPHS) {
+        return 0;
+    }
+
+    now = osGetTime();
+    font_strip_indices[font_strip_count++] = index;
+    strip = font_strip_get(now);
+    if (strip == NULL) {
+        font_strip_count--;
+        return 0;
+    }
+
+    font_strip_drawn = strip;
+    strip->last_drawn = now;
+    font_strip_next_x = x + w;
+    font_strip_emit();
+    *gfxP = font_strip_end;
+    return 1;
+}
+
+static s32 font_draw(Gfx **gfxP, FontAtlas *atlas, s32 variant, f32 x, f32 y, f32 w, f32 h, s32 index) {
+    s32 native = w == (f32)atlas->glyph_w && h == (f32)atlas->glyph_h && x == (f32)(s32)x && y == (f32)(s32)y;
+    s32 ret;
+
+    if (index < 0 || index >= atlas->glyph_count) {
+        return 0;
+    }
+    if (native && font_strip_extend(gfxP, atlas, variant, x, y, w, index)) {
+        return 1;
+    }
+
+    // Draw the glyph on its own. If it's at native size, the next glyph can turn it into a strip.
+    font_strip_start = *gfxP;
+    ret = font_atlas_draw(gfxP, atlas, x, y, w, h, index);
+    font_strip_atlas = native ? atlas : NULL;
+    font_strip_variant = variant;
+    font_strip_indices[0] = index;
+    font_strip_count = 1;
+    font_strip_drawn = NULL;
+    font_strip_end = *gfxP;
+    font_strip_x = x;
+    font_strip_next_x = x + w;
+    font_strip_y = y;
+    return ret;
+}
+
+RECOMP_PATCH s32 fontXX_drawID(Gfx **gfxP, f32 x, f32 y, f32 w, f32 h, s32 index) {
+    return font_draw(gfxP, &font_xx_atlas, 1, x, y, w, h, index);
+}
+
+RECOMP_PATCH s32 fontXX_drawID2(Gfx **gfxP, f32 x, f32 y, f32 w, f32 h, s32 index) {
+    return font_draw(gfxP, &font_xx_atlas, 2, x, y, w, h, index);
+}
+
+RECOMP_PATCH s32 fontAsc_drawID(Gfx **gfxP, f32 x, f32 y, f32 w, f32 h, s32 index) {
+    return font_draw(gfxP, &font_asc_atlas, 1, x, y, w, h, index);
+}
+
+RECOMP_PATCH s32 fontAsc_drawID2(Gfx **gfxP, f32 x, f32 y, f32 w, f32 h, s32 index) {
+    return font_draw(gfxP, &font_asc_atlas, 2, x, y, w, h, index);
+}
@@ -8,4 +8,9 @@ DECLARE_FUNC(void, recomp_puts, const char* data, u32 size);
 DECLARE_FUNC(void, recomp_exit);
 #endif
 
+DECLARE_FUNC(s32, recomp_eeprom_probe);
+DECLARE_FUNC(s32, recomp_eeprom_read, u8 address, u8* buffer, s32 size);
+DECLARE_FUNC(s32, recomp_eeprom_write, u8 address, u8* buffer, s32 size);
+DECLARE_FUNC(u32, recomp_get_anime_load_generation);
+
 #endif
@@ -31,6 +31,8 @@ void load_TexPal(const u16 tlut[]);
 #define osContStartQuery osContStartQuery_recomp
 #define osContGetQuery osContGetQuery_recomp
 #define RECOMP_PATCH __attribute__((section(".recomp_patch")))
+// Also replaces functions the runtime reimplements instead of recompiling.
+#define RECOMP_FORCE_PATCH __attribute__((section(".recomp_force_patch")))
 
 #define sinf __sinf_recomp
 #define cosf __cosf_recomp
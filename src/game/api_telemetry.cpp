@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "json/json.hpp"
+
+#include "recomp_data.h"
+#include "recomp_telemetry.h"
+#include "zelda_config.h"
+
+// Counters for the exports that mods call. See recomp_telemetry.h.
+//
+// Counters are kept per (export, caller) pair in a map behind a mutex. Exports are mostly called from the game thread,
+// so the mutex is rarely contended, and none of this runs unless telemetry was started from the debug menu.
+
+struct ExportCounters {
+    uint64_t calls = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t lock_wait_ns = 0;
+
+    void add(const ExportCounters& rhs) {
+        calls += rhs.calls;
+        total_ns += rhs.total_ns;
+        max_ns = std::max(max_ns, rhs.max_ns);
+        lock_wait_ns += rhs.lock_wait_ns;
+    }
+};
+
+std::atomic_bool recomputil::api_telemetry_active = false;
+
+static struct {
+    std::mutex mutex;
+    std::vector<std::string> export_names;
+    // Keyed by the export's id in the upper 32 bits and the caller's address in the lower 32 bits.
+    std::unordered_map<uint64_t, ExportCounters> counters;
+    std::chrono::steady_clock::time_point start_time;
+} Telemetry;
+
+uint32_t recomputil::add_telemetry_export(const char* name) {
+    std::lock_guard lock{ Telemetry.mutex };
+    Telemetry.export_names.emplace_back(name);
+    return static_cast<uint32_t>(Telemetry.export_names.size() - 1);
+}
+
+void recomputil::record_export_call(uint32_t export_id, uint32_t caller, uint64_t elapsed_ns, uint64_t lock_wait_ns) {
+    std::lock_guard lock{ Telemetry.mutex };
+    ExportCounters& counters = Telemetry.counters[(static_cast<uint64_t>(export_id) << 32) | caller];
+    counters.calls++;
+    counters.total_ns += elapsed_ns;
+    counters.max_ns = std::max(counters.max_ns, elapsed_ns);
+    counters.lock_wait_ns += lock_wait_ns;
+}
+
+void recomputil::start_api_telemetry() {
+    std::lock_guard lock{ Telemetry.mutex };
+    Telemetry.counters.clear();
+    Telemetry.start_time = std::chrono::steady_clock::now();
+    api_telemetry_active.store(true);
+    printf("Recording mod API telemetry\n");
+}
+
+static double ns_to_ms(uint64_t ns) {
+    return ns / 1e6;
+}
+
+static std::string caller_string(uint32_t caller) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "0x%08" PRIX32, caller);
+    return buf;
+}
+
+std::string recomputil::stop_api_telemetry() {
+    api_telemetry_active.store(false);
+
+    struct ExportReport {
+        std::string name;
+        ExportCounters totals;
+        std::vector<std::pair<uint32_t, ExportCounters>> callers;
+    };
+
+    std::vector<ExportReport> reports;
+    double duration_ms;
+    {
+        std::lock_guard lock{ Telemetry.mutex };
+        duration_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Telemetry.start_time).count();
+
+        std::unordered_map<uint32_t, size_t> report_indices;
+        for (const auto& [key, counters] : Telemetry.counters) {
+            uint32_t export_id = static_cast<uint32_t>(key >> 32);
+            auto [it, inserted] = report_indices.emplace(export_id, reports.size());
+            if (inserted) {
+                reports.emplace_back(ExportReport{ Telemetry.export_names[export_id] });
+            }
+            ExportReport& report = reports[it->second];
+            report.totals.add(counters);
+            report.callers.emplace_back(static_cast<uint32_t>(key), counters);
+        }
+    }
+
+    // Most expensive exports and callers first.
+    std::sort(reports.begin(), reports.end(),
+        [](const ExportReport& lhs, const ExportReport& rhs) { return lhs.totals.total_ns > rhs.totals.total_ns; });
+    for (ExportReport& report : reports) {
+        std::sort(report.callers.begin(), report.callers.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.second.total_ns > rhs.second.total_ns; });
+    }
+
+    nlohmann::json json{};
+    json["duration_ms"] = duration_ms;
+    json["exports"] = nlohmann::json::array();
+    uint64_t total_calls = 0;
+    printf("Mod API telemetry over %.0f ms:\n", duration_ms);
+    for (const ExportReport& report : reports) {
+        total_calls += report.totals.calls;
+        printf("  %-48s %10" PRIu64 " calls, %9.3f ms total, %9.3f ms max, %9.3f ms lock wait, %zu callers\n",
+            report.name.c_str(), report.totals.calls, ns_to_ms(report.totals.total_ns), ns_to_ms(report.totals.max_ns),
+            ns_to_ms(report.totals.lock_wait_ns), report.callers.size());
+
+        nlohmann::json export_json{};
+        export_json["name"] = report.name;
+        export_json["calls"] = report.totals.calls;
+        export_json["total_ms"] = ns_to_ms(report.totals.total_ns);
+        export_json["max_ms"] = ns_to_ms(report.totals.max_ns);
+        export_json["lock_wait_ms"] = ns_to_ms(report.totals.lock_wait_ns);
+        export_json["callers"] = nlohmann::json::array();
+        for (const auto& [caller, counters] : report.callers) {
+            nlohmann::json caller_json{};
+            caller_json["caller"] = caller_string(caller);
+            caller_json["calls"] = counters.calls;
+            caller_json["total_ms"] = ns_to_ms(counters.total_ns);
+            caller_json["max_ms"] = ns_to_ms(counters.max_ns);
+            caller_json["lock_wait_ms"] = ns_to_ms(counters.lock_wait_ns);
+            export_json["callers"].push_back(std::move(caller_json));
+        }
+        json["exports"].push_back(std::move(export_json));
+    }
+
+    json["containers"] = nlohmann::json::array();
+    for (const DataContainerStats& stats : get_data_container_stats()) {
+        printf("  %-20s %zu containers, %zu entries, largest %zu\n", stats.type, stats.containers, stats.total_entries, stats.max_entries);
+        nlohmann::json container_json{};
+        container_json["type"] = stats.type;
+        container_json["containers"] = stats.containers;
+        container_json["total_entries"] = stats.total_entries;
+        container_json["max_entries"] = stats.max_entries;
+        json["containers"].push_back(std::move(container_json));
+    }
+
+    std::filesystem::path path = zelda64::get_app_folder_path() / "api_telemetry.json";
+    bool saved;
+    {
+        std::ofstream output_file{ path };
+        output_file << std::setw(4) << json;
+        saved = output_file.good();
+    }
+    if (!saved) {
+        printf("Failed to write %s\n", path.string().c_str());
+    }
+
+    std::string summary = std::to_string(total_calls) + " calls to " + std::to_string(reports.size()) + " exports";
+    if (!reports.empty()) {
+        char top[128];
+        snprintf(top, sizeof(top), ", most time in %s (%.2f ms)", reports[0].name.c_str(), ns_to_ms(reports[0].totals.total_ns));
+        summary += top;
+    }
+    if (saved) {
+        summary += ", saved to api_telemetry.json";
+    }
+    return summary;
+}
@@ -332,6 +332,7 @@ void assign_all_mappings(int controller_num, recomp::InputDevice device, const r
     assign_mapping_complete(controller_num, device, recomp::GameInput::TOGGLE_MENU, values.toggle_menu);
     assign_mapping_complete(controller_num, device, recomp::GameInput::ACCEPT_MENU, values.accept_menu);
     assign_mapping_complete(controller_num, device, recomp::GameInput::APPLY_MENU, values.apply_menu);
+    assign_mapping_complete(controller_num, device, recomp::GameInput::REWIND, values.rewind);
 };
 
 void zelda64::reset_input_bindings() {
@@ -1,4 +1,5 @@
 #include <array>
+#include <atomic>
 
 #include "librecomp/helpers.hpp"
 #include "recomp_input.h"
@@ -10,13 +11,8 @@ using input_mapping_array = std::array<input_mapping, static_cast<size_t>(recomp
 static std::array<input_mapping_array, 4> keyboard_input_mappings{};
 static std::array<input_mapping_array, 4> controller_input_mappings{};
 static std::array<recomp::ControllerGUID, 4> controller_guids{};
-
-// Make the button value array, which maps a button index to its bit field.
-#define DEFINE_INPUT(name, value, readable) uint16_t(value##u),
-static const std::array n64_button_values = {
-    DEFINE_N64_BUTTON_INPUTS()
-};
-#undef DEFINE_INPUT
+// Set when a player's bindings change so get_n64_input recompiles them on the game thread before its next read.
+static std::array<std::atomic_bool, 4> n64_bindings_dirty{ true, true, true, true };
 
 // Make the input name array.
 #define DEFINE_INPUT(name, value, readable) readable,
@@ -73,11 +69,13 @@ void recomp::set_input_binding(int controller_num, recomp::GameInput input, size
 
     if (binding_index < cur_input_mapping.size()) {
         cur_input_mapping[binding_index] = value;
+        n64_bindings_dirty[controller_num].store(true);
     }
 }
 
 void recomp::set_input_controller_guid(int controller_num, const ControllerGUID& guid) {
     controller_guids[controller_num] = guid;
+    recomp::invalidate_controller_assignments();
 }
 
 recomp::ControllerGUID recomp::get_input_controller_guid(int controller_num) {
@@ -85,6 +83,16 @@ recomp::ControllerGUID recomp::get_input_controller_guid(int controller_num) {
 }
 
 
+static void compile_n64_bindings(int controller_num) {
+    recomp::InputFieldSpans keyboard_fields;
+    recomp::InputFieldSpans controller_fields;
+    for (size_t i = 0; i < keyboard_fields.size(); i++) {
+        keyboard_fields[i] = keyboard_input_mappings[controller_num][i];
+        controller_fields[i] = controller_input_mappings[controller_num][i];
+    }
+    recomp::compile_n64_bindings(controller_num, keyboard_fields, controller_fields);
+}
+
 bool recomp::get_n64_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out) {
     if (!recomp::n64_controller_present(controller_num)) {
         *buttons_out = 0;
@@ -98,27 +106,11 @@ bool recomp::get_n64_input(int controller_num, uint16_t* buttons_out, float* x_o
     float cur_y = 0.0f;
 
     if (!recomp::game_input_disabled()) {
-        for (size_t i = 0; i < n64_button_values.size(); i++) {
-            size_t input_index = (size_t)GameInput::N64_BUTTON_START + i;
-            cur_buttons |= recomp::get_input_digital(controller_num, keyboard_input_mappings[controller_num][input_index]) ? n64_button_values[i] : 0;
-            cur_buttons |= recomp::get_input_digital(controller_num, controller_input_mappings[controller_num][input_index]) ? n64_button_values[i] : 0;
+        if (n64_bindings_dirty[controller_num].exchange(false)) {
+            compile_n64_bindings(controller_num);
         }
-
-        float joystick_deadzone = recomp::get_joystick_deadzone() / 100.0f;
-
-       float joystick_x = recomp::get_input_analog(controller_num, controller_input_mappings[controller_num][(size_t)GameInput::X_AXIS_POS])
-                        - recomp::get_input_analog(controller_num, controller_input_mappings[controller_num][(size_t)GameInput::X_AXIS_NEG]);
-
-        float joystick_y = recomp::get_input_analog(controller_num, controller_input_mappings[controller_num][(size_t)GameInput::Y_AXIS_POS])
-                        - recomp::get_input_analog(controller_num, controller_input_mappings[controller_num][(size_t)GameInput::Y_AXIS_NEG]);
-
-        recomp::apply_joystick_deadzone(joystick_x, joystick_y, &joystick_x, &joystick_y);
-
-        cur_x = recomp::get_input_analog(controller_num, keyboard_input_mappings[controller_num][(size_t)GameInput::X_AXIS_POS])
-                - recomp::get_input_analog(controller_num, keyboard_input_mappings[controller_num][(size_t)GameInput::X_AXIS_NEG]) + joystick_x;
-
-        cur_y = recomp::get_input_analog(controller_num, keyboard_input_mappings[controller_num][(size_t)GameInput::Y_AXIS_POS])
-                - recomp::get_input_analog(controller_num, keyboard_input_mappings[controller_num][(size_t)GameInput::Y_AXIS_NEG]) + joystick_y;
+        recomp::get_compiled_n64_input(controller_num, &cur_buttons, &cur_x, &cur_y);
+        recomp::input_latency_on_read(controller_num, &cur_buttons);
     }
 
     *buttons_out = cur_buttons;
@@ -127,3 +119,16 @@ bool recomp::get_n64_input(int controller_num, uint16_t* buttons_out, float* x_o
 
     return true;
 }
+
+std::string recomp::benchmark_n64_input(int controller_num, int iterations) {
+    // Copy the mappings so the benchmark works on bindings that can't change under it.
+    input_mapping_array keyboard_mappings = keyboard_input_mappings[controller_num];
+    input_mapping_array controller_mappings = controller_input_mappings[controller_num];
+    recomp::InputFieldSpans keyboard_fields;
+    recomp::InputFieldSpans controller_fields;
+    for (size_t i = 0; i < keyboard_fields.size(); i++) {
+        keyboard_fields[i] = keyboard_mappings[i];
+        controller_fields[i] = controller_mappings[i];
+    }
+    return recomp::benchmark_compiled_n64_input(controller_num, keyboard_fields, controller_fields, iterations);
+}
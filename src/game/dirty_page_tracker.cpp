@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "dirty_page_tracker.h"
+
+// Trackers that the fault handler checks faulting addresses against. Only a few regions are ever tracked at once
+// (RDRAM by quicksaves and rewind, plus a buffer while a benchmark runs).
+constexpr size_t max_trackers = 4;
+static std::array<std::atomic<DirtyPageTracker*>, max_trackers> active_trackers{};
+static std::once_flag fault_handler_installed;
+
+// Several trackers can cover the same region, each with its own dirty bits, so every one of them is told about the
+// write. Any tracker protecting a page again makes the next write fault, which marks the page in all of them.
+static bool handle_write_fault(void* address) {
+    bool handled = false;
+    for (std::atomic<DirtyPageTracker*>& tracker : active_trackers) {
+        DirtyPageTracker* cur = tracker.load(std::memory_order_acquire);
+        if (cur != nullptr && cur->on_write_fault(reinterpret_cast<uintptr_t>(address))) {
+            handled = true;
+        }
+    }
+    return handled;
+}
+
+#ifdef _WIN32
+
+static size_t system_page_size() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+}
+
+static bool set_writable(uint8_t* base, size_t size, bool writable) {
+    DWORD old_protect;
+    return VirtualProtect(base, size, writable ? PAGE_READWRITE : PAGE_READONLY, &old_protect) != 0;
+}
+
+static LONG CALLBACK write_fault_handler(PEXCEPTION_POINTERS info) {
+    const EXCEPTION_RECORD* record = info->ExceptionRecord;
+    if (record->ExceptionCode == EXCEPTION_ACCESS_VIOLATION && record->NumberParameters >= 2 &&
+        record->ExceptionInformation[0] == 1 && handle_write_fault(reinterpret_cast<void*>(record->ExceptionInformation[1])))
+    {
+        return EXCEPTION_CONTINUE_EXECUTION;
+    }
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
+static void install_fault_handler() {
+    AddVectoredExceptionHandler(1, write_fault_handler);
+}
+
+uint8_t* DirtyPageTracker::allocate_region(size_t size) {
+    return static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+}
+
+void DirtyPageTracker::free_region(uint8_t* base, size_t size) {
+    VirtualFree(base, 0, MEM_RELEASE);
+}
+
+#else
+
+static size_t system_page_size() {
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+static bool set_writable(uint8_t* base, size_t size, bool writable) {
+    return mprotect(base, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ) == 0;
+}
+
+// Protection faults are SIGSEGV on Linux and SIGBUS on macOS.
+static struct sigaction previous_segv_action;
+static struct sigaction previous_bus_action;
+
+static void write_fault_handler(int sig, siginfo_t* info, void* ucontext) {
+    if (handle_write_fault(info->si_addr)) {
+        return;
+    }
+
+    // Not a tracked write, so pass it on to whatever handled the signal before.
+    const struct sigaction& previous = sig == SIGBUS ? previous_bus_action : previous_segv_action;
+    if ((previous.sa_flags & SA_SIGINFO) != 0) {
+        previous.sa_sigaction(sig, info, ucontext);
+    }
+    else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+        previous.sa_handler(sig);
+    }
+    else {
+        // Restore the default action, which crashes as usual when the faulting instruction is retried.
+        signal(sig, SIG_DFL);
+    }
+}
+
+static void install_fault_handler() {
+    struct sigaction action{};
+    action.sa_sigaction = write_fault_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_segv_action);
+    sigaction(SIGBUS, &action, &previous_bus_action);
+}
+
+uint8_t* DirtyPageTracker::allocate_region(size_t size) {
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return base == MAP_FAILED ? nullptr : static_cast<uint8_t*>(base);
+}
+
+void DirtyPageTracker::free_region(uint8_t* base, size_t size) {
+    munmap(base, size);
+}
+
+#endif
+
+DirtyPageTracker::DirtyPageTracker() : page_bytes(system_page_size()) {}
+
+DirtyPageTracker::~DirtyPageTracker() {
+    stop();
+}
+
+bool DirtyPageTracker::start(uint8_t* base, size_t size) {
+    stop();
+
+    size_t words = ((size + page_bytes - 1) / page_bytes + 63) / 64;
+    if (words > dirty_words.load(std::memory_order_relaxed)) {
+        bit_arrays.emplace_back(std::make_unique<std::atomic_uint64_t[]>(words));
+        // The handler reads the word count before the array, so it never sees a count bigger than the array it gets.
+        dirty_bits.store(bit_arrays.back().get(), std::memory_order_release);
+        dirty_words.store(words, std::memory_order_release);
+    }
+    std::atomic_uint64_t* bits = dirty_bits.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < words; i++) {
+        bits[i].store(~uint64_t{0}, std::memory_order_relaxed);
+    }
+    num_faults = 0;
+
+    region_size.store(size, std::memory_order_release);
+    region.store(base, std::memory_order_release);
+    if (reinterpret_cast<uintptr_t>(base) % page_bytes != 0 || size % page_bytes != 0) {
+        printf("Dirty page tracking unavailable: region isn't page aligned\n");
+        return false;
+    }
+
+    size_t slot = 0;
+    for (; slot < max_trackers; slot++) {
+        DirtyPageTracker* expected = nullptr;
+        if (active_trackers[slot].compare_exchange_strong(expected, this)) {
+            break;
+        }
+    }
+    if (slot == max_trackers) {
+        printf("Dirty page tracking unavailable: too many tracked regions\n");
+        return false;
+    }
+
+    std::call_once(fault_handler_installed, install_fault_handler);
+    if (!set_writable(base, size, false)) {
+        printf("Dirty page tracking unavailable: failed to write protect region\n");
+        active_trackers[slot].store(nullptr, std::memory_order_release);
+        return false;
+    }
+
+    write_protected.store(true, std::memory_order_release);
+    return true;
+}
+
+void DirtyPageTracker::stop() {
+    uint8_t* base = region.load(std::memory_order_relaxed);
+    if (base == nullptr) {
+        return;
+    }
+    size_t size = region_size.load(std::memory_order_relaxed);
+
+    if (write_protected.exchange(false, std::memory_order_acq_rel)) {
+        bool shared = false;
+        for (std::atomic<DirtyPageTracker*>& tracker : active_trackers) {
+            DirtyPageTracker* expected = this;
+            tracker.compare_exchange_strong(expected, nullptr);
+            DirtyPageTracker* other = tracker.load(std::memory_order_acquire);
+            if (other != nullptr) {
+                uint8_t* other_base = other->region.load(std::memory_order_acquire);
+                size_t other_size = other->region_size.load(std::memory_order_acquire);
+                if (other_base < base + size && base < other_base + other_size) {
+                    shared = true;
+                }
+            }
+        }
+        // Leave the protection in place if another tracker still needs to see writes to the region.
+        if (!shared) {
+            set_writable(base, size, true);
+        }
+    }
+
+    // A handler that read the old region can still mark a bit after this, which lands in an array that's still
+    // allocated and is overwritten by the next start.
+    region.store(nullptr, std::memory_order_release);
+    region_size.store(0, std::memory_order_release);
+}
+
+bool DirtyPageTracker::on_write_fault(uintptr_t address) {
+    if (!write_protected.load(std::memory_order_acquire)) {
+        return false;
+    }
+    uint8_t* base = region.load(std::memory_order_acquire);
+    uintptr_t start = reinterpret_cast<uintptr_t>(base);
+    if (base == nullptr || address < start || address >= start + region_size.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    size_t page = (address - start) / page_bytes;
+    size_t words = dirty_words.load(std::memory_order_acquire);
+    std::atomic_uint64_t* bits = dirty_bits.load(std::memory_order_acquire);
+    if (page / 64 < words) {
+        bits[page / 64].fetch_or(uint64_t{1} << (page % 64), std::memory_order_relaxed);
+    }
+    num_faults.fetch_add(1, std::memory_order_relaxed);
+    return set_writable(base + page * page_bytes, page_bytes, true);
+}
+
+void DirtyPageTracker::peek_dirty_pages(std::vector<uint32_t>& out) const {
+    size_t pages = num_pages();
+    for (size_t word = 0; word < num_words(); word++) {
+        uint64_t bits = is_protected() ? dirty_bits.load(std::memory_order_relaxed)[word].load(std::memory_order_relaxed) : ~uint64_t{0};
+        for (; bits != 0; bits &= bits - 1) {
+            size_t page = word * 64 + std::countr_zero(bits);
+            if (page < pages) {
+                out.push_back(static_cast<uint32_t>(page));
+            }
+        }
+    }
+}
+
+void DirtyPageTracker::take_dirty_pages(std::vector<uint32_t>& out) {
+    if (!is_protected()) {
+        peek_dirty_pages(out);
+        return;
+    }
+
+    // Clear the bits before protecting the pages again. A write that lands in between either hits a page that's still
+    // writable and is in place before the caller copies the page, or faults and marks the page for the next call.
+    size_t first = out.size();
+    size_t pages = num_pages();
+    std::atomic_uint64_t* dirty = dirty_bits.load(std::memory_order_relaxed);
+    for (size_t word = 0; word < num_words(); word++) {
+        uint64_t bits = dirty[word].exchange(0, std::memory_order_acq_rel);
+        for (; bits != 0; bits &= bits - 1) {
+            size_t page = word * 64 + std::countr_zero(bits);
+            if (page < pages) {
+                out.push_back(static_cast<uint32_t>(page));
+            }
+        }
+    }
+
+    // Protect runs of consecutive pages with one call each.
+    for (size_t i = first; i < out.size(); ) {
+        size_t run_end = i + 1;
+        while (run_end < out.size() && out[run_end] == out[run_end - 1] + 1) {
+            run_end++;
+        }
+        set_writable(base() + out[i] * page_bytes, (run_end - i) * page_bytes, false);
+        i = run_end;
+    }
+}
+
+void PageSnapshot::save(uint8_t* base, size_t size) {
+    if (!tracker.is_started()) {
+        copy.resize(size);
+        tracker.start(base, size);
+    }
+
+    pages.clear();
+    tracker.take_dirty_pages(pages);
+    copy_pages(copy.data(), tracker.base());
+    saved = true;
+}
+
+void PageSnapshot::restore() {
+    if (!saved) {
+        return;
+    }
+
+    // The pages written since the save are still writable, so copy them back before protecting them again.
+    pages.clear();
+    tracker.peek_dirty_pages(pages);
+    copy_pages(tracker.base(), copy.data());
+
+    // The region matches the snapshot again, so start tracking from a clean slate.
+    restored_pages.clear();
+    tracker.take_dirty_pages(restored_pages);
+}
+
+void PageSnapshot::reset() {
+    tracker.stop();
+    copy = {};
+    pages.clear();
+    saved = false;
+}
+
+void PageSnapshot::copy_pages(uint8_t* dst, const uint8_t* src) {
+    size_t page_size = tracker.page_size();
+    for (uint32_t page : pages) {
+        size_t offset = page * page_size;
+        std::memcpy(dst + offset, src + offset, std::min(page_size, copy.size() - offset));
+    }
+}
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "recomp.h"
+#include "librecomp/game.hpp"
+#include "librecomp/helpers.hpp"
+
+#include "zelda_config.h"
+#include "zelda_game.h"
+
+// Write-back EEPROM cache.
+//
+// The game saves in bursts of small EEPROM writes. Instead of turning each one into file I/O, the EEPROM functions
+// below read and write an in-memory image of the save file, and a writer thread flushes the image once writes have
+// stopped for flush_debounce (or at the latest flush_max_delay after the first unflushed write), and again on exit.
+// Writes that don't change any bytes aren't flushed at all.
+//
+// Flushes write the whole image to a temporary file, sync it to disk and rename it over the save file, so the save file
+// always holds either the previous flush or the new one, even if the process is killed or the system loses power
+// mid-flush. The save file is the same one the runtime uses (saves/<game id>.bin), with the EEPROM at the start of it,
+// and any bytes past the EEPROM are kept as they are.
+//
+// Netplay guests play with the host's save instead of their own (see use_temporary_eeprom_image), which is never
+// flushed so their save file is left alone.
+//
+// The game reaches the cache through the recomp_eeprom_ natives, which patches/eeprom_cache.c substitutes for the
+// game's EEPROM functions.
+
+constexpr uint32_t eeprom_block_size = 8;
+constexpr uint32_t eeprom_4k_size = 512;
+constexpr int32_t eeprom_type_4k = 1;
+constexpr auto flush_debounce = std::chrono::milliseconds{500};
+constexpr auto flush_max_delay = std::chrono::seconds{5};
+
+using eeprom_clock = std::chrono::steady_clock;
+
+static struct {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+    bool loaded = false;
+    bool stopping = false;
+    bool temporary = false;
+    std::filesystem::path path;
+    std::vector<uint8_t> image;
+    bool dirty = false;
+    eeprom_clock::time_point first_unflushed_write;
+    eeprom_clock::time_point last_write;
+
+    uint64_t writes = 0;
+    uint64_t unchanged_writes = 0;
+    uint64_t writes_since_flush = 0;
+    uint64_t flushes = 0;
+    uint64_t failed_flushes = 0;
+} EepromCache;
+
+static FILE* open_for_writing(const std::filesystem::path& path) {
+#ifdef _WIN32
+    return _wfopen(path.c_str(), L"wb");
+#else
+    return fopen(path.c_str(), "wb");
+#endif
+}
+
+// Writes the file's buffered data and waits for it to reach the disk.
+static bool sync_file(FILE* file) {
+    if (fflush(file) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Makes a rename in the directory durable. Windows has no equivalent and doesn't need one for MoveFileEx.
+static void sync_directory(const std::filesystem::path& dir) {
+#ifndef _WIN32
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+static bool write_image(const std::filesystem::path& path, const std::vector<uint8_t>& image) {
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+
+    FILE* file = open_for_writing(temp_path);
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(image.data(), 1, image.size(), file) == image.size() && sync_file(file);
+    if (fclose(file) != 0 || !written) {
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        return false;
+    }
+    sync_directory(path.parent_path());
+    return true;
+}
+
+// Writes the image if it's dirty. Called with the lock held, which is released while writing.
+static void flush_locked(std::unique_lock<std::mutex>& lock) {
+    if (!EepromCache.dirty) {
+        return;
+    }
+    if (EepromCache.temporary) {
+        EepromCache.dirty = false;
+        EepromCache.writes_since_flush = 0;
+        return;
+    }
+
+    std::vector<uint8_t> image = EepromCache.image;
+    uint64_t writes = EepromCache.writes_since_flush;
+    EepromCache.dirty = false;
+    EepromCache.writes_since_flush = 0;
+
+    lock.unlock();
+    auto start = eeprom_clock::now();
+    bool written = write_image(EepromCache.path, image);
+    double elapsed_ms = std::chrono::duration<double, std::milli>(eeprom_clock::now() - start).count();
+    lock.lock();
+
+    if (written) {
+        EepromCache.flushes++;
+        printf("Saved EEPROM in %.2f ms, %" PRIu64 " writes absorbed (%" PRIu64 " total, %" PRIu64 " unchanged, %" PRIu64 " flushes)\n",
+            elapsed_ms, writes, EepromCache.writes, EepromCache.unchanged_writes, EepromCache.flushes);
+    }
+    else {
+        // Keep the image dirty so the next flush retries.
+        EepromCache.failed_flushes++;
+        if (!EepromCache.dirty) {
+            EepromCache.dirty = true;
+            EepromCache.first_unflushed_write = eeprom_clock::now();
+            EepromCache.last_write = EepromCache.first_unflushed_write;
+        }
+        EepromCache.writes_since_flush += writes;
+        printf("Failed to save EEPROM to %s\n", EepromCache.path.string().c_str());
+    }
+}
+
+static void writer_thread_func() {
+    std::unique_lock lock{ EepromCache.mutex };
+    while (!EepromCache.stopping) {
+        if (!EepromCache.dirty) {
+            EepromCache.cv.wait(lock, [] { return EepromCache.stopping || EepromCache.dirty; });
+            continue;
+        }
+
+        auto flush_time = std::min(EepromCache.last_write + flush_debounce, EepromCache.first_unflushed_write + flush_max_delay);
+        if (eeprom_clock::now() < flush_time) {
+            // Woken up early by another write or by stopping, either way recompute the flush time.
+            EepromCache.cv.wait_until(lock, flush_time);
+            continue;
+        }
+        flush_locked(lock);
+    }
+}
+
+// Loads the game's save file on first use. Called with the lock held.
+static void load_locked(const std::u8string& game_id) {
+    if (EepromCache.loaded) {
+        return;
+    }
+    EepromCache.loaded = true;
+
+    std::filesystem::path saves_dir = zelda64::get_app_folder_path() / "saves";
+    std::error_code ec;
+    std::filesystem::create_directories(saves_dir, ec);
+    EepromCache.path = saves_dir / (game_id + u8".bin");
+
+    EepromCache.image.clear();
+    std::ifstream file{ EepromCache.path, std::ios::binary };
+    if (file.good()) {
+        EepromCache.image.assign(std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{});
+    }
+    if (EepromCache.image.size() < eeprom_4k_size) {
+        EepromCache.image.resize(eeprom_4k_size, 0);
+    }
+
+    EepromCache.stopping = false;
+    EepromCache.thread = std::thread{ writer_thread_func };
+}
+
+static void eeprom_read(uint8_t* rdram, gpr buffer, uint32_t offset, uint32_t size) {
+    std::lock_guard lock{ EepromCache.mutex };
+    load_locked(recomp::current_game_id());
+    for (uint32_t i = 0; i < size; i++) {
+        MEM_B(i, buffer) = EepromCache.image[offset + i];
+    }
+}
+
+static void eeprom_write(uint8_t* rdram, gpr buffer, uint32_t offset, uint32_t size) {
+    std::lock_guard lock{ EepromCache.mutex };
+    load_locked(recomp::current_game_id());
+    EepromCache.writes++;
+
+    bool changed = false;
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t value = MEM_B(i, buffer);
+        if (EepromCache.image[offset + i] != value) {
+            EepromCache.image[offset + i] = value;
+            changed = true;
+        }
+    }
+    if (!changed) {
+        EepromCache.unchanged_writes++;
+        return;
+    }
+
+    auto now = eeprom_clock::now();
+    if (!EepromCache.dirty) {
+        EepromCache.dirty = true;
+        EepromCache.first_unflushed_write = now;
+    }
+    EepromCache.last_write = now;
+    EepromCache.writes_since_flush++;
+    EepromCache.cv.notify_one();
+}
+
+// Returns false (and the game gets an error) if the access runs past the end of the EEPROM.
+static bool eeprom_range_valid(uint32_t address, uint32_t size) {
+    return address * eeprom_block_size + size <= eeprom_4k_size;
+}
+
+extern "C" void recomp_eeprom_probe(uint8_t* rdram, recomp_context* ctx) {
+    _return(ctx, eeprom_type_4k);
+}
+
+extern "C" void recomp_eeprom_read(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t address = _arg<0, u8>(rdram, ctx);
+    gpr buffer = ctx->r5;
+    int32_t size = _arg<2, s32>(rdram, ctx);
+    if (size < 0 || !eeprom_range_valid(address, static_cast<uint32_t>(size))) {
+        _return(ctx, -1);
+        return;
+    }
+    eeprom_read(rdram, buffer, address * eeprom_block_size, static_cast<uint32_t>(size));
+    _return(ctx, 0);
+}
+
+extern "C" void recomp_eeprom_write(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t address = _arg<0, u8>(rdram, ctx);
+    gpr buffer = ctx->r5;
+    int32_t size = _arg<2, s32>(rdram, ctx);
+    if (size < 0 || !eeprom_range_valid(address, static_cast<uint32_t>(size))) {
+        _return(ctx, -1);
+        return;
+    }
+    eeprom_write(rdram, buffer, address * eeprom_block_size, static_cast<uint32_t>(size));
+    _return(ctx, 0);
+}
+
+std::vector<uint8_t> zelda64::get_eeprom_image(const std::u8string& game_id) {
+    std::lock_guard lock{ EepromCache.mutex };
+    load_locked(game_id);
+    return std::vector<uint8_t>(EepromCache.image.begin(), EepromCache.image.begin() + eeprom_4k_size);
+}
+
+void zelda64::use_temporary_eeprom_image(const std::u8string& game_id, const std::vector<uint8_t>& image) {
+    std::lock_guard lock{ EepromCache.mutex };
+    load_locked(game_id);
+    std::fill(EepromCache.image.begin(), EepromCache.image.begin() + eeprom_4k_size, uint8_t{ 0 });
+    std::copy_n(image.begin(), std::min<size_t>(image.size(), eeprom_4k_size), EepromCache.image.begin());
+    EepromCache.temporary = true;
+    EepromCache.dirty = false;
+    EepromCache.writes_since_flush = 0;
+}
+
+void zelda64::stop_eeprom_cache() {
+    {
+        std::unique_lock lock{ EepromCache.mutex };
+        if (!EepromCache.loaded) {
+            return;
+        }
+        EepromCache.stopping = true;
+        EepromCache.cv.notify_one();
+    }
+    EepromCache.thread.join();
+
+    // Write anything the writer thread didn't get to.
+    std::unique_lock lock{ EepromCache.mutex };
+    flush_locked(lock);
+    EepromCache.loaded = false;
+    EepromCache.temporary = false;
+}
@@ -1,5 +1,13 @@
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
+#include <chrono>
+#include <cinttypes>
 #include <mutex>
+#include <random>
+#include <semaphore>
+#include <thread>
 #include <functional>
 #include <unordered_set>
 
@@ -7,6 +15,7 @@
 #include "recomp.h"
 #include "recomp_input.h"
 #include "zelda_config.h"
+#include "zelda_game.h"
 #include "recomp_ui.h"
 #include "SDL.h"
 #include "promptfont.h"
@@ -16,15 +25,69 @@ constexpr float axis_threshold = 0.5f;
 
 struct ControllerState {
     SDL_GameController* controller;
+    // Identity of the controller, queried from SDL once when it's opened instead of on every assignment pass.
+    recomp::ControllerGUID guid;
     std::array<float, 3> latest_accelerometer;
     GamepadMotion motion;
     uint32_t prev_gyro_timestamp;
-    ControllerState() : controller{}, latest_accelerometer{}, motion{}, prev_gyro_timestamp{} {
+    // Buttons pressed (from SDL button events) since the controller was last sampled, so taps that start and end
+    // between two polls still reach the game.
+    uint32_t pressed_since_sample;
+    ControllerState() : controller{}, guid{}, latest_accelerometer{}, motion{}, prev_gyro_timestamp{}, pressed_since_sample{} {
         motion.Reset();
         motion.SetCalibrationMode(GamepadMotionHelpers::CalibrationMode::Stillness | GamepadMotionHelpers::CalibrationMode::SensorFusion);
     };
 };
 
+// Controller state for one N64 controller slot, sampled from SDL once per poll. In single controller mode every slot
+// holds the combined state of all detected controllers.
+struct ControllerSlotSnapshot {
+    uint32_t buttons; // Bitmask indexed by SDL_GameControllerButton.
+    // Sum of each controller's axis value clamped to the positive and negative range respectively.
+    std::array<float, SDL_CONTROLLER_AXIS_MAX> axis_pos;
+    std::array<float, SDL_CONTROLLER_AXIS_MAX> axis_neg;
+    bool present;
+    bool has_rumble_pak;
+};
+
+// Immutable once published. Readers (get_n64_input and friends) only ever look at the most recently published snapshot,
+// so they don't need to lock controllers_mutex or call into SDL. The game thread reads the published snapshot in place,
+// since only it can hand that buffer back to the writer. Readers on any other thread get a copy, checked against the
+// buffer's write sequence so it never mixes two writes (see current_input_snapshot).
+// Button and key presses are latched: a snapshot reports everything that was held at any point since the last snapshot
+// the game thread took, so a tap that starts and ends between two reads is still seen once.
+struct InputSnapshot {
+    std::array<ControllerSlotSnapshot, 4> slots;
+    // Bitmask of the keyboard keys that are held, indexed by SDL_Scancode. Keys that should_override_keystate filters out
+    // (e.g. Enter while Alt is held) are left clear.
+    std::array<uint64_t, SDL_NUM_SCANCODES / 64> keys;
+};
+
+static_assert(SDL_CONTROLLER_BUTTON_MAX <= 32, "Controller button bitmask is too small");
+static_assert(SDL_NUM_SCANCODES % 64 == 0, "Keyboard bitmask doesn't cover every scancode");
+
+// One direction of the N64 stick (e.g. X_AXIS_NEG) as compiled from the InputFields bound to it.
+struct CompiledStickDirection {
+    std::array<uint64_t, SDL_NUM_SCANCODES / 64> key_mask;
+    uint32_t button_mask;
+    uint32_t num_axes;
+    std::array<uint8_t, recomp::bindings_per_input> axis_halves; // See axis_half_index.
+};
+
+// Flat form of a player's N64 bindings, built by recomp::compile_n64_bindings whenever the bindings change. The button
+// tables map each key, controller button and axis half to the N64 button bits it's bound to. The stick directions are
+// indexed by GameInput starting at Y_AXIS_POS, with keyboard and controller mappings kept apart because only the
+// controller mappings go through the joystick deadzone.
+struct CompiledN64Bindings {
+    std::array<uint16_t, SDL_NUM_SCANCODES> key_buttons;
+    std::array<uint16_t, SDL_CONTROLLER_BUTTON_MAX> controller_buttons;
+    std::array<uint16_t, SDL_CONTROLLER_AXIS_MAX * 2> axis_buttons;
+    std::array<CompiledStickDirection, 4> keyboard_stick;
+    std::array<CompiledStickDirection, 4> controller_stick;
+};
+
+static std::array<CompiledN64Bindings, 4> compiled_n64_bindings{};
+
 static struct {
     const Uint8* keys = nullptr;
     SDL_Keymod keymod = SDL_Keymod::KMOD_NONE;
@@ -36,6 +99,28 @@ static struct {
     std::array<SDL_GameController*, 4> assigned_controllers{}; // Only used when Multiplayer is enabled.
     std::unordered_map<SDL_JoystickID, ControllerState> controller_states;
     bool single_controller = true;
+    // Set whenever the assignment inputs change (hotplug, controller GUIDs in the config, controller mode).
+    std::atomic_bool assignments_dirty = true;
+
+    // Triple-buffered snapshots. The writer (publish_input_snapshot) fills the back buffer and swaps it with the middle
+    // one. The game thread swaps the middle one with its front buffer whenever a newer
+    // snapshot is available, and publishes the front buffer for readers.
+    std::array<InputSnapshot, 3> snapshots{};
+    uint32_t back_snapshot = 1; // Writer only.
+    std::atomic_uint32_t middle_snapshot = 2; // Index, plus snapshot_fresh_bit until the game thread takes it.
+    uint32_t front_snapshot = 0; // Game thread only.
+    std::atomic<const InputSnapshot*> published_snapshot = &snapshots[0];
+    // Per buffer write sequence, odd while the writer is filling the buffer.
+    std::array<std::atomic_uint32_t, 3> snapshot_sequences{};
+
+    // Presses accumulated by the writer since the game thread last took a snapshot.
+    std::array<uint32_t, 4> latched_buttons{};
+    std::array<uint64_t, SDL_NUM_SCANCODES / 64> latched_keys{};
+    // Keys pressed (from SDL key events) since the last snapshot was written.
+    std::array<std::atomic_uint64_t, SDL_NUM_SCANCODES / 64> pressed_keys{};
+
+    // Timestamp (SDL ticks) of the oldest press that the game hasn't seen yet, or 0. Used for the input latency stats.
+    std::atomic_uint32_t pending_press_ticks = 0;
     
     std::array<float, 2> rotation_delta{};
     std::array<float, 2> mouse_delta{};
@@ -44,6 +129,8 @@ static struct {
     std::array<float, 2> pending_mouse_delta{};
 
     std::array<float, 4> cur_rumble{};
+    // Taken before controllers_mutex by anything that closes a controller or sends rumble to it.
+    std::mutex rumble_mutex;
     std::array<bool, 4> rumble_active{};
 } InputState;
 
@@ -127,6 +214,8 @@ static recomp::ControllerGUID make_guid_for_controller(SDL_GameController* contr
     };
 }
 
+static void rebuild_controller_assignments_locked();
+
 static void show_controller_assignment_prompt_locked() {
     const int player_num = ControllerAssignState.next_player + 1;
     recompui::open_notification(
@@ -169,7 +258,7 @@ static bool try_handle_controller_assignment(SDL_JoystickID instance_id) {
         ControllerAssignState.next_player++;
 
         // Apply updated GUIDs to slot assignment immediately.
-        recomp::poll_inputs();
+        recomp::refresh_controller_assignments();
 
         const bool done_with_prompts = (ControllerAssignState.next_player >= ControllerAssignState.prompt_player_count);
         if (done_with_prompts) {
@@ -198,7 +287,7 @@ static bool try_handle_controller_assignment(SDL_JoystickID instance_id) {
                 if (remaining_controller != nullptr) {
                     recomp::set_input_controller_guid(3, make_guid_for_controller(remaining_controller));
                     ControllerAssignState.assigned_instance_ids.insert(remaining_instance_id);
-                    recomp::poll_inputs();
+                    recomp::refresh_controller_assignments();
                     recompui::set_prompt_progress(4, 4);
 
                     ControllerAssignState.active = false;
@@ -241,12 +330,25 @@ bool should_override_keystate(SDL_Scancode key, SDL_Keymod mod) {
     return false;        
 }
 
+// Remembers when the oldest press the game hasn't seen yet happened, see record_input_latency.
+static void note_press_event(uint32_t timestamp) {
+    uint32_t expected = 0;
+    InputState.pending_press_ticks.compare_exchange_strong(expected, timestamp == 0 ? 1 : timestamp);
+}
+
 bool sdl_event_filter(void* userdata, SDL_Event* event) {
     switch (event->type) {
     case SDL_EventType::SDL_KEYDOWN:
         {
             SDL_KeyboardEvent* keyevent = &event->key;
 
+            SDL_Scancode scancode = keyevent->keysym.scancode;
+            if (!keyevent->repeat && scancode >= 0 && scancode < SDL_NUM_SCANCODES &&
+                !should_override_keystate(scancode, static_cast<SDL_Keymod>(keyevent->keysym.mod))) {
+                InputState.pressed_keys[scancode / 64].fetch_or(uint64_t{1} << (scancode % 64));
+                note_press_event(keyevent->timestamp);
+            }
+
             if (recomp::is_controller_assignment_active() &&
                 keyevent->keysym.scancode == SDL_Scancode::SDL_SCANCODE_ESCAPE) {
                 recomp::cancel_controller_assignment();
@@ -288,6 +390,7 @@ bool sdl_event_filter(void* userdata, SDL_Event* event) {
         {
             SDL_ControllerDeviceEvent* controller_event = &event->cdevice;
             // 'which' is a joystick instance id for REMOVED.
+            std::lock_guard rumble_lock{ InputState.rumble_mutex };
             std::lock_guard lock{ InputState.controllers_mutex };
             auto it = InputState.controller_states.find(controller_event->which);
             if (it != InputState.controller_states.end()) {
@@ -296,6 +399,21 @@ bool sdl_event_filter(void* userdata, SDL_Event* event) {
                 }
                 InputState.controller_states.erase(it);
             }
+            // Rebuild right away so the closed controller can't be used by a reader before the next poll.
+            rebuild_controller_assignments_locked();
+        }
+        break;
+    case SDL_EventType::SDL_CONTROLLERDEVICEREMAPPED:
+        {
+            SDL_ControllerDeviceEvent* controller_event = &event->cdevice;
+            // 'which' is a joystick instance id for REMAPPED. The mapping can change the controller's identity, so
+            // query it again.
+            std::lock_guard lock{ InputState.controllers_mutex };
+            auto it = InputState.controller_states.find(controller_event->which);
+            if (it != InputState.controller_states.end() && it->second.controller != nullptr) {
+                it->second.guid = make_guid_for_controller(it->second.controller);
+            }
+            InputState.assignments_dirty.store(true);
         }
         break;
     case SDL_EventType::SDL_QUIT: {
@@ -317,6 +435,14 @@ bool sdl_event_filter(void* userdata, SDL_Event* event) {
         queue_if_enabled(event);
         break;
     case SDL_EventType::SDL_CONTROLLERBUTTONDOWN:
+        if (event->cbutton.button < SDL_CONTROLLER_BUTTON_MAX) {
+            std::lock_guard lock{ InputState.controllers_mutex };
+            auto it = InputState.controller_states.find(event->cbutton.which);
+            if (it != InputState.controller_states.end()) {
+                it->second.pressed_since_sample |= 1u << event->cbutton.button;
+            }
+        }
+        note_press_event(event->cbutton.timestamp);
         if (recomp::is_controller_assignment_active()) {
             (void)try_handle_controller_assignment(event->cbutton.which);
             break;
@@ -389,10 +515,13 @@ bool sdl_event_filter(void* userdata, SDL_Event* event) {
             float x = event->csensor.data[0] / SDL_STANDARD_GRAVITY;
             float y = event->csensor.data[1] / SDL_STANDARD_GRAVITY;
             float z = event->csensor.data[2] / SDL_STANDARD_GRAVITY;
-            ControllerState& state = InputState.controller_states[event->csensor.which];
-            state.latest_accelerometer[0] = x;
-            state.latest_accelerometer[1] = y;
-            state.latest_accelerometer[2] = z;
+            std::lock_guard lock{ InputState.controllers_mutex };
+            auto it = InputState.controller_states.find(event->csensor.which);
+            if (it != InputState.controller_states.end()) {
+                it->second.latest_accelerometer[0] = x;
+                it->second.latest_accelerometer[1] = y;
+                it->second.latest_accelerometer[2] = z;
+            }
         }
         else if (event->csensor.sensor == SDL_SensorType::SDL_SENSOR_GYRO) {
             // constexpr float gyro_threshold = 0.05f;
@@ -401,15 +530,21 @@ bool sdl_event_filter(void* userdata, SDL_Event* event) {
             float x = event->csensor.data[0] * rad_to_deg;
             float y = event->csensor.data[1] * rad_to_deg;
             float z = event->csensor.data[2] * rad_to_deg;
-            ControllerState& state = InputState.controller_states[event->csensor.which];
-            uint64_t cur_timestamp = event->csensor.timestamp;
-            uint32_t delta_ms = cur_timestamp - state.prev_gyro_timestamp;
-            state.motion.ProcessMotion(x, y, z, state.latest_accelerometer[0], state.latest_accelerometer[1], state.latest_accelerometer[2], delta_ms * 0.001f);
-            state.prev_gyro_timestamp = cur_timestamp;
-
             float rot_x = 0.0f;
             float rot_y = 0.0f;
-            state.motion.GetPlayerSpaceGyro(rot_x, rot_y);
+            {
+                std::lock_guard lock{ InputState.controllers_mutex };
+                auto it = InputState.controller_states.find(event->csensor.which);
+                if (it == InputState.controller_states.end()) {
+                    break;
+                }
+                ControllerState& state = it->second;
+                uint64_t cur_timestamp = event->csensor.timestamp;
+                uint32_t delta_ms = cur_timestamp - state.prev_gyro_timestamp;
+                state.motion.ProcessMotion(x, y, z, state.latest_accelerometer[0], state.latest_accelerometer[1], state.latest_accelerometer[2], delta_ms * 0.001f);
+                state.prev_gyro_timestamp = cur_timestamp;
+                state.motion.GetPlayerSpaceGyro(rot_x, rot_y);
+            }
 
             {
                 std::lock_guard lock{ InputState.pending_input_mutex };
@@ -505,7 +640,9 @@ static void open_controller_device_index(int device_index) {
             return;
         }
         it->second.controller = controller;
+        it->second.guid = make_guid_for_controller(controller);
     }
+    InputState.assignments_dirty.store(true);
 
     if (SDL_GameControllerHasSensor(controller, SDL_SensorType::SDL_SENSOR_GYRO) &&
         SDL_GameControllerHasSensor(controller, SDL_SensorType::SDL_SENSOR_ACCEL)) {
@@ -524,7 +661,7 @@ void recomp::scan_controllers() {
     }
 
     // Refresh assignments based on current devices + config.
-    recomp::poll_inputs();
+    recomp::refresh_controller_assignments();
 }
 
 void recomp::begin_controller_assignment(int detected_controller_count, std::function<void()> on_complete, std::function<void()> on_cancel) {
@@ -646,6 +783,9 @@ const recomp::DefaultN64Mappings recomp::default_n64_keyboard_mappings = {
     },
     .apply_menu = {
         {.input_type = (uint32_t)InputType::Keyboard, .input_id = SDL_SCANCODE_F}
+    },
+    .rewind = {
+        {.input_type = (uint32_t)InputType::Keyboard, .input_id = SDL_SCANCODE_BACKSPACE}
     }
 };
 
@@ -719,84 +859,281 @@ const recomp::DefaultN64Mappings recomp::default_n64_controller_mappings = {
     }
 };
 
-void recomp::poll_inputs() {
-    InputState.keys = SDL_GetKeyboardState(&InputState.numkeys);
-    InputState.keymod = SDL_GetModState();
+// Matches the opened controllers against the configured controller GUIDs. This only needs to run when one of those
+// changes, so it's driven by hotplug events and config changes instead of running on every poll.
+static void rebuild_controller_assignments_locked() {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Cleared first so an invalidation that happens while rebuilding isn't lost.
+    InputState.assignments_dirty.store(false);
+    InputState.detected_controllers.clear();
+
+    static std::vector<const ControllerState*> free_controllers;
+    free_controllers.clear();
+
+    for (auto& [id, state] : InputState.controller_states) {
+        (void) id; // Avoid unused variable warning.
+        if (state.controller != nullptr) {
+            // The rest of the identity is fixed while the controller is open, but the player index can be changed
+            // by SDL or the OS at any time.
+            SDL_Joystick* joystick = SDL_GameControllerGetJoystick(state.controller);
+            if (joystick != nullptr) {
+                state.guid.player_index = SDL_JoystickGetPlayerIndex(joystick);
+            }
+            free_controllers.emplace_back(&state);
+            InputState.detected_controllers.push_back(state.controller);
+        }
+    }
 
-    {
-        std::lock_guard lock{ InputState.controllers_mutex };
-        InputState.detected_controllers.clear();
+    // Assign controllers based on configuration.
+    InputState.assigned_controllers.fill(nullptr);
+
+    // FIXME: Use active player count instead of iterating on all possible players.
+    for (size_t i = 0; i < 4; i++) {
+        recomp::ControllerGUID controller_guid = recomp::get_input_controller_guid(i);
+        int min_index_difference = INT_MAX;
+        size_t j = 0;
+        while (j < free_controllers.size()) {
+            const recomp::ControllerGUID& joystick_guid = free_controllers[j]->guid;
+            if (joystick_guid.vendor == controller_guid.vendor && joystick_guid.product == controller_guid.product &&
+                joystick_guid.version == controller_guid.version && joystick_guid.crc16 == controller_guid.crc16 &&
+                joystick_guid.serial == controller_guid.serial) {
+                // The controller seems to be a match, but we use the controller with the least difference in
+                // player index to sort out potential duplicates.
+                int index_difference = abs(controller_guid.player_index - joystick_guid.player_index);
+                if (min_index_difference > index_difference) {
+                    InputState.assigned_controllers[i] = free_controllers[j]->controller;
+                    min_index_difference = index_difference;
+                    free_controllers.erase(free_controllers.begin() + j);
+                    continue;
+                }
+            }
 
-        static std::vector<size_t> free_controllers;
-        free_controllers.clear();
+            j++;
+        }
+    }
 
-        for (const auto& [id, state] : InputState.controller_states) {
-            (void) id; // Avoid unused variable warning.
-            SDL_GameController* controller = state.controller;
-            if (controller != nullptr) {
-                free_controllers.emplace_back(InputState.detected_controllers.size());
-                InputState.detected_controllers.push_back(controller);
-            }
+    // Do a second pass to assign controllers that are currently unused to the remaining players that failed to be
+    // assigned a controller.
+    for (int i = 0; i < 4; i++) {
+        if (InputState.assigned_controllers[i] != nullptr) {
+            continue;
         }
 
-        // Assign controllers based on configuration.
-        InputState.assigned_controllers.fill(nullptr);
-
-        // FIXME: Use active player count instead of iterating on all possible players.
-        Uint16 vendor, product, version, crc16;
-        for (size_t i = 0; i < 4; i++) {
-            recomp::ControllerGUID controller_guid = recomp::get_input_controller_guid(i);
-            int min_index_difference = INT_MAX;
-            size_t j = 0;
-            while (j < free_controllers.size()) {
-                SDL_GameController* controller = InputState.detected_controllers[free_controllers[j]];
-                SDL_Joystick* joystick = SDL_GameControllerGetJoystick(controller);
-                if (joystick != nullptr) {
-                    SDL_JoystickGUID joystick_guid = SDL_JoystickGetGUID(joystick);
-                    const char* joystick_serial = SDL_JoystickGetSerial(joystick);
-                    SDL_GetJoystickGUIDInfo(joystick_guid, &vendor, &product, &version, &crc16);
-
-                    bool empty_serials = controller_guid.serial.empty() && joystick_serial == nullptr;
-                    bool matching_serials =
-                        joystick_serial != nullptr && strcmp(joystick_serial, controller_guid.serial.c_str()) == 0;
-                    if (vendor == controller_guid.vendor && product == controller_guid.product &&
-                        version == controller_guid.version && crc16 == controller_guid.crc16 &&
-                        (empty_serials || matching_serials)) {
-                        // The controller seems to be a match, but we use the controller with the least difference in
-                        // player index to sort out potential duplicates.
-                        int joystick_player_index = SDL_JoystickGetPlayerIndex(joystick);
-                        int index_difference = abs(controller_guid.player_index - joystick_player_index);
-                        if (min_index_difference > index_difference) {
-                            InputState.assigned_controllers[i] = controller;
-                            min_index_difference = index_difference;
-                            free_controllers.erase(free_controllers.begin() + j);
-                            continue;
-                        }
-                    }
-                }
+        if (!free_controllers.empty()) {
+            // Assign a free controller only.
+            InputState.assigned_controllers[i] = free_controllers.front()->controller;
+            free_controllers.erase(free_controllers.begin());
+        } else {
+            // Prefer not to assign a controller if none of them are free.
+            break;
+        }
+    }
 
-                j++;
-            }
+    if (zelda64::get_debug_mode_enabled()) {
+        auto end = std::chrono::high_resolution_clock::now();
+        printf("Controller assignments rebuilt for %zu controller(s) in %lld us\n", InputState.detected_controllers.size(),
+            static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()));
+    }
+}
+
+void recomp::refresh_controller_assignments() {
+    std::lock_guard lock{ InputState.controllers_mutex };
+    rebuild_controller_assignments_locked();
+}
+
+void recomp::invalidate_controller_assignments() {
+    InputState.assignments_dirty.store(true);
+}
+
+static void sample_controller(ControllerSlotSnapshot& slot, SDL_GameController* controller) {
+    for (int button = 0; button < SDL_CONTROLLER_BUTTON_MAX; button++) {
+        if (SDL_GameControllerGetButton(controller, (SDL_GameControllerButton)button)) {
+            slot.buttons |= 1u << button;
         }
+    }
 
-        // Do a second pass to assign controllers that are currently unused to the remaining players that failed to be
-        // assigned a controller.
-        for (int i = 0; i < 4; i++) {
-            if (InputState.assigned_controllers[i] != nullptr) {
-                continue;
-            }
+    auto state_it = InputState.controller_states.find(SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(controller)));
+    if (state_it != InputState.controller_states.end()) {
+        slot.buttons |= state_it->second.pressed_since_sample;
+    }
 
-            if (!free_controllers.empty()) {
-                // Assign a free controller only.
-                InputState.assigned_controllers[i] = InputState.detected_controllers[free_controllers.front()];
-                free_controllers.erase(free_controllers.begin());
-            } else {
-                // Prefer not to assign a controller if none of them are free.
-                break;
+    for (int axis = 0; axis < SDL_CONTROLLER_AXIS_MAX; axis++) {
+        float cur_val = SDL_GameControllerGetAxis(controller, (SDL_GameControllerAxis)axis) * (1 / 32768.0f);
+        slot.axis_pos[axis] += std::clamp(cur_val, 0.0f, 1.0f);
+        slot.axis_neg[axis] += std::clamp(-cur_val, 0.0f, 1.0f);
+    }
+}
+
+constexpr uint32_t snapshot_fresh_bit = 0x4;
+constexpr uint32_t snapshot_index_mask = 0x3;
+
+// Samples every key, button and axis of the assigned controllers and publishes them as the newest snapshot. This is the
+// only place on the input read path that touches controllers_mutex, and it does so once per poll. Only called from
+// poll_inputs.
+static void publish_input_snapshot() {
+    InputSnapshot& next = InputState.snapshots[InputState.back_snapshot];
+    std::atomic_uint32_t& sequence = InputState.snapshot_sequences[InputState.back_snapshot];
+    uint32_t start_sequence = sequence.load(std::memory_order_relaxed) + 1;
+    sequence.store(start_sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    next = {};
+
+    // Start latching from scratch once the game thread has taken the previous snapshot. If it takes it right after this
+    // check, presses that were already delivered get reported one more time, which only extends them by one read.
+    if ((InputState.middle_snapshot.load(std::memory_order_acquire) & snapshot_fresh_bit) == 0) {
+        InputState.latched_buttons = {};
+        InputState.latched_keys = {};
+    }
+
+    int numkeys = 0;
+    const Uint8* keys = SDL_GetKeyboardState(&numkeys);
+    SDL_Keymod keymod = SDL_GetModState();
+    numkeys = std::min(numkeys, (int)SDL_NUM_SCANCODES);
+    for (int key = 0; key < numkeys; key++) {
+        if (keys[key] && !should_override_keystate((SDL_Scancode)key, keymod)) {
+            next.keys[key / 64] |= uint64_t{1} << (key % 64);
+        }
+    }
+    for (size_t word = 0; word < next.keys.size(); word++) {
+        InputState.latched_keys[word] |= next.keys[word] | InputState.pressed_keys[word].exchange(0);
+        next.keys[word] = InputState.latched_keys[word];
+    }
+
+    {
+        std::lock_guard lock{ InputState.controllers_mutex };
+        if (InputState.single_controller) {
+            for (SDL_GameController* controller : InputState.detected_controllers) {
+                sample_controller(next.slots[0], controller);
+            }
+            next.slots[0].has_rumble_pak = !InputState.detected_controllers.empty();
+            for (size_t i = 1; i < next.slots.size(); i++) {
+                next.slots[i] = next.slots[0];
             }
         }
+        else {
+            for (size_t i = 0; i < next.slots.size(); i++) {
+                SDL_GameController* controller = InputState.assigned_controllers[i];
+                if (controller != nullptr) {
+                    sample_controller(next.slots[i], controller);
+                    next.slots[i].present = true;
+                    next.slots[i].has_rumble_pak = true;
+                }
+            }
+        }
+
+        // Taps on controllers that aren't assigned to anything shouldn't show up once they are.
+        for (auto& [instance_id, state] : InputState.controller_states) {
+            state.pressed_since_sample = 0;
+        }
+    }
+
+    for (size_t i = 0; i < next.slots.size(); i++) {
+        InputState.latched_buttons[i] |= next.slots[i].buttons;
+        next.slots[i].buttons = InputState.latched_buttons[i];
+    }
+    sequence.store(start_sequence + 1, std::memory_order_release);
+
+    uint32_t prev_middle = InputState.middle_snapshot.exchange(InputState.back_snapshot | snapshot_fresh_bit, std::memory_order_acq_rel);
+    InputState.back_snapshot = prev_middle & snapshot_index_mask;
+}
+
+// Set on the thread that acquires snapshots, which is the only one that can read the published one in place.
+static thread_local bool owns_published_snapshot = false;
+
+// Takes the newest snapshot if the writer has published one since the last call. Game thread only.
+static void acquire_input_snapshot() {
+    owns_published_snapshot = true;
+    if ((InputState.middle_snapshot.load(std::memory_order_relaxed) & snapshot_fresh_bit) == 0) {
+        return;
     }
 
+    uint32_t prev_middle = InputState.middle_snapshot.exchange(InputState.front_snapshot, std::memory_order_acq_rel);
+    InputState.front_snapshot = prev_middle & snapshot_index_mask;
+    InputState.published_snapshot.store(&InputState.snapshots[InputState.front_snapshot], std::memory_order_release);
+}
+
+// The most recently published snapshot. On any thread but the game thread, the buffer can be handed back to the writer
+// and refilled at any time, so it's copied instead, retrying until the copy doesn't overlap a write. The copy is only
+// valid until the next call on the same thread.
+static const InputSnapshot& current_input_snapshot() {
+    const InputSnapshot* published = InputState.published_snapshot.load(std::memory_order_acquire);
+    if (owns_published_snapshot) {
+        return *published;
+    }
+
+    thread_local InputSnapshot copy;
+    while (true) {
+        published = InputState.published_snapshot.load(std::memory_order_acquire);
+        std::atomic_uint32_t& sequence = InputState.snapshot_sequences[published - InputState.snapshots.data()];
+        uint32_t start_sequence = sequence.load(std::memory_order_acquire);
+        if ((start_sequence & 1) != 0) {
+            continue;
+        }
+        copy = *published;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == start_sequence) {
+            return copy;
+        }
+    }
+}
+
+// Press to game latency, in milliseconds, of the most recent presses. Only written from the game thread.
+static struct {
+    std::array<uint32_t, 256> samples{};
+    size_t count = 0;
+    std::array<uint16_t, 4> prev_buttons{};
+} InputLatencyStats;
+
+static void print_input_latency_stats() {
+    size_t num_samples = std::min(InputLatencyStats.count, InputLatencyStats.samples.size());
+    std::array<uint32_t, 256> sorted = InputLatencyStats.samples;
+    std::sort(sorted.begin(), sorted.begin() + num_samples);
+    printf("Input latency over the last %zu presses: median %u ms, p99 %u ms\n",
+        num_samples, sorted[num_samples / 2], sorted[(num_samples * 99) / 100]);
+}
+
+// Called with each N64 button word the game reads. When new buttons show up, the time since the oldest unseen SDL press
+// event is recorded as that press' latency.
+static void record_input_latency(int controller_num, uint16_t buttons) {
+    uint16_t new_buttons = buttons & ~InputLatencyStats.prev_buttons[controller_num];
+    InputLatencyStats.prev_buttons[controller_num] = buttons;
+    if (new_buttons == 0) {
+        return;
+    }
+
+    uint32_t press_ticks = InputState.pending_press_ticks.exchange(0);
+    if (press_ticks == 0) {
+        return;
+    }
+
+    // Presses of unbound keys never clear the pending timestamp, so ignore anything that's clearly not from this press.
+    uint32_t latency = SDL_GetTicks() - press_ticks;
+    if (latency > 250) {
+        return;
+    }
+
+    InputLatencyStats.samples[InputLatencyStats.count % InputLatencyStats.samples.size()] = latency;
+    InputLatencyStats.count++;
+    if (zelda64::get_debug_mode_enabled() && (InputLatencyStats.count % 64) == 0) {
+        print_input_latency_stats();
+    }
+}
+
+
+void recomp::poll_inputs() {
+    InputState.keys = SDL_GetKeyboardState(&InputState.numkeys);
+    InputState.keymod = SDL_GetModState();
+
+    // Assignments are cached, so this is only a flag check unless a controller or the config changed since the last poll.
+    if (InputState.assignments_dirty.load()) {
+        recomp::refresh_controller_assignments();
+    }
+
+    publish_input_snapshot();
+    acquire_input_snapshot();
+    recomp::input_latency_on_poll();
+
     // Read the deltas while resetting them to zero.
     {
         std::lock_guard lock{ InputState.pending_input_mutex };
@@ -807,24 +1144,45 @@ void recomp::poll_inputs() {
         InputState.mouse_delta = InputState.pending_mouse_delta;
         InputState.pending_mouse_delta = { 0.0f, 0.0f };
     }
+
+    // Rewind follows the first player's keyboard and controller bindings.
+    bool rewind_held = false;
+    for (size_t i = 0; i < recomp::bindings_per_input; i++) {
+        rewind_held |= recomp::get_input_digital(0, recomp::get_input_binding(0, recomp::GameInput::REWIND, i, recomp::InputDevice::Keyboard));
+        rewind_held |= recomp::get_input_digital(0, recomp::get_input_binding(0, recomp::GameInput::REWIND, i, recomp::InputDevice::Controller));
+    }
+    zelda64::set_rewind_held(rewind_held);
     
-    // Quicksaving is disabled for now and will likely have more limited functionality
-    // when restored, rather than allowing saving and loading at any point in time.
-    #if 0
+    // F5 saves and F7 loads. The action waits for the game's threads to reach the handshake checkpoints in
+    // quicksaving.cpp, and is cancelled if they don't. Holding shift saves to or loads from the save state file instead of memory.
     if (InputState.keys) {
         static bool save_was_held = false;
         static bool load_was_held = false;
         bool save_is_held = InputState.keys[SDL_SCANCODE_F5] != 0;
         bool load_is_held = InputState.keys[SDL_SCANCODE_F7] != 0;
+        bool to_file = InputState.keys[SDL_SCANCODE_LSHIFT] != 0 || InputState.keys[SDL_SCANCODE_RSHIFT] != 0;
+        std::filesystem::path save_state_path = zelda64::get_app_folder_path() / "quicksave.state";
         if (save_is_held && !save_was_held) {
-            zelda64::quicksave_save();
+            if (to_file) {
+                zelda64::save_state_to_file(save_state_path);
+            }
+            else {
+                zelda64::quicksave_save();
+            }
         }
         else if (load_is_held && !load_was_held) {
-            zelda64::quicksave_load();
+            if (to_file) {
+                if (!zelda64::load_state_from_file(save_state_path)) {
+                    printf("Failed to load save state %s\n", save_state_path.string().c_str());
+                }
+            }
+            else {
+                zelda64::quicksave_load();
+            }
         }
         save_was_held = save_is_held;
+        load_was_held = load_is_held;
     }
-    #endif
 }
 
 void recomp::set_rumble(int controller_num, bool on) {
@@ -844,15 +1202,11 @@ ultramodern::input::connected_device_info_t recomp::get_connected_device_info(in
     }
 
     // Only report a Rumble Pak when there is a physical controller assigned/available for that slot.
-    std::lock_guard lock{ InputState.controllers_mutex };
-    if (InputState.single_controller) {
-        info.connected_pak = InputState.detected_controllers.empty() ? ultramodern::input::Pak::None : ultramodern::input::Pak::RumblePak;
-    } else {
-        info.connected_pak = (controller_num >= 0 && controller_num < (int)InputState.assigned_controllers.size() &&
-                              InputState.assigned_controllers[controller_num] != nullptr)
-                                 ? ultramodern::input::Pak::RumblePak
-                                 : ultramodern::input::Pak::None;
-    }
+    const InputSnapshot& snapshot = current_input_snapshot();
+    info.connected_pak = (controller_num >= 0 && controller_num < (int)snapshot.slots.size() &&
+                          snapshot.slots[controller_num].has_rumble_pak)
+                             ? ultramodern::input::Pak::RumblePak
+                             : ultramodern::input::Pak::None;
 
     return info;
 }
@@ -867,12 +1221,8 @@ bool recomp::n64_controller_present(int controller_num) {
         return false;
     }
 
-    std::lock_guard lock{ InputState.controllers_mutex };
-    if (InputState.single_controller) {
-        return false;
-    }
-
-    return InputState.assigned_controllers[controller_num] != nullptr;
+    // Only set for assigned controllers when not in single controller mode.
+    return current_input_snapshot().slots[controller_num].present;
 }
 
 static float smoothstep(float from, float to, float amount) {
@@ -881,7 +1231,136 @@ static float smoothstep(float from, float to, float amount) {
 }
 
 // Update rumble to attempt to mimic the way n64 rumble ramps up and falls off
+// Rumble output runs on its own thread since SDL_GameControllerRumble can block for milliseconds on some HID drivers.
+// The VI callback only computes the target strength of each slot and posts it to the worker's mailbox, and the worker
+// coalesces those and only calls into SDL when a controller's strength changes meaningfully or its keep-alive is due.
+constexpr uint16_t rumble_change_threshold = 0xFFFF / 64;
+// Rumble is sent with a short duration and refreshed while it's on, so a hang can't leave a controller rumbling.
+constexpr uint32_t rumble_duration_ms = 2000;
+constexpr auto rumble_keep_alive = std::chrono::milliseconds{1000};
+
+static struct {
+    std::thread thread;
+    std::atomic_bool running = false;
+    // Mailbox: latest target strength per slot. The VI callback only signals when a target changes.
+    std::array<std::atomic_uint16_t, 4> targets{};
+    std::array<uint16_t, 4> posted_targets{}; // VI callback only.
+    std::counting_semaphore<> signal{0};
+
+    // SDL call timing, worker only.
+    uint64_t num_calls = 0;
+    std::chrono::nanoseconds total_call_time{};
+    std::chrono::nanoseconds max_call_time{};
+    std::chrono::steady_clock::time_point last_stats_print{};
+} RumbleWorker;
+
+struct RumbleOutput {
+    uint16_t strength;
+    std::chrono::steady_clock::time_point sent_time;
+};
+
+static void send_rumble(SDL_GameController* controller, uint16_t strength) {
+    auto start = std::chrono::steady_clock::now();
+    SDL_GameControllerRumble(controller, 0, strength, rumble_duration_ms);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    RumbleWorker.num_calls++;
+    RumbleWorker.total_call_time += elapsed;
+    RumbleWorker.max_call_time = std::max(RumbleWorker.max_call_time, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+}
+
+static void print_rumble_stats(std::chrono::steady_clock::time_point now) {
+    if (RumbleWorker.num_calls == 0 || now - RumbleWorker.last_stats_print < std::chrono::seconds{10}) {
+        return;
+    }
+
+    printf("Rumble: %" PRIu64 " SDL calls, average %.3f ms, max %.3f ms\n", RumbleWorker.num_calls,
+        std::chrono::duration<double, std::milli>(RumbleWorker.total_call_time).count() / RumbleWorker.num_calls,
+        std::chrono::duration<double, std::milli>(RumbleWorker.max_call_time).count());
+    RumbleWorker.last_stats_print = now;
+    RumbleWorker.num_calls = 0;
+    RumbleWorker.total_call_time = {};
+    RumbleWorker.max_call_time = {};
+}
+
+static void rumble_thread_func() {
+    using clock = std::chrono::steady_clock;
+    std::unordered_map<SDL_GameController*, RumbleOutput> outputs;
+    std::vector<std::pair<SDL_GameController*, uint16_t>> wanted;
+
+    while (RumbleWorker.running.load()) {
+        // Wake up for new targets, or often enough to keep active rumble alive.
+        if (RumbleWorker.signal.try_acquire_for(rumble_keep_alive / 4)) {
+            // Coalesce everything that was posted while this thread was busy or asleep.
+            while (RumbleWorker.signal.try_acquire()) {}
+        }
+
+        std::array<uint16_t, 4> targets;
+        for (size_t i = 0; i < targets.size(); i++) {
+            targets[i] = RumbleWorker.targets[i].load(std::memory_order_relaxed);
+        }
+
+        // Held while calling into SDL so a controller can't be closed mid-call (see the device removal event), without
+        // holding controllers_mutex and stalling input polling on a slow rumble call.
+        std::lock_guard rumble_lock{ InputState.rumble_mutex };
+
+        wanted.clear();
+        {
+            std::lock_guard lock{ InputState.controllers_mutex };
+            if (InputState.single_controller) {
+                // Every slot maps to every controller here, so use the strongest one.
+                uint16_t strength = *std::max_element(targets.begin(), targets.end());
+                for (SDL_GameController* controller : InputState.detected_controllers) {
+                    wanted.emplace_back(controller, strength);
+                }
+            }
+            else {
+                for (size_t i = 0; i < targets.size(); i++) {
+                    if (InputState.assigned_controllers[i] != nullptr) {
+                        wanted.emplace_back(InputState.assigned_controllers[i], targets[i]);
+                    }
+                }
+            }
+        }
+
+        auto now = clock::now();
+        for (const auto& [controller, strength] : wanted) {
+            auto [it, inserted] = outputs.try_emplace(controller, RumbleOutput{ 0, now });
+            RumbleOutput& output = it->second;
+            int delta = std::abs((int)strength - (int)output.strength);
+            bool changed = delta >= rumble_change_threshold || (delta != 0 && (strength == 0 || output.strength == 0));
+            bool keep_alive = output.strength != 0 && now - output.sent_time >= rumble_keep_alive;
+            if (changed || keep_alive) {
+                send_rumble(controller, strength);
+                output = { strength, clock::now() };
+            }
+        }
+
+        // Forget controllers that were closed or unassigned.
+        std::erase_if(outputs, [&](const auto& entry) {
+            return std::find_if(wanted.begin(), wanted.end(), [&](const auto& w) { return w.first == entry.first; }) == wanted.end();
+        });
+
+        if (zelda64::get_debug_mode_enabled()) {
+            print_rumble_stats(clock::now());
+        }
+    }
+}
+
+void recomp::stop_rumble_worker() {
+    if (RumbleWorker.running.exchange(false)) {
+        RumbleWorker.signal.release();
+        RumbleWorker.thread.join();
+    }
+}
+
 void recomp::update_rumble() {
+    if (!RumbleWorker.running.load()) {
+        RumbleWorker.running.store(true);
+        RumbleWorker.thread = std::thread{ rumble_thread_func };
+    }
+
+    bool posted = false;
     for (size_t i = 0; i < InputState.cur_rumble.size(); i++) {
         // Note: values are not accurate! just approximations based on feel
         if (InputState.rumble_active[i]) {
@@ -896,42 +1375,21 @@ void recomp::update_rumble() {
         float smooth_rumble = smoothstep(0, 1, InputState.cur_rumble[i]);
  
         uint16_t rumble_strength = smooth_rumble * (recomp::get_rumble_strength() * 0xFFFF / 100);
-        uint32_t duration = 1000000; // Dummy duration value that lasts long enough to matter as the game will reset rumble on its own.
-        {
-            std::lock_guard lock{ InputState.controllers_mutex };
-            if (InputState.single_controller) {
-                for (const auto &controller : InputState.detected_controllers) {
-                    SDL_GameControllerRumble(controller, 0, rumble_strength, duration);
-                }
-            }
-            else {
-                if (InputState.assigned_controllers[i] != nullptr) {
-                    SDL_GameControllerRumble(InputState.assigned_controllers[i], 0, rumble_strength, duration);
-                }
-            }
-         }
-     }
- }
+        if (rumble_strength != RumbleWorker.posted_targets[i]) {
+            RumbleWorker.targets[i].store(rumble_strength, std::memory_order_relaxed);
+            RumbleWorker.posted_targets[i] = rumble_strength;
+            posted = true;
+        }
+    }
+
+    if (posted) {
+        RumbleWorker.signal.release();
+    }
+}
 
 bool controller_button_state(int controller_num, int32_t input_id) {
     if (input_id >= 0 && input_id < SDL_GameControllerButton::SDL_CONTROLLER_BUTTON_MAX) {
-        SDL_GameControllerButton button = (SDL_GameControllerButton)input_id;
-        bool ret = false;
-        {
-            std::lock_guard lock{ InputState.controllers_mutex };
-            if (InputState.single_controller) {
-                for (const auto &controller : InputState.detected_controllers) {
-                    ret |= SDL_GameControllerGetButton(controller, button);
-                }
-            }
-            else {
-                if (InputState.assigned_controllers[controller_num] != nullptr) {
-                    ret |= SDL_GameControllerGetButton(InputState.assigned_controllers[controller_num], button);
-                }
-            }
-        }
-
-        return ret;
+        return (current_input_snapshot().slots[controller_num].buttons & (1u << input_id)) != 0;
     }
     return false;
 }
@@ -942,36 +1400,16 @@ float controller_axis_state(int controller_num, int32_t input_id, bool allow_sup
     if (abs(input_id) - 1 < SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_MAX) {
         SDL_GameControllerAxis axis = (SDL_GameControllerAxis)(abs(input_id) - 1);
         bool negative_range = input_id < 0;
-        float ret = 0.0f;
 
-        {
-            auto gather_axis_state = [&](SDL_GameController* controller) {
-                float cur_val = SDL_GameControllerGetAxis(controller, axis) * (1 / 32768.0f);
-                if (negative_range) {
-                    cur_val = -cur_val;
-                }
-
-                // Check if this input is a right analog axis and suppress it accordingly.
-                if (allow_suppression && right_analog_suppressed.load() &&
-                    (axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_RIGHTX || axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_RIGHTY)) {
-                    cur_val = 0;
-                }
-                ret += std::clamp(cur_val, 0.0f, 1.0f);
-            };
-
-            std::lock_guard lock{ InputState.controllers_mutex };
-            if (InputState.single_controller) {
-                for (SDL_GameController *controller : InputState.detected_controllers) {
-                    gather_axis_state(controller);
-                }
-            }
-            else {
-                if (InputState.assigned_controllers[controller_num] != nullptr) {
-                    gather_axis_state(InputState.assigned_controllers[controller_num]);
-                }
-            }
+        // Check if this input is a right analog axis and suppress it accordingly.
+        if (allow_suppression && right_analog_suppressed.load() &&
+            (axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_RIGHTX || axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_RIGHTY)) {
+            return 0.0f;
         }
 
+        const ControllerSlotSnapshot& slot = current_input_snapshot().slots[controller_num];
+        float ret = negative_range ? slot.axis_neg[axis] : slot.axis_pos[axis];
+
         return std::clamp(ret, 0.0f, 1.0f);
     }
     return false;
@@ -1038,6 +1476,313 @@ bool recomp::get_input_digital(int controller_num, const std::span<const recomp:
     return ret;
 }
 
+// Index of a ControllerAnalog input id's axis half (axis * 2, plus one for the negative range), or -1 if it's invalid.
+static int axis_half_index(int32_t input_id) {
+    int axis = abs(input_id) - 1;
+    if (axis < 0 || axis >= SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_MAX) {
+        return -1;
+    }
+    return axis * 2 + (input_id < 0 ? 1 : 0);
+}
+
+static float axis_half_value(const ControllerSlotSnapshot& slot, int half, bool suppress_right) {
+    int axis = half / 2;
+    if (suppress_right && (axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_RIGHTX || axis == SDL_GameControllerAxis::SDL_CONTROLLER_AXIS_RIGHTY)) {
+        return 0.0f;
+    }
+    return std::clamp((half & 1) ? slot.axis_neg[axis] : slot.axis_pos[axis], 0.0f, 1.0f);
+}
+
+static void compile_button_field(CompiledN64Bindings& compiled, const recomp::InputField& field, uint16_t button_value) {
+    switch ((InputType)field.input_type) {
+    case InputType::Keyboard:
+        if (field.input_id >= 0 && field.input_id < SDL_NUM_SCANCODES) {
+            compiled.key_buttons[field.input_id] |= button_value;
+        }
+        break;
+    case InputType::ControllerDigital:
+        if (field.input_id >= 0 && field.input_id < SDL_CONTROLLER_BUTTON_MAX) {
+            compiled.controller_buttons[field.input_id] |= button_value;
+        }
+        break;
+    case InputType::ControllerAnalog:
+        if (int half = axis_half_index(field.input_id); half >= 0) {
+            compiled.axis_buttons[half] |= button_value;
+        }
+        break;
+    case InputType::Mouse:
+    case InputType::None:
+        break;
+    }
+}
+
+static void compile_stick_field(CompiledStickDirection& direction, const recomp::InputField& field) {
+    switch ((InputType)field.input_type) {
+    case InputType::Keyboard:
+        if (field.input_id >= 0 && field.input_id < SDL_NUM_SCANCODES) {
+            direction.key_mask[field.input_id / 64] |= uint64_t{1} << (field.input_id % 64);
+        }
+        break;
+    case InputType::ControllerDigital:
+        if (field.input_id >= 0 && field.input_id < SDL_CONTROLLER_BUTTON_MAX) {
+            direction.button_mask |= 1u << field.input_id;
+        }
+        break;
+    case InputType::ControllerAnalog:
+        if (int half = axis_half_index(field.input_id); half >= 0 && direction.num_axes < direction.axis_halves.size()) {
+            direction.axis_halves[direction.num_axes++] = (uint8_t)half;
+        }
+        break;
+    case InputType::Mouse:
+    case InputType::None:
+        break;
+    }
+}
+
+// Same result as get_input_analog over the direction's fields: any held key or button saturates the direction, otherwise
+// the bound axis halves are summed.
+static float compiled_stick_value(const CompiledStickDirection& direction, const InputSnapshot& snapshot,
+                                  const ControllerSlotSnapshot& slot, bool suppress_right) {
+    if (slot.buttons & direction.button_mask) {
+        return 1.0f;
+    }
+    for (size_t word = 0; word < snapshot.keys.size(); word++) {
+        if (snapshot.keys[word] & direction.key_mask[word]) {
+            return 1.0f;
+        }
+    }
+
+    float ret = 0.0f;
+    for (uint32_t i = 0; i < direction.num_axes; i++) {
+        ret += axis_half_value(slot, direction.axis_halves[i], suppress_right);
+    }
+    return std::clamp(ret, 0.0f, 1.0f);
+}
+
+#define DEFINE_INPUT(name, value, readable) uint16_t(value##u),
+static const std::array compiled_n64_button_values = {
+    DEFINE_N64_BUTTON_INPUTS()
+};
+#undef DEFINE_INPUT
+
+static CompiledN64Bindings compile_bindings(const recomp::InputFieldSpans& keyboard_fields, const recomp::InputFieldSpans& controller_fields) {
+    using recomp::GameInput;
+    CompiledN64Bindings compiled{};
+
+    for (size_t i = 0; i < compiled_n64_button_values.size(); i++) {
+        size_t input_index = (size_t)GameInput::N64_BUTTON_START + i;
+        for (const recomp::InputField& field : keyboard_fields[input_index]) {
+            compile_button_field(compiled, field, compiled_n64_button_values[i]);
+        }
+        for (const recomp::InputField& field : controller_fields[input_index]) {
+            compile_button_field(compiled, field, compiled_n64_button_values[i]);
+        }
+    }
+
+    for (size_t i = 0; i < compiled.keyboard_stick.size(); i++) {
+        size_t input_index = (size_t)GameInput::Y_AXIS_POS + i;
+        for (const recomp::InputField& field : keyboard_fields[input_index]) {
+            compile_stick_field(compiled.keyboard_stick[i], field);
+        }
+        for (const recomp::InputField& field : controller_fields[input_index]) {
+            compile_stick_field(compiled.controller_stick[i], field);
+        }
+    }
+
+    return compiled;
+}
+
+void recomp::compile_n64_bindings(int controller_num, const InputFieldSpans& keyboard_fields, const InputFieldSpans& controller_fields) {
+    compiled_n64_bindings[controller_num] = compile_bindings(keyboard_fields, controller_fields);
+}
+
+constexpr size_t stick_y_pos = (size_t)recomp::GameInput::Y_AXIS_POS - (size_t)recomp::GameInput::Y_AXIS_POS;
+constexpr size_t stick_y_neg = (size_t)recomp::GameInput::Y_AXIS_NEG - (size_t)recomp::GameInput::Y_AXIS_POS;
+constexpr size_t stick_x_neg = (size_t)recomp::GameInput::X_AXIS_NEG - (size_t)recomp::GameInput::Y_AXIS_POS;
+constexpr size_t stick_x_pos = (size_t)recomp::GameInput::X_AXIS_POS - (size_t)recomp::GameInput::Y_AXIS_POS;
+
+// Reads the N64 buttons and stick of one controller from a snapshot through compiled tables. Doesn't touch any shared
+// state, so it's also used by the benchmark on private copies.
+static void evaluate_compiled_n64_input(const CompiledN64Bindings& compiled, const InputSnapshot& snapshot, int controller_num,
+                                        bool suppress_right, uint16_t* buttons_out, float* x_out, float* y_out) {
+    const ControllerSlotSnapshot& slot = snapshot.slots[controller_num];
+    uint16_t buttons = 0;
+
+    // Only held keys and buttons are visited, so this is a few word tests when nothing is pressed.
+    for (size_t word = 0; word < snapshot.keys.size(); word++) {
+        for (uint64_t bits = snapshot.keys[word]; bits != 0; bits &= bits - 1) {
+            buttons |= compiled.key_buttons[word * 64 + std::countr_zero(bits)];
+        }
+    }
+    for (uint32_t bits = slot.buttons; bits != 0; bits &= bits - 1) {
+        buttons |= compiled.controller_buttons[std::countr_zero(bits)];
+    }
+    for (size_t half = 0; half < compiled.axis_buttons.size(); half++) {
+        // TODO adjustable threshold
+        if (compiled.axis_buttons[half] != 0 && axis_half_value(slot, (int)half, suppress_right) >= axis_threshold) {
+            buttons |= compiled.axis_buttons[half];
+        }
+    }
+
+    auto stick_value = [&](const CompiledStickDirection& direction) {
+        return compiled_stick_value(direction, snapshot, slot, suppress_right);
+    };
+
+    float joystick_x = stick_value(compiled.controller_stick[stick_x_pos]) - stick_value(compiled.controller_stick[stick_x_neg]);
+    float joystick_y = stick_value(compiled.controller_stick[stick_y_pos]) - stick_value(compiled.controller_stick[stick_y_neg]);
+    recomp::apply_joystick_deadzone(joystick_x, joystick_y, &joystick_x, &joystick_y);
+
+    *buttons_out = buttons;
+    *x_out = stick_value(compiled.keyboard_stick[stick_x_pos]) - stick_value(compiled.keyboard_stick[stick_x_neg]) + joystick_x;
+    *y_out = stick_value(compiled.keyboard_stick[stick_y_pos]) - stick_value(compiled.keyboard_stick[stick_y_neg]) + joystick_y;
+}
+
+void recomp::get_compiled_n64_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out) {
+    // Only reads the snapshot poll_inputs acquired, so every port sees the same one. Acquiring here as well would let a
+    // sample published between two port reads clear the latched presses that the remaining ports haven't seen yet.
+    evaluate_compiled_n64_input(compiled_n64_bindings[controller_num], current_input_snapshot(), controller_num,
+        right_analog_suppressed.load(), buttons_out, x_out, y_out);
+
+    record_input_latency(controller_num, *buttons_out);
+}
+
+// Value of a single InputField in a snapshot, with the same rules as get_input_analog.
+static float snapshot_field_value(const InputSnapshot& snapshot, const ControllerSlotSnapshot& slot,
+                                  const recomp::InputField& field, bool suppress_right) {
+    switch ((InputType)field.input_type) {
+    case InputType::Keyboard:
+        if (field.input_id >= 0 && field.input_id < SDL_NUM_SCANCODES) {
+            return (snapshot.keys[field.input_id / 64] >> (field.input_id % 64)) & 1 ? 1.0f : 0.0f;
+        }
+        return 0.0f;
+    case InputType::ControllerDigital:
+        if (field.input_id >= 0 && field.input_id < SDL_CONTROLLER_BUTTON_MAX) {
+            return (slot.buttons & (1u << field.input_id)) != 0 ? 1.0f : 0.0f;
+        }
+        return 0.0f;
+    case InputType::ControllerAnalog:
+        if (int half = axis_half_index(field.input_id); half >= 0) {
+            return axis_half_value(slot, half, suppress_right);
+        }
+        return 0.0f;
+    case InputType::Mouse:
+    case InputType::None:
+        return 0.0f;
+    }
+    return 0.0f;
+}
+
+// Evaluates every bound InputField individually against a snapshot, the way get_n64_input did before the bindings were
+// compiled. Only used as the reference for the benchmark.
+static void evaluate_n64_fields(const recomp::InputFieldSpans& keyboard_fields, const recomp::InputFieldSpans& controller_fields,
+                                const InputSnapshot& snapshot, int controller_num, bool suppress_right,
+                                uint16_t* buttons_out, float* x_out, float* y_out) {
+    using recomp::GameInput;
+    const ControllerSlotSnapshot& slot = snapshot.slots[controller_num];
+
+    auto digital = [&](std::span<const recomp::InputField> fields) {
+        for (const recomp::InputField& field : fields) {
+            float value = snapshot_field_value(snapshot, slot, field, suppress_right);
+            if ((InputType)field.input_type == InputType::ControllerAnalog ? value >= axis_threshold : value != 0.0f) {
+                return true;
+            }
+        }
+        return false;
+    };
+    auto analog = [&](std::span<const recomp::InputField> fields) {
+        float ret = 0.0f;
+        for (const recomp::InputField& field : fields) {
+            ret += snapshot_field_value(snapshot, slot, field, suppress_right);
+        }
+        return std::clamp(ret, 0.0f, 1.0f);
+    };
+
+    uint16_t buttons = 0;
+    for (size_t i = 0; i < compiled_n64_button_values.size(); i++) {
+        size_t input_index = (size_t)GameInput::N64_BUTTON_START + i;
+        if (digital(keyboard_fields[input_index]) || digital(controller_fields[input_index])) {
+            buttons |= compiled_n64_button_values[i];
+        }
+    }
+
+    float joystick_x = analog(controller_fields[(size_t)GameInput::X_AXIS_POS]) - analog(controller_fields[(size_t)GameInput::X_AXIS_NEG]);
+    float joystick_y = analog(controller_fields[(size_t)GameInput::Y_AXIS_POS]) - analog(controller_fields[(size_t)GameInput::Y_AXIS_NEG]);
+    recomp::apply_joystick_deadzone(joystick_x, joystick_y, &joystick_x, &joystick_y);
+
+    *buttons_out = buttons;
+    *x_out = analog(keyboard_fields[(size_t)GameInput::X_AXIS_POS]) - analog(keyboard_fields[(size_t)GameInput::X_AXIS_NEG]) + joystick_x;
+    *y_out = analog(keyboard_fields[(size_t)GameInput::Y_AXIS_POS]) - analog(keyboard_fields[(size_t)GameInput::Y_AXIS_NEG]) + joystick_y;
+}
+
+std::string recomp::benchmark_compiled_n64_input(int controller_num, const InputFieldSpans& keyboard_fields,
+                                                 const InputFieldSpans& controller_fields, int iterations) {
+    using clock = std::chrono::high_resolution_clock;
+    constexpr size_t num_snapshots = 64;
+
+    // Works on its own bindings and randomly generated snapshots, so it can run on any thread without touching the game's
+    // input state, and both paths see exactly the same input on every iteration.
+    CompiledN64Bindings compiled = compile_bindings(keyboard_fields, controller_fields);
+    bool suppress_right = right_analog_suppressed.load();
+    std::vector<InputSnapshot> snapshots(num_snapshots);
+    std::mt19937 rng{ 1234 };
+    for (InputSnapshot& snapshot : snapshots) {
+        snapshot = {};
+        for (int i = 0; i < 4; i++) {
+            uint32_t key = rng() % SDL_NUM_SCANCODES;
+            snapshot.keys[key / 64] |= uint64_t{1} << (key % 64);
+        }
+        ControllerSlotSnapshot& slot = snapshot.slots[controller_num];
+        slot.buttons = rng() & ((1u << SDL_CONTROLLER_BUTTON_MAX) - 1) & rng();
+        for (int axis = 0; axis < SDL_CONTROLLER_AXIS_MAX; axis++) {
+            float value = (rng() % 2001) / 1000.0f - 1.0f;
+            slot.axis_pos[axis] = std::max(value, 0.0f);
+            slot.axis_neg[axis] = std::max(-value, 0.0f);
+        }
+    }
+
+    uint32_t mismatches = 0;
+    uint32_t checksum = 0;
+    uint16_t fields_buttons, compiled_buttons;
+    float fields_x, fields_y, compiled_x, compiled_y;
+
+    auto fields_start = clock::now();
+    for (int i = 0; i < iterations; i++) {
+        evaluate_n64_fields(keyboard_fields, controller_fields, snapshots[i % num_snapshots], controller_num, suppress_right,
+            &fields_buttons, &fields_x, &fields_y);
+        checksum += fields_buttons;
+    }
+    auto fields_end = clock::now();
+
+    for (int i = 0; i < iterations; i++) {
+        evaluate_compiled_n64_input(compiled, snapshots[i % num_snapshots], controller_num, suppress_right,
+            &compiled_buttons, &compiled_x, &compiled_y);
+        checksum -= compiled_buttons;
+    }
+    auto compiled_end = clock::now();
+
+    for (const InputSnapshot& snapshot : snapshots) {
+        evaluate_n64_fields(keyboard_fields, controller_fields, snapshot, controller_num, suppress_right,
+            &fields_buttons, &fields_x, &fields_y);
+        evaluate_compiled_n64_input(compiled, snapshot, controller_num, suppress_right,
+            &compiled_buttons, &compiled_x, &compiled_y);
+        if (fields_buttons != compiled_buttons || fields_x != compiled_x || fields_y != compiled_y) {
+            mismatches++;
+        }
+    }
+    bool results_match = mismatches == 0 && checksum == 0;
+
+    double fields_ns = std::chrono::duration<double, std::nano>(fields_end - fields_start).count() / iterations;
+    double compiled_ns = std::chrono::duration<double, std::nano>(compiled_end - fields_end).count() / iterations;
+
+    char summary[256];
+    snprintf(summary, sizeof(summary), "Per-field: %.1f ns, compiled: %.1f ns (%.1fx)%s",
+        fields_ns, compiled_ns, compiled_ns > 0.0 ? fields_ns / compiled_ns : 0.0,
+        results_match ? "" : ", RESULTS DIFFER");
+    printf("N64 input benchmark for player %d over %d iterations: %s\n", controller_num + 1, iterations, summary);
+
+    return summary;
+}
+
 void recomp::get_gyro_deltas(float* x, float* y) {
     std::array<float, 2> cur_rotation_delta = InputState.rotation_delta;
     float sensitivity = (float)recomp::get_gyro_sensitivity() / 100.0f;
@@ -1117,6 +1862,7 @@ bool recomp::get_single_controller_mode() {
 
 void recomp::set_single_controller_mode(bool single_controller) {
     InputState.single_controller = single_controller;
+    InputState.assignments_dirty.store(true);
 }
 
 std::string controller_button_to_string(SDL_GameControllerButton button) {
@@ -1286,32 +2032,26 @@ std::string recomp::InputField::to_string() const {
 }
 
 void recomp::refresh_controller_options() {
-    // TODO: Is it okay to use this to make sure the detected controllers are up to date here?
-    recomp::poll_inputs();
-
     std::lock_guard lock{ InputState.controllers_mutex };
+    if (InputState.assignments_dirty.load()) {
+        rebuild_controller_assignments_locked();
+    }
+
     InputState.detected_controller_options.clear();
-    for (SDL_GameController* controller : InputState.detected_controllers) {
-        SDL_Joystick* joystick = SDL_GameControllerGetJoystick(controller);
+    for (const auto& [id, state] : InputState.controller_states) {
+        (void) id; // Avoid unused variable warning.
+        if (state.controller == nullptr) {
+            continue;
+        }
+
+        SDL_Joystick* joystick = SDL_GameControllerGetJoystick(state.controller);
         if (joystick == nullptr) {
             continue;
         }
 
-        Uint16 vendor, product, version, crc16;
         const char* joystick_name = SDL_JoystickName(joystick);
-        const char* joystick_serial = SDL_JoystickGetSerial(joystick);
         std::string joystick_name_string = joystick_name != nullptr ? std::string(joystick_name) : "Unknown controller";
-        SDL_JoystickGUID joystick_guid = SDL_JoystickGetGUID(joystick);
-        int joystick_player_index = SDL_JoystickGetPlayerIndex(joystick);
-        SDL_GetJoystickGUIDInfo(joystick_guid, &vendor, &product, &version, &crc16);
-
-        ControllerGUID guid = { joystick_serial != nullptr ? std::string(joystick_serial) : std::string(),
-                                vendor,
-                                product,
-                                version,
-                                crc16,
-                                joystick_player_index };
-        InputState.detected_controller_options.emplace_back(ControllerOption{ joystick_name_string, guid });
+        InputState.detected_controller_options.emplace_back(ControllerOption{ joystick_name_string, state.guid });
     }
 }
 
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "recomp.h"
+#include "ultramodern/config.hpp"
+#include "json/json.hpp"
+
+#include "recomp_input.h"
+
+// Input-to-present latency measurement.
+//
+// While active, a thread injects a synthetic N64 button press at random intervals (so presses land at every phase of
+// the frame) and the press is timestamped at each stage of the pipeline:
+//   poll:    the first poll_inputs after the injection
+//   read:    the first controller read by the game (osContGetReadData -> get_n64_input) that returns the press
+//   handle:  the game's pad update (joyProcCore) reporting the press as newly triggered, which is when the game acts on it
+//   dl:      the first display list the game submits after handling the press, i.e. the one built by that frame
+//   present: the first screen update after that display list
+// Samples are grouped by the settings that affect latency (window mode, refresh rate, background input), and each group's distribution is printed every report_interval samples or whenever the settings change.
+
+using latency_clock = std::chrono::steady_clock;
+
+// How long each synthetic press is held, long enough for the game to see it on at least one of its reads.
+constexpr auto press_hold_time = std::chrono::milliseconds{100};
+// Presses that haven't made it to the screen by then are dropped (e.g. the game was paused or the menu was open).
+constexpr auto press_timeout = std::chrono::seconds{1};
+constexpr size_t report_interval = 100;
+// gControllerPressedButtons[0], the buttons joyProcCore reports as newly pressed on port 1 this frame.
+constexpr gpr pressed_buttons_vram = 0xFFFFFFFF800FAF88ULL;
+
+enum class LatencyStage {
+    Idle,
+    Injected,
+    Polled,
+    Read,
+    Handled,
+    Submitted,
+};
+
+struct LatencySample {
+    double poll_ms;
+    double read_ms;
+    double handle_ms;
+    double dl_ms;
+    double present_ms;
+};
+
+static struct {
+    std::mutex mutex;
+    std::thread thread;
+    std::atomic_bool active = false;
+    uint16_t button = 0;
+    LatencyStage stage = LatencyStage::Idle;
+    latency_clock::time_point inject_time;
+    LatencySample cur_sample;
+    std::string config_label;
+    std::vector<LatencySample> samples;
+} LatencyState;
+
+static std::string current_config_label() {
+    const ultramodern::renderer::GraphicsConfig& config = ultramodern::renderer::get_graphics_config();
+    nlohmann::json wm_option = config.wm_option;
+    nlohmann::json rr_option = config.rr_option;
+    nlohmann::json background_input = recomp::get_background_input_mode();
+
+    std::string label = "window mode " + wm_option.get<std::string>() + ", refresh rate " + rr_option.get<std::string>();
+    if (config.rr_option == ultramodern::renderer::RefreshRate::Manual) {
+        label += " (" + std::to_string(config.rr_manual_value) + ")";
+    }
+    label += ", background input " + background_input.get<std::string>();
+    return label;
+}
+
+static double percentile(std::vector<double>& values, double fraction) {
+    size_t index = std::min(values.size() - 1, (size_t)(values.size() * fraction));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void print_latency_report_locked() {
+    if (LatencyState.samples.empty()) {
+        return;
+    }
+
+    printf("Input latency over %zu presses with %s:\n", LatencyState.samples.size(), LatencyState.config_label.c_str());
+
+    auto print_stage = [](const char* name, double LatencySample::* member) {
+        std::vector<double> values;
+        values.reserve(LatencyState.samples.size());
+        for (const LatencySample& sample : LatencyState.samples) {
+            values.push_back(sample.*member);
+        }
+        double median = percentile(values, 0.5);
+        double p90 = percentile(values, 0.9);
+        double p99 = percentile(values, 0.99);
+        double max = *std::max_element(values.begin(), values.end());
+        printf("  %-8s median %6.2f ms, p90 %6.2f ms, p99 %6.2f ms, max %6.2f ms\n", name, median, p90, p99, max);
+    };
+
+    print_stage("poll", &LatencySample::poll_ms);
+    print_stage("read", &LatencySample::read_ms);
+    print_stage("handle", &LatencySample::handle_ms);
+    print_stage("dl", &LatencySample::dl_ms);
+    print_stage("present", &LatencySample::present_ms);
+
+    LatencyState.samples.clear();
+}
+
+static double ms_since_injection(latency_clock::time_point now) {
+    return std::chrono::duration<double, std::milli>(now - LatencyState.inject_time).count();
+}
+
+static void injector_thread_func() {
+    std::mt19937 rng{ std::random_device{}() };
+    std::uniform_int_distribution<int> delay_ms{ 250, 500 };
+
+    while (LatencyState.active.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ delay_ms(rng) });
+
+        std::lock_guard lock{ LatencyState.mutex };
+        latency_clock::time_point now = latency_clock::now();
+        if (LatencyState.stage != LatencyStage::Idle && now - LatencyState.inject_time < press_timeout) {
+            continue;
+        }
+
+        // Group samples by the settings in effect when the press is injected.
+        std::string label = current_config_label();
+        if (label != LatencyState.config_label) {
+            print_latency_report_locked();
+            LatencyState.config_label = std::move(label);
+        }
+
+        LatencyState.stage = LatencyStage::Injected;
+        LatencyState.inject_time = now;
+        LatencyState.cur_sample = {};
+    }
+}
+
+void recomp::start_input_latency_measurement(uint16_t button) {
+    if (LatencyState.active.exchange(true)) {
+        return;
+    }
+
+    LatencyState.button = button;
+    LatencyState.stage = LatencyStage::Idle;
+    LatencyState.thread = std::thread{ injector_thread_func };
+    printf("Measuring input latency with synthetic presses of N64 button 0x%04X\n", button);
+}
+
+void recomp::stop_input_latency_measurement() {
+    if (!LatencyState.active.exchange(false)) {
+        return;
+    }
+
+    LatencyState.thread.join();
+    std::lock_guard lock{ LatencyState.mutex };
+    print_latency_report_locked();
+    LatencyState.stage = LatencyStage::Idle;
+}
+
+void recomp::input_latency_on_poll() {
+    if (!LatencyState.active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard lock{ LatencyState.mutex };
+    if (LatencyState.stage == LatencyStage::Injected) {
+        LatencyState.cur_sample.poll_ms = ms_since_injection(latency_clock::now());
+        LatencyState.stage = LatencyStage::Polled;
+    }
+}
+
+void recomp::input_latency_on_read(int controller_num, uint16_t* buttons) {
+    if (controller_num != 0 || !LatencyState.active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard lock{ LatencyState.mutex };
+    if (LatencyState.stage == LatencyStage::Idle || LatencyState.stage == LatencyStage::Injected) {
+        return;
+    }
+
+    latency_clock::time_point now = latency_clock::now();
+    if (now - LatencyState.inject_time < press_hold_time) {
+        *buttons |= LatencyState.button;
+        if (LatencyState.stage == LatencyStage::Polled) {
+            LatencyState.cur_sample.read_ms = ms_since_injection(now);
+            LatencyState.stage = LatencyStage::Read;
+        }
+    }
+}
+
+// Called by a hook at the end of joyProcCore (see drmario64.us.toml), once the game has worked out which buttons were
+// newly pressed this frame.
+extern "C" void recomp_input_latency_on_pad_update(uint8_t* rdram, recomp_context* ctx) {
+    if (!LatencyState.active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard lock{ LatencyState.mutex };
+    if (LatencyState.stage == LatencyStage::Read && (MEM_HU(0, pressed_buttons_vram) & LatencyState.button) != 0) {
+        LatencyState.cur_sample.handle_ms = ms_since_injection(latency_clock::now());
+        LatencyState.stage = LatencyStage::Handled;
+    }
+}
+
+void recomp::input_latency_on_send_dl() {
+    if (!LatencyState.active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard lock{ LatencyState.mutex };
+    if (LatencyState.stage == LatencyStage::Handled) {
+        LatencyState.cur_sample.dl_ms = ms_since_injection(latency_clock::now());
+        LatencyState.stage = LatencyStage::Submitted;
+    }
+}
+
+void recomp::input_latency_on_present() {
+    if (!LatencyState.active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard lock{ LatencyState.mutex };
+    if (LatencyState.stage == LatencyStage::Submitted) {
+        LatencyState.cur_sample.present_ms = ms_since_injection(latency_clock::now());
+        LatencyState.samples.push_back(LatencyState.cur_sample);
+        LatencyState.stage = LatencyStage::Idle;
+
+        if (LatencyState.samples.size() >= report_interval) {
+            print_latency_report_locked();
+        }
+    }
+}
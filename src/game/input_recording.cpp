@@ -0,0 +1,342 @@
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "recomp_input.h"
+
+// Recording and replay of the N64 controller data that the game reads.
+//
+// Every poll samples all four ports once, either from live input or from the replay log, and get_input and
+// get_connected_device_info return that sample until the next poll. Polls are issued by the game's controller reads, so
+// the sequence of samples lines up with the game's own frames and a replay feeds it exactly the values it saw while
+// recording, independent of the machine, frame rate or input devices it's replayed on.
+//
+// Log format (little-endian):
+//   header: char[8] "DM64INP", u32 version, u32 reserved
+//   record: u32 repeat count, u8 present port mask, u8 rumble pak port mask,
+//           then for each present port: u16 buttons, f32 stick x, f32 stick y
+// A record covers `repeat count` consecutive polls with identical data, so idle stretches take a few bytes.
+//
+// During netplay, the inputs exchanged with the other players stand in for live input, so recordings of a netplay
+// session replay the whole match.
+
+constexpr char input_log_magic[8] = "DM64INP";
+constexpr uint32_t input_log_version = 1;
+// Flush the log every this many records so a crash loses at most a few seconds of input.
+constexpr uint32_t input_log_flush_interval = 64;
+
+struct RecordedPort {
+    uint16_t buttons;
+    float x;
+    float y;
+    bool operator==(const RecordedPort& rhs) const = default;
+};
+
+struct RecordedFrame {
+    uint8_t present;
+    uint8_t rumble_pak;
+    std::array<RecordedPort, 4> ports;
+    bool operator==(const RecordedFrame& rhs) const = default;
+};
+
+enum class InputLogMode {
+    Off,
+    Recording,
+    Replaying,
+};
+
+static struct {
+    InputLogMode mode = InputLogMode::Off;
+    std::ofstream out_file;
+    std::ifstream in_file;
+    RecordedFrame frame{};
+    // Recording: polls covered by the frame that hasn't been written yet. Replaying: polls left for the current frame.
+    uint32_t repeat = 0;
+    uint32_t records_since_flush = 0;
+    uint64_t total_polls = 0;
+} InputLog;
+
+static void write_u8(std::ofstream& file, uint8_t value) {
+    file.put((char)value);
+}
+
+static void write_u16(std::ofstream& file, uint16_t value) {
+    char bytes[2] = { (char)(value >> 0), (char)(value >> 8) };
+    file.write(bytes, sizeof(bytes));
+}
+
+static void write_u32(std::ofstream& file, uint32_t value) {
+    char bytes[4] = { (char)(value >> 0), (char)(value >> 8), (char)(value >> 16), (char)(value >> 24) };
+    file.write(bytes, sizeof(bytes));
+}
+
+static void write_f32(std::ofstream& file, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    write_u32(file, bits);
+}
+
+static bool read_u8(std::ifstream& file, uint8_t* value) {
+    char byte;
+    if (!file.get(byte)) {
+        return false;
+    }
+    *value = (uint8_t)byte;
+    return true;
+}
+
+static bool read_u16(std::ifstream& file, uint16_t* value) {
+    unsigned char bytes[2];
+    if (!file.read((char*)bytes, sizeof(bytes))) {
+        return false;
+    }
+    *value = (uint16_t)(bytes[0] | (bytes[1] << 8));
+    return true;
+}
+
+static bool read_u32(std::ifstream& file, uint32_t* value) {
+    unsigned char bytes[4];
+    if (!file.read((char*)bytes, sizeof(bytes))) {
+        return false;
+    }
+    *value = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return true;
+}
+
+static bool read_f32(std::ifstream& file, float* value) {
+    uint32_t bits;
+    if (!read_u32(file, &bits)) {
+        return false;
+    }
+    std::memcpy(value, &bits, sizeof(bits));
+    return true;
+}
+
+static void write_record() {
+    if (InputLog.repeat == 0) {
+        return;
+    }
+
+    write_u32(InputLog.out_file, InputLog.repeat);
+    write_u8(InputLog.out_file, InputLog.frame.present);
+    write_u8(InputLog.out_file, InputLog.frame.rumble_pak);
+    for (size_t i = 0; i < InputLog.frame.ports.size(); i++) {
+        if (InputLog.frame.present & (1 << i)) {
+            write_u16(InputLog.out_file, InputLog.frame.ports[i].buttons);
+            write_f32(InputLog.out_file, InputLog.frame.ports[i].x);
+            write_f32(InputLog.out_file, InputLog.frame.ports[i].y);
+        }
+    }
+
+    InputLog.repeat = 0;
+    if (++InputLog.records_since_flush >= input_log_flush_interval) {
+        InputLog.out_file.flush();
+        InputLog.records_since_flush = 0;
+    }
+}
+
+static bool read_record() {
+    RecordedFrame frame{};
+    uint32_t repeat;
+    if (!read_u32(InputLog.in_file, &repeat) || !read_u8(InputLog.in_file, &frame.present) ||
+        !read_u8(InputLog.in_file, &frame.rumble_pak)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < frame.ports.size(); i++) {
+        if (frame.present & (1 << i)) {
+            RecordedPort& port = frame.ports[i];
+            if (!read_u16(InputLog.in_file, &port.buttons) || !read_f32(InputLog.in_file, &port.x) ||
+                !read_f32(InputLog.in_file, &port.y)) {
+                return false;
+            }
+        }
+    }
+
+    if (repeat == 0) {
+        return false;
+    }
+
+    InputLog.frame = frame;
+    InputLog.repeat = repeat;
+    return true;
+}
+
+static bool get_live_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out) {
+    if (recomp::netplay_active()) {
+        return recomp::get_netplay_input(controller_num, buttons_out, x_out, y_out);
+    }
+    return recomp::get_n64_input(controller_num, buttons_out, x_out, y_out);
+}
+
+static ultramodern::input::connected_device_info_t get_live_device_info(int controller_num) {
+    if (recomp::netplay_active()) {
+        // Every instance has to see the same controllers, so no paks are reported either.
+        uint16_t buttons;
+        float x, y;
+        bool present = recomp::get_netplay_input(controller_num, &buttons, &x, &y);
+        return ultramodern::input::connected_device_info_t{
+            .connected_device = present ? ultramodern::input::Device::Controller : ultramodern::input::Device::None,
+            .connected_pak = ultramodern::input::Pak::None,
+        };
+    }
+    return recomp::get_connected_device_info(controller_num);
+}
+
+static RecordedFrame sample_live_frame() {
+    RecordedFrame frame{};
+    for (size_t i = 0; i < frame.ports.size(); i++) {
+        RecordedPort& port = frame.ports[i];
+        if (get_live_input((int)i, &port.buttons, &port.x, &port.y)) {
+            frame.present |= 1 << i;
+        }
+        else {
+            port = {};
+        }
+        if (get_live_device_info((int)i).connected_pak == ultramodern::input::Pak::RumblePak) {
+            frame.rumble_pak |= 1 << i;
+        }
+    }
+    return frame;
+}
+
+bool recomp::start_input_recording(const std::filesystem::path& path) {
+    recomp::stop_input_log();
+
+    InputLog.out_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!InputLog.out_file.good()) {
+        printf("Failed to open input recording %s\n", path.string().c_str());
+        return false;
+    }
+
+    InputLog.out_file.write(input_log_magic, sizeof(input_log_magic));
+    write_u32(InputLog.out_file, input_log_version);
+    write_u32(InputLog.out_file, 0);
+
+    InputLog.mode = InputLogMode::Recording;
+    InputLog.frame = {};
+    InputLog.repeat = 0;
+    InputLog.records_since_flush = 0;
+    InputLog.total_polls = 0;
+    printf("Recording input to %s\n", path.string().c_str());
+    return true;
+}
+
+bool recomp::start_input_replay(const std::filesystem::path& path) {
+    recomp::stop_input_log();
+
+    InputLog.in_file.open(path, std::ios::binary);
+    if (!InputLog.in_file.good()) {
+        printf("Failed to open input replay %s\n", path.string().c_str());
+        return false;
+    }
+
+    char magic[sizeof(input_log_magic)];
+    uint32_t version, reserved;
+    if (!InputLog.in_file.read(magic, sizeof(magic)) || std::memcmp(magic, input_log_magic, sizeof(magic)) != 0 ||
+        !read_u32(InputLog.in_file, &version) || version != input_log_version || !read_u32(InputLog.in_file, &reserved)) {
+        printf("%s is not a valid input recording\n", path.string().c_str());
+        InputLog.in_file.close();
+        return false;
+    }
+
+    // Load the first record right away so device queries made before the first poll see the recorded controllers.
+    if (!read_record()) {
+        printf("Input recording %s is empty\n", path.string().c_str());
+        InputLog.in_file.close();
+        return false;
+    }
+
+    InputLog.mode = InputLogMode::Replaying;
+    InputLog.total_polls = 0;
+    printf("Replaying input from %s\n", path.string().c_str());
+    return true;
+}
+
+void recomp::stop_input_log() {
+    switch (InputLog.mode) {
+    case InputLogMode::Recording:
+        write_record();
+        InputLog.out_file.close();
+        printf("Input recording finished after %" PRIu64 " polls\n", InputLog.total_polls);
+        break;
+    case InputLogMode::Replaying:
+        InputLog.in_file.close();
+        printf("Input replay finished after %" PRIu64 " polls\n", InputLog.total_polls);
+        break;
+    case InputLogMode::Off:
+        break;
+    }
+    InputLog.mode = InputLogMode::Off;
+}
+
+void recomp::poll_logged_inputs() {
+    recomp::poll_inputs();
+    recomp::netplay_on_poll();
+
+    switch (InputLog.mode) {
+    case InputLogMode::Recording:
+        {
+            RecordedFrame frame = sample_live_frame();
+            if (InputLog.repeat != 0 && frame != InputLog.frame) {
+                write_record();
+            }
+            InputLog.frame = frame;
+            InputLog.repeat++;
+            InputLog.total_polls++;
+        }
+        break;
+    case InputLogMode::Replaying:
+        // The first record is already loaded when the replay starts, so only advance after the first poll.
+        if (InputLog.total_polls != 0 && --InputLog.repeat == 0 && !read_record()) {
+            // Out of input, hand control back to live input.
+            recomp::stop_input_log();
+            break;
+        }
+        InputLog.total_polls++;
+        break;
+    case InputLogMode::Off:
+        break;
+    }
+}
+
+// Whether reads should come from InputLog.frame. While recording, reads before the first poll (e.g. the controller
+// query at boot) go to live input since nothing has been sampled yet.
+static bool logged_frame_available() {
+    switch (InputLog.mode) {
+    case InputLogMode::Recording:
+        return InputLog.total_polls != 0;
+    case InputLogMode::Replaying:
+        return true;
+    case InputLogMode::Off:
+        return false;
+    }
+    return false;
+}
+
+bool recomp::get_logged_n64_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out) {
+    if (!logged_frame_available() || controller_num < 0 || controller_num >= (int)InputLog.frame.ports.size()) {
+        return get_live_input(controller_num, buttons_out, x_out, y_out);
+    }
+
+    const RecordedPort& port = InputLog.frame.ports[controller_num];
+    *buttons_out = port.buttons;
+    *x_out = port.x;
+    *y_out = port.y;
+    return (InputLog.frame.present & (1 << controller_num)) != 0;
+}
+
+ultramodern::input::connected_device_info_t recomp::get_logged_device_info(int controller_num) {
+    if (!logged_frame_available() || controller_num < 0 || controller_num >= (int)InputLog.frame.ports.size()) {
+        return get_live_device_info(controller_num);
+    }
+
+    bool present = (InputLog.frame.present & (1 << controller_num)) != 0;
+    bool rumble_pak = (InputLog.frame.rumble_pak & (1 << controller_num)) != 0;
+    return ultramodern::input::connected_device_info_t{
+        .connected_device = present ? ultramodern::input::Device::Controller : ultramodern::input::Device::None,
+        .connected_pak = (present && rumble_pak) ? ultramodern::input::Pak::RumblePak : ultramodern::input::Pak::None,
+    };
+}
@@ -0,0 +1,700 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using socket_t = SOCKET;
+constexpr socket_t invalid_socket = INVALID_SOCKET;
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using socket_t = int;
+constexpr socket_t invalid_socket = -1;
+#endif
+
+#include "recomp.h"
+#include "recomp_input.h"
+#include "zelda_game.h"
+
+// Netplay.
+//
+// Every instance runs the whole game and only N64 controller data is exchanged. Each game poll is one netplay frame.
+// The local controller's input for frame F is sampled at frame F - input_delay and sent to the other players right
+// away, and the poll for frame F waits until every player's input for it has arrived, so all instances feed the game
+// the same inputs on the same polls. With an input delay larger than the one-way latency the wait is normally zero.
+//
+// Packets are sent to a single address, either the other player directly or a relay that forwards them to everyone
+// else (see src/tools/netplay_relay.cpp). Each send carries every input the sender hasn't seen acknowledged yet, split
+// over several packets if needed, so lost or reordered packets are covered by the next send without separate
+// retransmission.
+//
+// Before the game starts, start_netplay waits for every player to say hello. Hellos carry the ROM hash and the netplay
+// settings, which must match, and player 1's hello carries its save, which every other player plays with instead of
+// their own so that all instances start from the same state.
+//
+// Every checksum_interval frames, each instance hashes the game's gameplay state right after the game has handled that
+// frame's input and sends the hash along with its inputs. A hash that differs from another player's for the same frame
+// means the games have desynced, which is reported (only once per player) but doesn't end the session.
+//
+// This is lockstep rather than rollback: inputs are never predicted, so the game never has to be rewound and run again.
+// Rollback would restore a snapshot from the quicksave handshake and then run the mispredicted frames again faster than
+// VI, with their graphics and audio tasks skipped. That needs support from the runtime and the renderer.
+//
+// Packet format (little-endian), starting with u32 magic "DMNP", u8 version, u8 player, u8 input count, u8 type:
+//   inputs: u32 acks[4] (for each player, the first frame the sender hasn't received from them), u32 first frame,
+//           u32 checksum frame (no_checksum if none yet), u64 checksum, then for each input: u16 buttons, i8 stick x,
+//           i8 stick y
+//   hello:  u64 ROM hash, u32 player count, u32 input delay, u32 save size, save
+
+constexpr uint32_t netplay_magic = 0x504E4D44; // "DMNP"
+constexpr uint8_t netplay_version = 3;
+constexpr uint8_t packet_type_inputs = 0;
+constexpr uint8_t packet_type_hello = 1;
+constexpr size_t max_players = 4;
+// Inputs kept per player. Players can't drift further apart than about twice the input delay, so this is plenty.
+constexpr uint32_t input_window = 256;
+constexpr uint32_t max_input_delay = 60;
+constexpr uint32_t max_inputs_per_packet = 64;
+constexpr size_t input_header_size = 8 + max_players * 4 + 4 + 4 + 8;
+constexpr size_t hello_header_size = 8 + 8 + 4 + 4 + 4;
+// Dr. Mario 64 has a 4Kbit EEPROM, this leaves room for a bigger one.
+constexpr size_t max_save_size = 1024;
+constexpr size_t max_packet_size = std::max(input_header_size + max_inputs_per_packet * 4, hello_header_size + max_save_size);
+constexpr auto resend_interval = std::chrono::milliseconds{5};
+constexpr auto hello_interval = std::chrono::milliseconds{100};
+constexpr auto connect_timeout = std::chrono::seconds{60};
+constexpr auto disconnect_timeout = std::chrono::seconds{10};
+constexpr uint32_t stats_interval_frames = 60 * 60;
+
+// The checksum covers the game's settings (the evs_* variables) and game_state_data, which holds each player's in-game
+// state. The rest of the main segment's BSS is left out because it holds thread stacks, display lists and audio
+// buffers, which differ between instances that are in sync. Checksums are kept for the last few intervals to compare
+// against players that are behind.
+constexpr uint32_t checksum_interval = 120;
+constexpr uint32_t checksum_history = 8;
+constexpr uint32_t no_checksum = 0xFFFFFFFF;
+
+struct ChecksumRange {
+    gpr vram;
+    size_t size;
+};
+
+constexpr ChecksumRange checksum_ranges[] = {
+    { 0xFFFFFFFF80088400ULL, 0x1C },  // evs_stereo to evs_vs_count
+    { 0xFFFFFFFF800EF560ULL, 0x750 }, // evs_mem_data
+    { 0xFFFFFFFF800EFCD0ULL, 0x10 },  // evs_gamesel
+    { 0xFFFFFFFF800F1CE0ULL, 0x8 },   // evs_playmax
+    { 0xFFFFFFFF800F1E00ULL, 0x20 },  // evs_default_name
+    { 0xFFFFFFFF800F7470ULL, 0x18 },  // evs_cfg_4p
+    { 0xFFFFFFFF800FAE78ULL, 0x8 },   // evs_select_name_no
+    { 0xFFFFFFFF800FB3A4ULL, 0x4 },   // evs_game_time
+    { 0xFFFFFFFF801236F0ULL, 0xF20 }, // evs_gamemode and game_state_data, up to the end of the BSS
+};
+
+using netplay_clock = std::chrono::steady_clock;
+
+struct NetInput {
+    uint16_t buttons;
+    int8_t x;
+    int8_t y;
+};
+
+struct NetChecksum {
+    uint32_t frame = no_checksum;
+    uint64_t hash = 0;
+};
+
+static struct {
+    std::atomic_bool active = false;
+    socket_t sock = invalid_socket;
+    sockaddr_storage remote{};
+    socklen_t remote_len = 0;
+    uint32_t local_player = 0;
+    uint32_t num_players = 0;
+    uint32_t input_delay = 0;
+    // The frame the next poll consumes.
+    uint32_t frame = 0;
+    std::array<std::array<NetInput, input_window>, max_players> inputs{};
+    // Every input of a player before this frame has been received (or sampled, for the local player).
+    std::array<uint32_t, max_players> received{};
+    // The first frame of local input that each other player hasn't received yet, as reported by their packets.
+    std::array<uint32_t, max_players> peer_acks{};
+    // The inputs returned to the game until the next poll.
+    std::array<NetInput, max_players> current{};
+    netplay_clock::time_point last_send;
+    netplay_clock::time_point last_receive;
+    bool connected = false;
+
+    // Handshake state. initial_save is player 1's save, which is sent in its hellos.
+    std::array<bool, max_players> hello_received{};
+    bool hello_requested = false;
+    bool settings_mismatch = false;
+    bool save_received = false;
+    std::vector<uint8_t> initial_save;
+
+    // Checksums are computed by the pad update hook and exchanged by the polls. Both normally run on the same game
+    // thread, but the lock keeps this safe if they don't.
+    std::mutex checksum_mutex;
+    std::array<NetChecksum, checksum_history> local_checksums{};
+    NetChecksum latest_checksum{};
+    // The latest checksum from each player, until the local one for its frame has been computed.
+    std::array<NetChecksum, max_players> peer_checksums{};
+    std::array<uint32_t, max_players> checked_frame{};
+    std::array<bool, max_players> desync_reported{};
+
+    std::atomic_uint64_t packets_sent = 0;
+    std::atomic_uint64_t packets_received = 0;
+    std::atomic_uint64_t stalls = 0;
+    std::atomic<double> stall_ms_total = 0.0;
+    std::atomic<double> stall_ms_max = 0.0;
+    std::atomic_uint64_t checksums_compared = 0;
+    std::atomic_uint64_t desyncs = 0;
+} Netplay;
+
+static void close_socket(socket_t sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+}
+
+static uint32_t get_u32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+static int8_t quantize_axis(float value) {
+    return static_cast<int8_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 127.0f));
+}
+
+static void put_u64(uint8_t* out, uint64_t value) {
+    put_u32(out, static_cast<uint32_t>(value));
+    put_u32(out + 4, static_cast<uint32_t>(value >> 32));
+}
+
+static uint64_t get_u64(const uint8_t* in) {
+    return get_u32(in) | (static_cast<uint64_t>(get_u32(in + 4)) << 32);
+}
+
+static void put_packet_header(uint8_t* packet, uint8_t count, uint8_t type) {
+    put_u32(packet, netplay_magic);
+    packet[4] = netplay_version;
+    packet[5] = static_cast<uint8_t>(Netplay.local_player);
+    packet[6] = count;
+    packet[7] = type;
+}
+
+static void send_packet(const uint8_t* packet, size_t size) {
+    sendto(Netplay.sock, reinterpret_cast<const char*>(packet), static_cast<int>(size), 0,
+        reinterpret_cast<const sockaddr*>(&Netplay.remote), Netplay.remote_len);
+    Netplay.packets_sent++;
+}
+
+static void send_input_packet(uint32_t first, uint32_t count, const NetChecksum& checksum) {
+    uint32_t local = Netplay.local_player;
+    uint8_t packet[max_packet_size];
+    put_packet_header(packet, static_cast<uint8_t>(count), packet_type_inputs);
+    for (size_t player = 0; player < max_players; player++) {
+        put_u32(packet + 8 + player * 4, Netplay.received[player]);
+    }
+    put_u32(packet + 8 + max_players * 4, first);
+    put_u32(packet + 12 + max_players * 4, checksum.frame);
+    put_u64(packet + 16 + max_players * 4, checksum.hash);
+
+    uint8_t* cur = packet + input_header_size;
+    for (uint32_t frame = first; frame < first + count; frame++) {
+        const NetInput& input = Netplay.inputs[local][frame % input_window];
+        cur[0] = static_cast<uint8_t>(input.buttons);
+        cur[1] = static_cast<uint8_t>(input.buttons >> 8);
+        cur[2] = static_cast<uint8_t>(input.x);
+        cur[3] = static_cast<uint8_t>(input.y);
+        cur += 4;
+    }
+    send_packet(packet, cur - packet);
+}
+
+// Sends every local input that some player hasn't acknowledged, starting from the oldest, in as many packets as it
+// takes. Inputs older than the window can't be needed, since nobody can be that far behind.
+static void send_inputs() {
+    uint32_t local = Netplay.local_player;
+    uint32_t end = Netplay.received[local];
+    uint32_t first = end;
+    for (uint32_t player = 0; player < Netplay.num_players; player++) {
+        if (player != local) {
+            first = std::min(first, Netplay.peer_acks[player]);
+        }
+    }
+    first = std::max(first, end - std::min(end, input_window));
+
+    NetChecksum checksum;
+    {
+        std::lock_guard lock{ Netplay.checksum_mutex };
+        checksum = Netplay.latest_checksum;
+    }
+
+    do {
+        uint32_t count = std::min(end - first, max_inputs_per_packet);
+        send_input_packet(first, count, checksum);
+        first += count;
+    } while (first < end);
+    Netplay.last_send = netplay_clock::now();
+}
+
+static void send_hello() {
+    uint8_t packet[max_packet_size];
+    put_packet_header(packet, 0, packet_type_hello);
+    put_u64(packet + 8, zelda64::rom_hash);
+    put_u32(packet + 16, Netplay.num_players);
+    put_u32(packet + 20, Netplay.input_delay);
+    size_t save_size = Netplay.local_player == 0 ? Netplay.initial_save.size() : 0;
+    put_u32(packet + 24, static_cast<uint32_t>(save_size));
+    std::memcpy(packet + hello_header_size, Netplay.initial_save.data(), save_size);
+    send_packet(packet, hello_header_size + save_size);
+    Netplay.hello_requested = false;
+}
+
+// Compares a player's checksum against the local one for the same frame. Called with checksum_mutex held.
+static void compare_checksum_locked(uint32_t player, const NetChecksum& peer, const NetChecksum& local) {
+    if (peer.frame != local.frame || peer.frame == Netplay.checked_frame[player]) {
+        return;
+    }
+    Netplay.checked_frame[player] = peer.frame;
+    Netplay.checksums_compared++;
+    if (peer.hash != local.hash) {
+        Netplay.desyncs++;
+        if (!Netplay.desync_reported[player]) {
+            Netplay.desync_reported[player] = true;
+            printf("Netplay: game state differs from player %u at frame %u, the games have desynced\n", player + 1, peer.frame);
+        }
+    }
+}
+
+static void handle_peer_checksum(uint32_t player, const NetChecksum& peer) {
+    if (peer.frame == no_checksum) {
+        return;
+    }
+    std::lock_guard lock{ Netplay.checksum_mutex };
+    const NetChecksum& local = Netplay.local_checksums[(peer.frame / checksum_interval) % checksum_history];
+    if (local.frame == peer.frame) {
+        compare_checksum_locked(player, peer, local);
+    }
+    else {
+        // Not computed here yet, the pad update hook compares it once it is.
+        Netplay.peer_checksums[player] = peer;
+    }
+}
+
+// Called for hellos of at least hello_header_size bytes.
+static void handle_hello(uint32_t player, const uint8_t* packet, size_t size) {
+    uint32_t save_size = get_u32(packet + 24);
+    if (save_size > max_save_size || size < hello_header_size + save_size) {
+        return;
+    }
+
+    if (get_u64(packet + 8) != zelda64::rom_hash || get_u32(packet + 16) != Netplay.num_players ||
+        get_u32(packet + 20) != Netplay.input_delay)
+    {
+        if (!Netplay.settings_mismatch) {
+            printf("Netplay: player %u is using a different ROM, player count or input delay\n", player + 1);
+        }
+        Netplay.settings_mismatch = true;
+        return;
+    }
+
+    Netplay.hello_received[player] = true;
+    if (player == 0 && !Netplay.save_received) {
+        Netplay.initial_save.assign(packet + hello_header_size, packet + hello_header_size + save_size);
+        Netplay.save_received = true;
+    }
+    // The player may not have heard from this one yet, so answer on the next poll once the handshake is over.
+    Netplay.hello_requested = true;
+}
+
+static void handle_packet(const uint8_t* packet, size_t size) {
+    if (size < 8 || get_u32(packet) != netplay_magic || packet[4] != netplay_version) {
+        return;
+    }
+    uint32_t player = packet[5];
+    uint32_t count = packet[6];
+    if (player >= Netplay.num_players || player == Netplay.local_player) {
+        return;
+    }
+
+    if (packet[7] == packet_type_hello) {
+        if (size >= hello_header_size) {
+            Netplay.packets_received++;
+            Netplay.last_receive = netplay_clock::now();
+            handle_hello(player, packet, size);
+        }
+        return;
+    }
+    if (packet[7] != packet_type_inputs || size < input_header_size + count * 4) {
+        return;
+    }
+
+    Netplay.packets_received++;
+    Netplay.last_receive = netplay_clock::now();
+    uint32_t ack = get_u32(packet + 8 + Netplay.local_player * 4);
+    Netplay.peer_acks[player] = std::max(Netplay.peer_acks[player], ack);
+    handle_peer_checksum(player, NetChecksum{ get_u32(packet + 12 + max_players * 4), get_u64(packet + 16 + max_players * 4) });
+
+    // Only take inputs that extend the received range, anything past a gap is resent by a later packet.
+    uint32_t first = get_u32(packet + 8 + max_players * 4);
+    const uint8_t* cur = packet + input_header_size;
+    for (uint32_t frame = first; frame < first + count; frame++, cur += 4) {
+        if (frame != Netplay.received[player] || frame >= Netplay.frame + input_window) {
+            continue;
+        }
+        Netplay.inputs[player][frame % input_window] = NetInput{
+            .buttons = static_cast<uint16_t>(cur[0] | (cur[1] << 8)),
+            .x = static_cast<int8_t>(cur[2]),
+            .y = static_cast<int8_t>(cur[3]),
+        };
+        Netplay.received[player]++;
+    }
+}
+
+// Waits up to timeout_ms for packets and handles every one that's available.
+static void receive_packets(int timeout_ms) {
+#ifdef _WIN32
+    WSAPOLLFD fd{ Netplay.sock, POLLRDNORM, 0 };
+    if (WSAPoll(&fd, 1, timeout_ms) <= 0) {
+        return;
+    }
+#else
+    pollfd fd{ Netplay.sock, POLLIN, 0 };
+    if (poll(&fd, 1, timeout_ms) <= 0) {
+        return;
+    }
+#endif
+
+    uint8_t packet[max_packet_size];
+    while (true) {
+        int size = recv(Netplay.sock, reinterpret_cast<char*>(packet), sizeof(packet), 0);
+        if (size <= 0) {
+            break;
+        }
+        handle_packet(packet, static_cast<size_t>(size));
+    }
+}
+
+static bool all_inputs_received(uint32_t frame) {
+    for (uint32_t player = 0; player < Netplay.num_players; player++) {
+        if (Netplay.received[player] <= frame) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_netplay_stats() {
+    printf("Netplay: %s\n", recomp::get_netplay_stats().c_str());
+}
+
+static bool handshake_done() {
+    for (uint32_t player = 0; player < Netplay.num_players; player++) {
+        if (player != Netplay.local_player && !Netplay.hello_received[player]) {
+            return false;
+        }
+    }
+    return Netplay.local_player == 0 || Netplay.save_received;
+}
+
+// Waits for every player's hello, up to connect_timeout.
+static bool wait_for_players() {
+    printf("Netplay: waiting up to %lld s for the other players\n",
+        static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(connect_timeout).count()));
+    auto start = netplay_clock::now();
+    auto last_hello = start - hello_interval;
+    while (!handshake_done()) {
+        if (Netplay.settings_mismatch) {
+            // Let the other player know as well, rather than leaving it to time out.
+            send_hello();
+            return false;
+        }
+        auto now = netplay_clock::now();
+        if (now - start >= connect_timeout) {
+            printf("Netplay: timed out waiting for the other players\n");
+            return false;
+        }
+        if (now - last_hello >= hello_interval) {
+            send_hello();
+            last_hello = now;
+        }
+        receive_packets(10);
+    }
+
+    // Make sure everyone has heard from this player before it stops sending hellos. Later hellos are still answered.
+    send_hello();
+    Netplay.connected = true;
+    Netplay.last_receive = netplay_clock::now();
+    return true;
+}
+
+bool recomp::start_netplay(uint32_t local_player, uint32_t num_players, const std::string& remote_address,
+    uint16_t local_port, uint32_t input_delay, std::vector<uint8_t>& save)
+{
+    recomp::stop_netplay();
+
+    if (num_players < 2 || num_players > max_players || local_player >= num_players || input_delay > max_input_delay) {
+        printf("Invalid netplay settings\n");
+        return false;
+    }
+    if (local_player == 0 && save.size() > max_save_size) {
+        printf("Netplay save is too large to send\n");
+        return false;
+    }
+
+#ifdef _WIN32
+    static bool wsa_started = false;
+    if (!wsa_started) {
+        WSADATA wsa_data;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+            printf("Failed to initialize Winsock\n");
+            return false;
+        }
+        wsa_started = true;
+    }
+#endif
+
+    // Address is host:port.
+    size_t colon = remote_address.rfind(':');
+    if (colon == std::string::npos) {
+        printf("Netplay address %s is missing a port\n", remote_address.c_str());
+        return false;
+    }
+    std::string host = remote_address.substr(0, colon);
+    std::string port = remote_address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || result == nullptr) {
+        printf("Failed to resolve netplay address %s\n", remote_address.c_str());
+        return false;
+    }
+    std::memcpy(&Netplay.remote, result->ai_addr, result->ai_addrlen);
+    Netplay.remote_len = static_cast<socklen_t>(result->ai_addrlen);
+    freeaddrinfo(result);
+
+    socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == invalid_socket) {
+        printf("Failed to create netplay socket\n");
+        return false;
+    }
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(local_port);
+    if (bind(sock, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0) {
+        printf("Failed to bind netplay socket to port %u\n", local_port);
+        close_socket(sock);
+        return false;
+    }
+#ifdef _WIN32
+    u_long non_blocking = 1;
+    ioctlsocket(sock, FIONBIO, &non_blocking);
+#else
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    Netplay.sock = sock;
+    Netplay.local_player = local_player;
+    Netplay.num_players = num_players;
+    Netplay.input_delay = input_delay;
+    Netplay.frame = 0;
+    // The first input_delay frames are neutral for everyone, since no input can have been sent for them.
+    for (size_t player = 0; player < max_players; player++) {
+        Netplay.inputs[player].fill(NetInput{});
+        Netplay.received[player] = input_delay;
+        Netplay.peer_acks[player] = input_delay;
+    }
+    Netplay.current.fill(NetInput{});
+    Netplay.last_receive = netplay_clock::now();
+    Netplay.connected = false;
+    Netplay.hello_received.fill(false);
+    Netplay.hello_requested = false;
+    Netplay.settings_mismatch = false;
+    Netplay.save_received = false;
+    Netplay.initial_save = local_player == 0 ? save : std::vector<uint8_t>{};
+    {
+        std::lock_guard lock{ Netplay.checksum_mutex };
+        Netplay.local_checksums.fill(NetChecksum{});
+        Netplay.latest_checksum = NetChecksum{};
+        Netplay.peer_checksums.fill(NetChecksum{});
+        Netplay.checked_frame.fill(no_checksum);
+        Netplay.desync_reported.fill(false);
+    }
+    Netplay.packets_sent = 0;
+    Netplay.packets_received = 0;
+    Netplay.stalls = 0;
+    Netplay.stall_ms_total = 0.0;
+    Netplay.stall_ms_max = 0.0;
+    Netplay.checksums_compared = 0;
+    Netplay.desyncs = 0;
+
+    if (!wait_for_players()) {
+        close_socket(sock);
+        Netplay.sock = invalid_socket;
+        printf("Netplay not started\n");
+        return false;
+    }
+    if (local_player != 0) {
+        save = Netplay.initial_save;
+    }
+    Netplay.active = true;
+
+    printf("Netplay started as player %u of %u via %s, input delay %u frames\n", local_player + 1, num_players,
+        remote_address.c_str(), input_delay);
+    return true;
+}
+
+void recomp::stop_netplay() {
+    if (!Netplay.active.exchange(false)) {
+        return;
+    }
+
+    print_netplay_stats();
+    close_socket(Netplay.sock);
+    Netplay.sock = invalid_socket;
+}
+
+bool recomp::netplay_active() {
+    return Netplay.active.load();
+}
+
+void recomp::netplay_on_poll() {
+    if (!Netplay.active.load()) {
+        return;
+    }
+
+    // Sample the local controller for input_delay frames from now and send it straight away.
+    NetInput local{};
+    float x = 0.0f;
+    float y = 0.0f;
+    if (recomp::get_n64_input(0, &local.buttons, &x, &y)) {
+        local.x = quantize_axis(x);
+        local.y = quantize_axis(y);
+    }
+    uint32_t local_player = Netplay.local_player;
+    Netplay.inputs[local_player][Netplay.received[local_player] % input_window] = local;
+    Netplay.received[local_player]++;
+    send_inputs();
+    if (Netplay.hello_requested) {
+        send_hello();
+    }
+
+    receive_packets(0);
+    if (!all_inputs_received(Netplay.frame)) {
+        auto wait_start = netplay_clock::now();
+        while (!all_inputs_received(Netplay.frame)) {
+            receive_packets(1);
+            auto now = netplay_clock::now();
+            if (now - Netplay.last_send >= resend_interval) {
+                send_inputs();
+            }
+            if (Netplay.hello_requested) {
+                send_hello();
+            }
+            // Every player has been heard from during the handshake, so this only waits on players that stop sending.
+            if (now - Netplay.last_receive >= disconnect_timeout) {
+                printf("Netplay connection timed out at frame %u\n", Netplay.frame);
+                recomp::stop_netplay();
+                return;
+            }
+        }
+        double stall_ms = std::chrono::duration<double, std::milli>(netplay_clock::now() - wait_start).count();
+        Netplay.stalls++;
+        Netplay.stall_ms_total = Netplay.stall_ms_total + stall_ms;
+        Netplay.stall_ms_max = std::max(Netplay.stall_ms_max.load(), stall_ms);
+    }
+
+    for (uint32_t player = 0; player < Netplay.num_players; player++) {
+        Netplay.current[player] = Netplay.inputs[player][Netplay.frame % input_window];
+    }
+    Netplay.frame++;
+
+    if (Netplay.frame % stats_interval_frames == 0) {
+        print_netplay_stats();
+    }
+}
+
+bool recomp::get_netplay_input(int controller_num, uint16_t* buttons_out, float* x_out, float* y_out) {
+    if (controller_num < 0 || static_cast<uint32_t>(controller_num) >= Netplay.num_players) {
+        *buttons_out = 0;
+        *x_out = 0.0f;
+        *y_out = 0.0f;
+        return false;
+    }
+
+    const NetInput& input = Netplay.current[controller_num];
+    *buttons_out = input.buttons;
+    *x_out = input.x / 127.0f;
+    *y_out = input.y / 127.0f;
+    return true;
+}
+
+std::string recomp::get_netplay_stats() {
+    uint64_t stalls = Netplay.stalls.load();
+    char buf[256];
+    snprintf(buf, sizeof(buf), "frame %u, %llu packets sent, %llu received, %llu stalls (%.1f ms avg, %.1f ms max), "
+        "%llu checksums compared, %llu mismatched",
+        Netplay.frame, static_cast<unsigned long long>(Netplay.packets_sent.load()),
+        static_cast<unsigned long long>(Netplay.packets_received.load()), static_cast<unsigned long long>(stalls),
+        stalls == 0 ? 0.0 : Netplay.stall_ms_total.load() / stalls, Netplay.stall_ms_max.load(),
+        static_cast<unsigned long long>(Netplay.checksums_compared.load()),
+        static_cast<unsigned long long>(Netplay.desyncs.load()));
+    return buf;
+}
+
+// Called from the end of joyProcCore, once the game has handled the input of the frame the last poll returned.
+extern "C" void recomp_netplay_on_pad_update(uint8_t* rdram, recomp_context* ctx) {
+    if (!Netplay.active.load(std::memory_order_relaxed)) {
+        return;
+    }
+    uint32_t frame = Netplay.frame - 1;
+    if (Netplay.frame == 0 || frame % checksum_interval != 0) {
+        return;
+    }
+
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (const ChecksumRange& range : checksum_ranges) {
+        const uint8_t* data = rdram + (range.vram - 0xFFFFFFFF80000000ULL);
+        for (size_t i = 0; i < range.size; i += sizeof(uint32_t)) {
+            uint32_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            hash = (hash ^ word) * 0x100000001B3ULL;
+        }
+    }
+
+    std::lock_guard lock{ Netplay.checksum_mutex };
+    NetChecksum checksum{ frame, hash };
+    Netplay.local_checksums[(frame / checksum_interval) % checksum_history] = checksum;
+    Netplay.latest_checksum = checksum;
+    for (uint32_t player = 0; player < Netplay.num_players; player++) {
+        if (player != Netplay.local_player) {
+            compare_checksum_locked(player, Netplay.peer_checksums[player], checksum);
+        }
+    }
+}
@@ -1,37 +1,115 @@
-// Quicksaving is disabled for now
-
-#if 0
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "librecomp/helpers.hpp"
 #include "librecomp/input.hpp"
 #include "ultramodern/ultramodern.hpp"
 
+#include "dirty_page_tracker.h"
+#include "recomp_data.h"
+#include "rewind.h"
+#include "save_states.h"
+#include "zelda_game.h"
+
+// Quicksaving.
+//
+// Quicksave actions happen at checkpoints, hooked into drmario64.us.toml at points of the game's thread loops that are
+// always reached through the same calls: the main thread's pad update (joyProcCore) drives the action through
+// recomp_handle_quicksave_actions_main, and the graphics thread (gfxproc_onRetrace) and the idle thread check in through
+// recomp_handle_quicksave_actions. Once every checkpoint thread has checked in, the main thread saves or restores RDRAM,
+// the data API containers and the registers of each checkpoint thread, then lets the others continue. The remaining
+// threads (the scheduler, audio and background task threads) are left blocked on their message queues, whose state is
+// part of RDRAM.
+//
+// A checkpoint thread that doesn't check in within checkpoint_timeout cancels the action rather than hang the game, and
+// so does restoring registers that were saved with a different stack pointer or return address than the thread has now,
+// since the thread would then return into calls it isn't in.
+//
+// RDRAM is kept in a PageSnapshot, so after the first quicksave later saves only copy the pages that were written since
+// the previous save, and loads only copy back the pages that were written since the save.
+//
+// Save states use the same handshake, but copy the state into a SaveStateImage that's written to disk in the background,
+// and load RDRAM straight from the file. See save_states.h. Rewind captures and steps also go through it, see rewind.cpp.
+//
+// The handshake's message queues and timer live in the RDRAM gap right below the patches (see patches/patches.ld), so
+// they're never part of what's saved and restored.
+
 enum class QuicksaveAction {
     None,
+    // Claimed by a request that's still filling in its pending data. The threads treat it the same as None.
+    Preparing,
     Save,
-    Load
+    Load,
+    SaveFile,
+    LoadFile,
+    RewindCapture,
+    RewindStep
 };
 
 std::atomic<QuicksaveAction> cur_quicksave_action = QuicksaveAction::None;
 
+// Quicksaves are dropped while another action is pending, rather than replacing it: a rewind step that got replaced
+// would never reach rewind_step, and the rewind buffer would wait on it forever.
 void zelda64::quicksave_save() {
-    cur_quicksave_action.store(QuicksaveAction::Save);
+    QuicksaveAction expected = QuicksaveAction::None;
+    cur_quicksave_action.compare_exchange_strong(expected, QuicksaveAction::Save);
 }
 
 void zelda64::quicksave_load() {
-    cur_quicksave_action.store(QuicksaveAction::Load);
+    QuicksaveAction expected = QuicksaveAction::None;
+    cur_quicksave_action.compare_exchange_strong(expected, QuicksaveAction::Load);
 }
 
-uint8_t saved_rdram[ultramodern::rdram_size];
+using ContextMap = std::unordered_map<int32_t, recomp_context>;
+
+// Claims the action slot for a request that has pending data to fill in, which must be followed by post_action. Fails
+// if another action is pending, since the threads may already be saving or loading contexts for it. Data is only filled
+// in after claiming the slot, so it's never replaced while the handshake is using it.
+static bool claim_action() {
+    QuicksaveAction expected = QuicksaveAction::None;
+    return cur_quicksave_action.compare_exchange_strong(expected, QuicksaveAction::Preparing);
+}
+
+static void post_action(QuicksaveAction action) {
+    cur_quicksave_action.store(action);
+}
 
-thread_local recomp_context saved_context;
+static struct {
+    std::mutex context_mutex;
+    // Registers of each permanent thread, keyed by OSThread id.
+    ContextMap saved_contexts;
+    // Registers for the save state or rewind snapshot being captured or restored.
+    ContextMap pending_contexts;
+    std::filesystem::path file_path;
+    std::unique_ptr<zelda64::SaveStateReader> file_reader;
+    PageSnapshot saved_rdram;
+    std::vector<uint8_t> saved_data;
+} Quicksave;
 
-void save_context(recomp_context* ctx) {
-    saved_context = *ctx;
+static void save_context(ContextMap& contexts, int32_t thread_id, recomp_context* ctx) {
+    std::lock_guard lock{ Quicksave.context_mutex };
+    contexts[thread_id] = *ctx;
 }
 
-void load_context(recomp_context* ctx) {
-    *ctx = saved_context;
+static void load_context(const ContextMap& contexts, int32_t thread_id, recomp_context* ctx) {
+    std::lock_guard lock{ Quicksave.context_mutex };
+    auto find_it = contexts.find(thread_id);
+    if (find_it == contexts.end()) {
+        printf("No quicksave context for thread %d\n", thread_id);
+        return;
+    }
+    *ctx = find_it->second;
 
     // Restore the pointer to the odd floats for correctly handling mips3 float mode.
     if (ctx->mips3_float_mode) {
@@ -44,78 +122,505 @@ void load_context(recomp_context* ctx) {
     }
 }
 
-extern "C" void recomp_handle_quicksave_actions(uint8_t* rdram, recomp_context* ctx) {
-    QuicksaveAction action = cur_quicksave_action.load();
+static void copy_pages(uint8_t* dst, const uint8_t* src, std::span<const uint32_t> pages, size_t page_size, size_t total_size) {
+    for (uint32_t page : pages) {
+        size_t offset = page * page_size;
+        std::memcpy(dst + offset, src + offset, std::min(page_size, total_size - offset));
+    }
+}
+
+// Only copies the state into memory, compressing and writing it happen on the save-state writer thread.
+static void save_file(uint8_t* rdram) {
+    std::unique_ptr<zelda64::SaveStateImage> image = zelda64::acquire_save_state_image();
+    image->rdram.assign(rdram, rdram + ultramodern::rdram_size);
+    image->contexts.assign(Quicksave.pending_contexts.begin(), Quicksave.pending_contexts.end());
+    recomputil::save_data_snapshot(image->data);
+
+    std::filesystem::path path;
+    {
+        std::lock_guard lock{ Quicksave.context_mutex };
+        path = Quicksave.file_path;
+    }
+    zelda64::queue_save_state_write(path, std::move(image));
+    Quicksave.pending_contexts.clear();
+}
 
-    if (action != QuicksaveAction::None) {
-        PTR(OSMesgQueue) quicksave_enter_mq = _arg<0, PTR(OSMesgQueue)>(rdram, ctx);
-        PTR(OSMesgQueue) quicksave_exit_mq = _arg<1, PTR(OSMesgQueue)>(rdram, ctx);
+// Returns false if the file's RDRAM image is corrupt, in which case nothing has been loaded.
+static bool load_file(uint8_t* rdram) {
+    bool rdram_loaded = Quicksave.file_reader->read_rdram(rdram, ultramodern::rdram_size);
+    if (rdram_loaded && !recomputil::load_data_snapshot(Quicksave.file_reader->data())) {
+        printf("Save state is corrupt, the game's state is now undefined\n");
+    }
+    Quicksave.file_reader.reset();
+    return rdram_loaded;
+}
 
-        printf("saving context for thread %d\n", TO_PTR(OSThread, ultramodern::this_thread())->id);
+bool zelda64::save_state_to_file(const std::filesystem::path& path) {
+    if (!claim_action()) {
+        return false;
+    }
 
-        // Save or load the thread's context as needed based on the action.
-        if (action == QuicksaveAction::Save) {
-            save_context(ctx);
-        }
-        else if (action == QuicksaveAction::Load) {
-            load_context(ctx);
-        }
-        else {
-            assert(false);
+    {
+        std::lock_guard lock{ Quicksave.context_mutex };
+        Quicksave.file_path = path;
+    }
+    post_action(QuicksaveAction::SaveFile);
+    return true;
+}
+
+bool zelda64::load_state_from_file(const std::filesystem::path& path) {
+    // Opening the file can take a while, so do it before claiming the slot rather than holding up other requests.
+    auto reader = std::make_unique<SaveStateReader>();
+    if (!reader->open(path)) {
+        return false;
+    }
+    if (!claim_action()) {
+        return false;
+    }
+
+    {
+        std::lock_guard lock{ Quicksave.context_mutex };
+        Quicksave.pending_contexts = ContextMap{ reader->contexts().begin(), reader->contexts().end() };
+        Quicksave.file_reader = std::move(reader);
+    }
+    post_action(QuicksaveAction::LoadFile);
+    return true;
+}
+
+bool zelda64::request_rewind_capture() {
+    QuicksaveAction expected = QuicksaveAction::None;
+    return cur_quicksave_action.compare_exchange_strong(expected, QuicksaveAction::RewindCapture);
+}
+
+bool zelda64::request_rewind_step(const ThreadContexts& contexts) {
+    if (!claim_action()) {
+        return false;
+    }
+
+    {
+        std::lock_guard lock{ Quicksave.context_mutex };
+        Quicksave.pending_contexts = ContextMap{ contexts.begin(), contexts.end() };
+    }
+    post_action(QuicksaveAction::RewindStep);
+    return true;
+}
+
+// Checkpoint threads other than the main thread: the graphics thread and the idle thread.
+constexpr size_t checkpoint_thread_count = 2;
+constexpr OSTime checkpoint_timeout = 46'875'000 / 10; // 100 ms in CPU counter ticks.
+constexpr int32_t handshake_queue_size = 8;
+
+constexpr int32_t handshake_base = (int32_t)0x80800000;
+constexpr PTR(OSMesgQueue) handshake_enter_mq = handshake_base + 0x00;
+constexpr PTR(OSMesgQueue) handshake_exit_mq = handshake_base + 0x20;
+constexpr PTR(OSMesg) handshake_enter_msgs = handshake_base + 0x40;
+constexpr PTR(OSMesg) handshake_exit_msgs = handshake_base + 0x60;
+constexpr PTR(OSMesg) handshake_received_msg = handshake_base + 0x80;
+constexpr PTR(OSTimer) handshake_timer = handshake_base + 0x90;
+static_assert(sizeof(OSMesgQueue) <= 0x20, "Quicksave message queues overlap");
+
+static struct {
+    std::once_flag init_flag;
+    std::mutex mutex;
+    // Registers of the checkpoint threads waiting for the main thread, keyed by OSThread id. They stay blocked until
+    // they're released, so the main thread saves and restores their registers in place.
+    std::unordered_map<int32_t, recomp_context*> waiting;
+    // Set once the main thread stops waiting for threads to check in, until the action is done.
+    bool closed = false;
+    // Nonzero message the timer sends for the current action, to tell it apart from a late timer of a previous one.
+    // Main thread only.
+    uint32_t round = 0;
+} Handshake;
+
+static void init_handshake(uint8_t* rdram) {
+    std::call_once(Handshake.init_flag, [rdram]() {
+        osCreateMesgQueue(rdram, handshake_enter_mq, handshake_enter_msgs, handshake_queue_size);
+        osCreateMesgQueue(rdram, handshake_exit_mq, handshake_exit_msgs, handshake_queue_size);
+    });
+}
+
+static bool is_action_posted(QuicksaveAction action) {
+    return action != QuicksaveAction::None && action != QuicksaveAction::Preparing;
+}
+
+// Whether every thread at a checkpoint can take the registers it had when the contexts were saved.
+static bool contexts_match_checkpoints(const ContextMap& contexts, int32_t main_thread_id, const recomp_context* main_ctx) {
+    auto matches = [&contexts](int32_t thread_id, const recomp_context* ctx) {
+        auto find_it = contexts.find(thread_id);
+        return find_it != contexts.end() && find_it->second.r29 == ctx->r29 && find_it->second.r31 == ctx->r31;
+    };
+    if (!matches(main_thread_id, main_ctx)) {
+        return false;
+    }
+    for (const auto& [thread_id, ctx] : Handshake.waiting) {
+        if (!matches(thread_id, ctx)) {
+            return false;
         }
-    
-        // Tell the main thread that one of the other permanent threads is ready for performing a quicksave action.
-        osSendMesg(rdram, quicksave_enter_mq, NULLPTR, OS_MESG_NOBLOCK);
-        // Wait for the main thread to signal that other permanent threads are safe to continue.
-        osRecvMesg(rdram, quicksave_exit_mq, NULLPTR, OS_MESG_BLOCK);
     }
+    return true;
 }
 
-extern "C" void wake_threads_for_quicksave_action(uint8_t* rdram, recomp_context* ctx);
+static void save_checkpoint_contexts(ContextMap& contexts, int32_t main_thread_id, recomp_context* main_ctx) {
+    {
+        std::lock_guard lock{ Quicksave.context_mutex };
+        contexts.clear();
+    }
+    save_context(contexts, main_thread_id, main_ctx);
+    for (const auto& [thread_id, ctx] : Handshake.waiting) {
+        save_context(contexts, thread_id, ctx);
+    }
+}
 
-extern "C" void recomp_handle_quicksave_actions_main(uint8_t* rdram, recomp_context* ctx) {
-    QuicksaveAction action = cur_quicksave_action.load();
-    
-    if (action != QuicksaveAction::None) {
-        PTR(OSMesgQueue) quicksave_enter_mq = _arg<0, PTR(OSMesgQueue)>(rdram, ctx);
-        PTR(OSMesgQueue) quicksave_exit_mq = _arg<1, PTR(OSMesgQueue)>(rdram, ctx);
+static void load_checkpoint_contexts(const ContextMap& contexts, int32_t main_thread_id, recomp_context* main_ctx) {
+    load_context(contexts, main_thread_id, main_ctx);
+    for (const auto& [thread_id, ctx] : Handshake.waiting) {
+        load_context(contexts, thread_id, ctx);
+    }
+}
 
-        wake_threads_for_quicksave_action(rdram, ctx);
+extern "C" void recomp_handle_quicksave_actions(uint8_t* rdram, recomp_context* ctx) {
+    if (!is_action_posted(cur_quicksave_action.load())) {
+        return;
+    }
+    init_handshake(rdram);
 
-        // Wait for all other permanent threads (hence the minus 1) to signal that they're ready for a quicksave action.
-        for (uint32_t i = 0; i < ultramodern::permanent_thread_count() - 1; i++) {
-            osRecvMesg(rdram, quicksave_enter_mq, NULLPTR, OS_MESG_BLOCK);
+    {
+        std::lock_guard lock{ Handshake.mutex };
+        if (Handshake.closed || !is_action_posted(cur_quicksave_action.load())) {
+            return;
         }
+        Handshake.waiting[TO_PTR(OSThread, ultramodern::this_thread())->id] = ctx;
+    }
 
-        // Allow any temporary threads to complete by lowering this thread's priority to 0.
-        // TODO this won't cause all temporary threads to complete if any are blocked by permanent threads
-        // or events like timers. Situations like that will need to be handed on a case-by-case basis for a given game.
-        if (ultramodern::temporary_thread_count() != 0) {
-            OSPri old_pri = osGetThreadPri(rdram, NULLPTR);
-            osSetThreadPri(rdram, NULLPTR, 0);
+    // Tell the main thread that this thread is ready, then wait until it's done. It saves or restores this thread's
+    // registers in the meantime.
+    osSendMesg(rdram, handshake_enter_mq, NULLPTR, OS_MESG_NOBLOCK);
+    osRecvMesg(rdram, handshake_exit_mq, NULLPTR, OS_MESG_BLOCK);
+}
 
-            osSetThreadPri(rdram, NULLPTR, old_pri);
+extern "C" void recomp_handle_quicksave_actions_main(uint8_t* rdram, recomp_context* ctx) {
+    QuicksaveAction action = cur_quicksave_action.load();
+    if (!is_action_posted(action)) {
+        return;
+    }
+    init_handshake(rdram);
+    int32_t thread_id = TO_PTR(OSThread, ultramodern::this_thread())->id;
+
+    // Wait for the other checkpoint threads, or for the timer to give up on them.
+    Handshake.round = Handshake.round % 0xFFFF + 1;
+    osSetTimer(rdram, handshake_timer, checkpoint_timeout, 0, handshake_enter_mq, (OSMesg)Handshake.round);
+    bool complete = false;
+    while (true) {
+        {
+            std::lock_guard lock{ Handshake.mutex };
+            if (Handshake.waiting.size() == checkpoint_thread_count) {
+                Handshake.closed = true;
+                complete = true;
+                break;
+            }
+        }
+        osRecvMesg(rdram, handshake_enter_mq, handshake_received_msg, OS_MESG_BLOCK);
+        if ((uint32_t)MEM_W(0, (gpr)handshake_received_msg) == Handshake.round) {
+            std::lock_guard lock{ Handshake.mutex };
+            Handshake.closed = true;
+            complete = Handshake.waiting.size() == checkpoint_thread_count;
+            break;
         }
+    }
+    osStopTimer(rdram, handshake_timer);
 
-        if (action == QuicksaveAction::Save) {
-            std::copy(rdram, rdram + ultramodern::rdram_size, saved_rdram);
+    // Allow any temporary threads to complete by lowering this thread's priority to 0.
+    // TODO this won't cause all temporary threads to complete if any are blocked by permanent threads
+    // or events like timers. Situations like that will need to be handed on a case-by-case basis for a given game.
+    if (ultramodern::temporary_thread_count() != 0) {
+        OSPri old_pri = osGetThreadPri(rdram, NULLPTR);
+        osSetThreadPri(rdram, NULLPTR, 0);
+
+        osSetThreadPri(rdram, NULLPTR, old_pri);
+    }
+
+    const char* cancel_reason = complete ? nullptr : "not every thread reached its checkpoint";
+    if (complete) {
+        const ContextMap* load_contexts = nullptr;
+        switch (action) {
+        case QuicksaveAction::Load:
+            load_contexts = &Quicksave.saved_contexts;
+            break;
+        case QuicksaveAction::LoadFile:
+        case QuicksaveAction::RewindStep:
+            load_contexts = &Quicksave.pending_contexts;
+            break;
+        default:
+            break;
+        }
+        if (action == QuicksaveAction::Load && !Quicksave.saved_rdram.valid()) {
+            cancel_reason = "nothing has been quicksaved yet";
         }
-        else if (action == QuicksaveAction::Load) {
-            std::copy(saved_rdram, saved_rdram + ultramodern::rdram_size, rdram);
+        else if (load_contexts != nullptr && !contexts_match_checkpoints(*load_contexts, thread_id, ctx)) {
+            cancel_reason = "the game is in a different place than when it was saved";
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (cancel_reason != nullptr) {
+        if (action == QuicksaveAction::RewindStep) {
+            zelda64::rewind_step_cancelled();
         }
-        else {
+        Quicksave.file_reader.reset();
+        Quicksave.pending_contexts.clear();
+    }
+    else {
+        switch (action) {
+        case QuicksaveAction::Save:
+            save_checkpoint_contexts(Quicksave.saved_contexts, thread_id, ctx);
+            Quicksave.saved_rdram.save(rdram, ultramodern::rdram_size);
+            Quicksave.saved_data.clear();
+            recomputil::save_data_snapshot(Quicksave.saved_data);
+            break;
+        case QuicksaveAction::Load:
+            load_checkpoint_contexts(Quicksave.saved_contexts, thread_id, ctx);
+            Quicksave.saved_rdram.restore();
+            recomputil::load_data_snapshot(Quicksave.saved_data);
+            break;
+        case QuicksaveAction::SaveFile:
+            save_checkpoint_contexts(Quicksave.pending_contexts, thread_id, ctx);
+            save_file(rdram);
+            break;
+        case QuicksaveAction::LoadFile:
+            if (load_file(rdram)) {
+                load_checkpoint_contexts(Quicksave.pending_contexts, thread_id, ctx);
+            }
+            else {
+                cancel_reason = "the save state is corrupt";
+            }
+            Quicksave.pending_contexts.clear();
+            break;
+        case QuicksaveAction::RewindCapture:
+            save_checkpoint_contexts(Quicksave.pending_contexts, thread_id, ctx);
+            zelda64::rewind_capture(rdram, Quicksave.pending_contexts);
+            Quicksave.pending_contexts.clear();
+            break;
+        case QuicksaveAction::RewindStep:
+            load_checkpoint_contexts(Quicksave.pending_contexts, thread_id, ctx);
+            zelda64::rewind_step(rdram);
+            Quicksave.pending_contexts.clear();
+            break;
+        default:
             assert(false);
+            break;
         }
+    }
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-        printf("Quicksave action complete\n");
+    if (cancel_reason != nullptr) {
+        printf("Quicksave action cancelled: %s\n", cancel_reason);
+    }
+    else if (action == QuicksaveAction::Save || action == QuicksaveAction::Load) {
+        printf("Quicksave %s complete: %zu pages in %.3f ms\n", action == QuicksaveAction::Save ? "save" : "load",
+            Quicksave.saved_rdram.last_page_count(), elapsed_ms);
+    }
+    else if (action == QuicksaveAction::SaveFile || action == QuicksaveAction::LoadFile) {
+        printf("Save state %s complete in %.3f ms\n", action == QuicksaveAction::SaveFile ? "save" : "load", elapsed_ms);
+    }
 
+    // Let the threads that checked in continue. Threads can check in for the next action as soon as it's posted.
+    size_t num_waiting;
+    {
+        std::lock_guard lock{ Handshake.mutex };
+        num_waiting = Handshake.waiting.size();
+        Handshake.waiting.clear();
+        Handshake.closed = false;
         cur_quicksave_action.store(QuicksaveAction::None);
+    }
+    for (size_t i = 0; i < num_waiting; i++) {
+        osSendMesg(rdram, handshake_exit_mq, NULLPTR, OS_MESG_BLOCK);
+    }
+}
 
-        // Tell all other permanent threads that they're good to continue.
-        for (uint32_t i = 0; i < ultramodern::permanent_thread_count() - 1; i++) {
-            osSendMesg(rdram, quicksave_exit_mq, NULLPTR, OS_MESG_BLOCK);
+// Simulates a typical Dr. Mario frame on a buffer the size of RDRAM for the benchmarks below: one framebuffer is redrawn,
+// the audio buffer is refilled and a few hundred words of game state are updated.
+static void simulate_frame(uint8_t* region, size_t frame, std::mt19937& rng) {
+    constexpr size_t framebuffer_bytes = 320 * 240 * sizeof(uint16_t);
+    constexpr size_t framebuffer_offsets[2] = { 0x200000, 0x280000 };
+    constexpr size_t audio_offset = 0x300000;
+    constexpr size_t audio_bytes = 0x2000;
+    constexpr size_t state_offset = 0x100000;
+    constexpr size_t state_bytes = 0x80000;
+    constexpr size_t state_writes = 512;
+
+    std::memset(region + framebuffer_offsets[frame % 2], static_cast<int>(frame), framebuffer_bytes);
+    std::memset(region + audio_offset, static_cast<int>(frame), audio_bytes);
+    for (size_t i = 0; i < state_writes; i++) {
+        size_t offset = state_offset + (rng() % (state_bytes / sizeof(uint32_t))) * sizeof(uint32_t);
+        uint32_t value = static_cast<uint32_t>(frame);
+        std::memcpy(region + offset, &value, sizeof(value));
+    }
+}
+
+// Allocates a tracked-region-compatible buffer the size of RDRAM filled with random data.
+static uint8_t* allocate_benchmark_rdram(std::mt19937& rng) {
+    uint8_t* region = DirtyPageTracker::allocate_region(ultramodern::rdram_size);
+    if (region != nullptr) {
+        for (size_t i = 0; i < ultramodern::rdram_size; i += sizeof(uint32_t)) {
+            uint32_t value = rng();
+            std::memcpy(region + i, &value, sizeof(value));
         }
     }
+    return region;
+}
+
+// Compares a full copy of RDRAM, which is what quicksaving used to do, against saving only the dirty pages, and
+// measures the cost of the write faults.
+std::string zelda64::benchmark_quicksave() {
+    constexpr size_t num_frames = 240;
+
+    size_t size = ultramodern::rdram_size;
+    std::mt19937 rng{ 0x5EED };
+    uint8_t* region = allocate_benchmark_rdram(rng);
+    if (region == nullptr) {
+        return "Failed to allocate benchmark memory";
+    }
+    std::vector<uint8_t> snapshot(size);
+
+    using clock = std::chrono::steady_clock;
+    auto ms_since = [](clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+
+    // Baseline: untracked frames followed by a full copy.
+    double untracked_write_ms = 0.0;
+    double full_copy_ms = 0.0;
+    for (size_t frame = 0; frame < num_frames; frame++) {
+        auto start = clock::now();
+        simulate_frame(region, frame, rng);
+        untracked_write_ms += ms_since(start);
+
+        start = clock::now();
+        std::memcpy(snapshot.data(), region, size);
+        full_copy_ms += ms_since(start);
+    }
+
+    // Tracked frames followed by an incremental save.
+    DirtyPageTracker tracker;
+    bool tracked = tracker.start(region, size);
+    std::vector<uint32_t> pages;
+    tracker.take_dirty_pages(pages);
+    copy_pages(snapshot.data(), region, pages, tracker.page_size(), size);
+
+    double tracked_write_ms = 0.0;
+    double incremental_ms = 0.0;
+    size_t total_pages = 0;
+    for (size_t frame = 0; frame < num_frames; frame++) {
+        auto start = clock::now();
+        simulate_frame(region, frame, rng);
+        tracked_write_ms += ms_since(start);
+
+        start = clock::now();
+        pages.clear();
+        tracker.take_dirty_pages(pages);
+        copy_pages(snapshot.data(), region, pages, tracker.page_size(), size);
+        incremental_ms += ms_since(start);
+        total_pages += pages.size();
+    }
+
+    bool matches = std::memcmp(snapshot.data(), region, size) == 0;
+    uint64_t faults = tracker.fault_count();
+    tracker.stop();
+    DirtyPageTracker::free_region(region, size);
+
+    double full_avg = full_copy_ms / num_frames;
+    double incremental_avg = incremental_ms / num_frames;
+    // Pages stay writable after their first fault until the next save, so this is paid once per save rather than per
+    // frame when saves are further apart than one frame.
+    double fault_overhead_us = (tracked_write_ms - untracked_write_ms) * 1000.0 / num_frames;
+    printf("Quicksave benchmark over %zu frames (%s):\n", num_frames, tracked ? "dirty page tracking" : "tracking unavailable");
+    printf("  full copy:   %.3f ms per save\n", full_avg);
+    printf("  incremental: %.3f ms per save, %.1f pages of %zu bytes\n", incremental_avg, (double)total_pages / num_frames, tracker.page_size());
+    printf("  faults:      %.1f per save, %.1f us per save\n", (double)faults / num_frames, fault_overhead_us);
+    printf("  snapshot %s\n", matches ? "matches" : "DOES NOT MATCH");
+
+    char summary[160];
+    snprintf(summary, sizeof(summary), "%s %.3f ms, incremental %.3f ms, faults %.0f us/save",
+        matches ? "Full" : "MISMATCH, full", full_avg, incremental_avg, fault_overhead_us);
+    return summary;
 }
 
-#endif
+// Run-ahead would, on every displayed frame, snapshot the game, run it N frames ahead with the current input and its
+// output suppressed, present the last of those frames, then roll back and run the real frame. That removes up to N
+// frames of the game's own input lag, at the cost of N extra frames of game logic plus one snapshot and one restore per
+// frame. This measures the snapshot and restore cost for each N on the simulated frame.
+//
+// Run-ahead itself isn't implemented. The quicksave handshake can snapshot and restore the game between frames, but
+// running ahead also needs the game's frame clock to advance faster than VI, and its RSP graphics and audio tasks to be
+// skipped for the hidden frames. Both are handled by the runtime and the renderer rather than anything in this tree.
+std::string zelda64::benchmark_run_ahead() {
+    constexpr size_t num_frames = 240;
+    constexpr size_t max_run_ahead = 3;
+
+    size_t size = ultramodern::rdram_size;
+    std::mt19937 rng{ 0x5EED };
+    uint8_t* region = allocate_benchmark_rdram(rng);
+    if (region == nullptr) {
+        return "Failed to allocate benchmark memory";
+    }
+    std::vector<uint8_t> expected(size);
+
+    using clock = std::chrono::steady_clock;
+    auto ms_since = [](clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+
+    std::string summary;
+    bool all_match = true;
+    printf("Run-ahead benchmark over %zu frames:\n", num_frames);
+    for (size_t ahead = 1; ahead <= max_run_ahead; ahead++) {
+        PageSnapshot snapshot;
+        double save_ms = 0.0;
+        double restore_ms = 0.0;
+        double logic_ms = 0.0;
+        size_t total_pages = 0;
+        bool matches = true;
+
+        for (size_t frame = 0; frame < num_frames; frame++) {
+            auto start = clock::now();
+            snapshot.save(region, size);
+            save_ms += ms_since(start);
+            if (frame == num_frames - 1) {
+                std::memcpy(expected.data(), region, size);
+            }
+
+            start = clock::now();
+            for (size_t i = 1; i <= ahead; i++) {
+                simulate_frame(region, frame + i, rng);
+            }
+            logic_ms += ms_since(start);
+
+            start = clock::now();
+            snapshot.restore();
+            restore_ms += ms_since(start);
+            total_pages += snapshot.last_page_count();
+            if (frame == num_frames - 1) {
+                matches = std::memcmp(expected.data(), region, size) == 0;
+            }
+
+            start = clock::now();
+            simulate_frame(region, frame, rng);
+            logic_ms += ms_since(start);
+        }
+        snapshot.reset();
+        all_match = all_match && matches;
+
+        // The first save copies all of RDRAM, which only happens when run-ahead is turned on.
+        double overhead_ms = (save_ms + restore_ms) / num_frames;
+        printf("  %zu ahead: save %.3f ms, restore %.3f ms, %.1f pages restored, simulated logic %.3f ms per frame%s\n",
+            ahead, save_ms / num_frames, restore_ms / num_frames, (double)total_pages / num_frames, logic_ms / num_frames,
+            matches ? "" : ", RESTORE MISMATCH");
+
+        char part[64];
+        snprintf(part, sizeof(part), "%s%zu ahead %.2f ms", summary.empty() ? "" : ", ", ahead, overhead_ms);
+        summary += part;
+    }
+    DirtyPageTracker::free_region(region, size);
+
+    return all_match ? summary : "MISMATCH, " + summary;
+}
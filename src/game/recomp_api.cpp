@@ -1,3 +1,4 @@
+#include <atomic>
 #include <cmath>
 
 #include "recomp.h"
@@ -61,6 +62,18 @@ extern "C" void recomp_exit(uint8_t* rdram, recomp_context* ctx) {
     ultramodern::quit();
 }
 
+// Number of characters loaded so far, counted by a hook at the start of animeState_load. Loads reuse the same buffers,
+// so the animation atlases in patches/anime_atlas.c are thrown away whenever this changes.
+static std::atomic<uint32_t> anime_load_generation = 0;
+
+extern "C" void recomp_on_anime_state_load(uint8_t* rdram, recomp_context* ctx) {
+    anime_load_generation++;
+}
+
+extern "C" void recomp_get_anime_load_generation(uint8_t* rdram, recomp_context* ctx) {
+    _return(ctx, anime_load_generation.load());
+}
+
 extern "C" void recomp_get_gyro_deltas(uint8_t* rdram, recomp_context* ctx) {
     float* x_out = _arg<0, float*>(rdram, ctx);
     float* y_out = _arg<1, float*>(rdram, ctx);
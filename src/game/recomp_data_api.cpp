@@ -1,70 +1,246 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
 #include <vector>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <type_traits>
 #include <unordered_map>
-#include <unordered_set>
+#include <utility>
 
-#include "slot_map.h"
+#include "flat_u32_map.h"
 #include "recomp_data.h"
+#include "recomp_telemetry.h"
 #include "recomp_ui.h"
+#include "zelda_config.h"
 #include "librecomp/helpers.hpp"
 #include "librecomp/overlays.hpp"
 #include "librecomp/addresses.hpp"
 #include "ultramodern/error_handling.hpp"
 
+// Snapshot buffers. Snapshots are only restored by the build that took them, so data is kept in host byte order and
+// arrays of trivially copyable data are copied in bulk.
+class SnapshotWriter {
+private:
+    std::vector<uint8_t>& out;
+public:
+    explicit SnapshotWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    template <typename T>
+    void write(const T& value) {
+        write_array(&value, 1);
+    }
+
+    template <typename T>
+    void write_array(const T* values, size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        size_t offset = out.size();
+        out.resize(offset + sizeof(T) * count);
+        if (count != 0) {
+            std::memcpy(out.data() + offset, values, sizeof(T) * count);
+        }
+    }
+
+    template <typename T>
+    void write_vector(const std::vector<T>& values) {
+        write<uint32_t>(static_cast<uint32_t>(values.size()));
+        write_array(values.data(), values.size());
+    }
+
+    void write_deque(const std::deque<uint32_t>& values) {
+        write<uint32_t>(static_cast<uint32_t>(values.size()));
+        for (uint32_t value : values) {
+            write(value);
+        }
+    }
+};
+
+class SnapshotReader {
+private:
+    std::span<const uint8_t> data;
+    size_t offset = 0;
+public:
+    explicit SnapshotReader(std::span<const uint8_t> data) : data(data) {}
+
+    template <typename T>
+    bool read(T& value) {
+        return read_array(&value, 1);
+    }
+
+    template <typename T>
+    bool read_array(T* values, size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (count > (data.size() - offset) / sizeof(T)) {
+            return false;
+        }
+        if (count != 0) {
+            std::memcpy(values, data.data() + offset, sizeof(T) * count);
+        }
+        offset += sizeof(T) * count;
+        return true;
+    }
+
+    template <typename T>
+    bool read_vector(std::vector<T>& values) {
+        uint32_t count;
+        if (!read(count) || count > (data.size() - offset) / sizeof(T)) {
+            return false;
+        }
+        values.resize(count);
+        return read_array(values.data(), count);
+    }
+
+    bool read_deque(std::deque<uint32_t>& values) {
+        std::vector<uint32_t> temp;
+        if (!read_vector(temp)) {
+            return false;
+        }
+        values.assign(temp.begin(), temp.end());
+        return true;
+    }
+
+    bool at_end() const {
+        return offset == data.size();
+    }
+};
+
+// The mod-facing maps and sets only ever use u32 keys, so they're backed by FlatU32Map/AdaptiveU32Set, which store
+// entries inline instead of allocating a node per entry like the standard unordered containers. Sets of small indices
+// are kept as bitsets.
+// All of the containers take a shared lock for read-only operations, so threads reading the same container don't
+// serialize against each other.
 template <typename KeyType, typename ValueType>
 class LockedMap {
+    static_assert(std::is_same_v<KeyType, uint32_t>, "LockedMap only supports u32 keys");
 private:
-    std::mutex mutex{};
-    std::unordered_map<KeyType, ValueType> map{};
+    recomputil::TimedMutex<std::shared_mutex> mutex{};
+    FlatU32Map<ValueType> map{};
 public:
     bool get(const KeyType& key, ValueType& out) {
-        std::lock_guard lock{mutex};
-        auto find_it = map.find(key);
-        if (find_it == map.end()) {
+        std::shared_lock lock{mutex};
+        ValueType* value = map.find(key);
+        if (value == nullptr) {
             return false;
         }
-        out = find_it->second;
+        out = *value;
         return true;
     }
 
     bool insert(const KeyType& key, ValueType val) {
         std::lock_guard lock{mutex};
-        auto ret = map.insert_or_assign(key, val);
-        return ret.second;
+        return map.insert_or_assign(key, val);
     }
 
     bool erase(const KeyType& key) {
         std::lock_guard lock{mutex};
-        size_t num_erased = map.erase(key);
-        return num_erased != 0;
+        return map.erase(key);
+    }
+
+    // Erases the key and returns the value it had, so that the value can be released without racing another erase.
+    bool erase(const KeyType& key, ValueType& out) {
+        std::lock_guard lock{mutex};
+        ValueType* value = map.find(key);
+        if (value == nullptr) {
+            return false;
+        }
+        out = *value;
+        return map.erase(key);
     }
 
     void clear() {
         std::lock_guard lock{mutex};
         map.clear();
     }
-    
-    bool erase_first(ValueType& out) {
+
+    // Bulk versions of the operations above, which process every key under a single lock and return the number of keys
+    // that were inserted, found or erased.
+    size_t insert_many(const KeyType* keys, const ValueType* values, size_t count) {
         std::lock_guard lock{mutex};
-        auto it = map.begin();
+        map.reserve(map.size() + count);
+        size_t num_inserted = 0;
+        for (size_t i = 0; i < count; i++) {
+            num_inserted += map.insert_or_assign(keys[i], values[i]);
+        }
+        return num_inserted;
+    }
 
-        if (it == map.end()) {
-            return false;
+    // Values for keys that aren't in the map are left unchanged.
+    size_t get_many(const KeyType* keys, ValueType* values_out, size_t count) {
+        std::shared_lock lock{mutex};
+        size_t num_found = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (ValueType* value = map.find(keys[i])) {
+                values_out[i] = *value;
+                num_found++;
+            }
+        }
+        return num_found;
+    }
+
+    size_t erase_many(const KeyType* keys, size_t count) {
+        std::lock_guard lock{mutex};
+        size_t num_erased = 0;
+        for (size_t i = 0; i < count; i++) {
+            num_erased += map.erase(keys[i]);
         }
+        return num_erased;
+    }
 
-        out = it->second;
-        map.erase(it);
-        return true;
+    template <typename Func>
+    size_t contains_many(const KeyType* keys, size_t count, Func&& on_result) {
+        std::shared_lock lock{mutex};
+        size_t num_found = 0;
+        for (size_t i = 0; i < count; i++) {
+            bool found = map.contains(keys[i]);
+            on_result(i, found);
+            num_found += found;
+        }
+        return num_found;
     }
 
     bool contains(const KeyType& key) {
-        std::lock_guard lock{mutex};
+        std::shared_lock lock{mutex};
 
         return map.contains(key);
     }
 
-    size_t size() {
+    // Resumable iteration in hash order, see FlatU32Map::visit_from_hash.
+    template <typename Func>
+    size_t visit_from(U32IterationCursor& cursor, size_t max_count, Func&& func) {
+        std::shared_lock lock{mutex};
+        return map.visit_from_hash(cursor.position, max_count, cursor.position, cursor.finished, func);
+    }
+
+    void save(SnapshotWriter& writer) {
+        std::shared_lock lock{mutex};
+        writer.write<uint32_t>(static_cast<uint32_t>(map.capacity()));
+        writer.write<uint32_t>(static_cast<uint32_t>(map.size()));
+        writer.write_array(map.raw_slots(), map.capacity());
+    }
+
+    bool load(SnapshotReader& reader) {
         std::lock_guard lock{mutex};
+        uint32_t capacity, num_entries;
+        std::vector<typename FlatU32Map<ValueType>::Slot> slots;
+        if (!reader.read(capacity) || !reader.read(num_entries) || capacity > (1u << 31)) {
+            return false;
+        }
+        slots.resize(capacity);
+        return reader.read_array(slots.data(), capacity) && map.assign_raw_slots(slots.data(), capacity, num_entries);
+    }
+
+    size_t size() {
+        std::shared_lock lock{mutex};
 
         return map.size();
     }
@@ -72,25 +248,24 @@ public:
 
 template <typename KeyType>
 class LockedSet {
+    static_assert(std::is_same_v<KeyType, uint32_t>, "LockedSet only supports u32 keys");
 private:
-    std::mutex mutex{};
-    std::unordered_set<KeyType> set{};
+    recomputil::TimedMutex<std::shared_mutex> mutex{};
+    AdaptiveU32Set set{};
 public:
     bool contains(const KeyType& key) {
-        std::lock_guard lock{mutex};
+        std::shared_lock lock{mutex};
         return set.contains(key);
     }
 
     bool insert(const KeyType& key) {
         std::lock_guard lock{mutex};
-        auto it = set.insert(key);
-        return it.second;
+        return set.insert(key);
     }
 
     bool erase(const KeyType& key) {
         std::lock_guard lock{mutex};
-        size_t num_erased = set.erase(key);
-        return num_erased != 0;
+        return set.erase(key);
     }
 
     void clear() {
@@ -98,79 +273,691 @@ public:
         set.clear();
     }
 
-    size_t size() {
+    size_t insert_many(const KeyType* keys, size_t count) {
+        std::lock_guard lock{mutex};
+        set.reserve(set.size() + count);
+        size_t num_inserted = 0;
+        for (size_t i = 0; i < count; i++) {
+            num_inserted += set.insert(keys[i]);
+        }
+        return num_inserted;
+    }
+
+    size_t erase_many(const KeyType* keys, size_t count) {
         std::lock_guard lock{mutex};
+        size_t num_erased = 0;
+        for (size_t i = 0; i < count; i++) {
+            num_erased += set.erase(keys[i]);
+        }
+        return num_erased;
+    }
+
+    template <typename Func>
+    size_t contains_many(const KeyType* keys, size_t count, Func&& on_result) {
+        std::shared_lock lock{mutex};
+        size_t num_found = 0;
+        for (size_t i = 0; i < count; i++) {
+            bool found = set.contains(keys[i]);
+            on_result(i, found);
+            num_found += found;
+        }
+        return num_found;
+    }
+
+    size_t size() {
+        std::shared_lock lock{mutex};
         return set.size();
     }
+
+    // Resumable iteration, see AdaptiveU32Set::visit_from.
+    template <typename Func>
+    size_t visit_from(U32IterationCursor& cursor, size_t max_count, Func&& func) {
+        std::shared_lock lock{mutex};
+        return set.visit_from(cursor, max_count, func);
+    }
+
+    // Saved as a u8 that's 1 for a bitset followed by its words, or 0 for a hashed set followed by its slots.
+    void save(SnapshotWriter& writer) {
+        std::shared_lock lock{mutex};
+        writer.write<uint8_t>(set.is_dense());
+        if (set.is_dense()) {
+            writer.write_vector(set.dense_words());
+            return;
+        }
+        const FlatU32Set& flat = set.flat_set();
+        writer.write<uint32_t>(static_cast<uint32_t>(flat.capacity()));
+        writer.write<uint32_t>(static_cast<uint32_t>(flat.size()));
+        writer.write_array(flat.raw_slots(), flat.capacity());
+    }
+
+    bool load(SnapshotReader& reader) {
+        std::lock_guard lock{mutex};
+        uint8_t dense;
+        if (!reader.read(dense) || dense > 1) {
+            return false;
+        }
+        if (dense != 0) {
+            std::vector<uint64_t> words;
+            return reader.read_vector(words) && set.assign_dense_words(std::move(words));
+        }
+
+        uint32_t capacity, num_entries;
+        std::vector<FlatU32Set::Slot> slots;
+        if (!reader.read(capacity) || !reader.read(num_entries) || capacity > (1u << 31)) {
+            return false;
+        }
+        slots.resize(capacity);
+        return reader.read_array(slots.data(), capacity) && set.assign_raw_slots(slots.data(), capacity, num_entries);
+    }
 };
 
+// Slot map of the u32-sized values that mods store in slotmaps. Keys have the same layout as dod::slot_map32 keys
+// (10-bit version, 20-bit index) and are never 0. Erasing an element bumps its slot's version, and a slot that runs out
+// of versions is retired instead of reused, so a stale key never matches a newer element. Values are stored in pages
+// that never move, so pointers returned by get stay valid while other elements are created, and the per-slot versions
+// are plain arrays that snapshots can copy directly.
 template <typename ValueType>
 class LockedSlotmap {
+    static_assert(std::is_trivially_copyable_v<ValueType>, "LockedSlotmap values must be trivially copyable");
 private:
-    std::mutex mutex{};
-    dod::slot_map32<ValueType> map{};
-    using key_t = typename dod::slot_map32<ValueType>::key;
+    static constexpr uint32_t page_size = 1024;
+    static constexpr uint32_t index_mask = 0x000FFFFF;
+    static constexpr uint32_t version_shift = 20;
+    static constexpr uint16_t max_version = 0x3FF;
+    // Freed slots aren't reused until this many are waiting, the same as dod::slot_map.
+    static constexpr size_t min_free_indices = 64;
+
+    using Page = std::array<ValueType, page_size>;
+
+    recomputil::TimedMutex<std::shared_mutex> mutex{};
+    std::vector<uint16_t> versions{};
+    std::vector<uint8_t> alive{};
+    std::vector<std::unique_ptr<Page>> pages{};
+    std::deque<uint32_t> free_indices{};
+    size_t count = 0;
+
+    uint32_t make_key(uint32_t index) const {
+        return (static_cast<uint32_t>(versions[index]) << version_shift) | index;
+    }
+
+    bool find(uint32_t key, uint32_t& index) const {
+        index = key & index_mask;
+        return key != 0 && index < alive.size() && alive[index] != 0 && make_key(index) == key;
+    }
+
+    ValueType& value_at(uint32_t index) {
+        return (*pages[index / page_size])[index % page_size];
+    }
+
+    void erase_index(uint32_t index) {
+        alive[index] = 0;
+        count--;
+        if (versions[index] < max_version) {
+            versions[index]++;
+            free_indices.push_back(index);
+        }
+    }
 public:
     bool get(uint32_t key, ValueType** out) {
-        std::lock_guard lock{mutex};
-        ValueType* ret = map.get(key_t{key});
-        *out = ret;
-        return ret != nullptr;
+        std::shared_lock lock{mutex};
+        uint32_t index;
+        if (!find(key, index)) {
+            *out = nullptr;
+            return false;
+        }
+        *out = &value_at(index);
+        return true;
     }
 
     uint32_t create() {
         std::lock_guard lock{mutex};
-        return map.emplace().raw;
+        uint32_t index;
+        if (free_indices.size() > min_free_indices || versions.size() > index_mask) {
+            if (free_indices.empty()) {
+                return 0;
+            }
+            index = free_indices.front();
+            free_indices.pop_front();
+        }
+        else {
+            index = static_cast<uint32_t>(versions.size());
+            versions.push_back(1);
+            alive.push_back(0);
+            if (index % page_size == 0) {
+                pages.push_back(std::make_unique<Page>());
+            }
+        }
+
+        alive[index] = 1;
+        value_at(index) = ValueType{};
+        count++;
+        return make_key(index);
     }
 
     bool erase(uint32_t key) {
         std::lock_guard lock{mutex};
-        if (!map.has_key(key_t{ key })) {
+        uint32_t index;
+        if (!find(key, index)) {
             return false;
         }
 
-        map.erase(key_t{ key });
+        erase_index(index);
         return true;
     }
 
     void clear() {
         std::lock_guard lock{mutex};
-        map.clear();
+        for (uint32_t index = 0; index < alive.size(); index++) {
+            if (alive[index] != 0) {
+                erase_index(index);
+            }
+        }
     }
     
-    bool erase_first(ValueType& out) {
+    bool erase(uint32_t key, ValueType& out) {
         std::lock_guard lock{mutex};
-        auto it = map.items().begin();
+        uint32_t index;
+        if (!find(key, index)) {
+            return false;
+        }
+
+        out = value_at(index);
+        erase_index(index);
+        return true;
+    }
+
+    size_t size() {
+        std::shared_lock lock{mutex};
+
+        return count;
+    }
+
+    // Visits up to max_count elements whose slot index is at least the cursor's position, in slot order. Elements never
+    // move between slots, so resuming from an index visits every element that stayed in the map exactly once. The keys
+    // passed to func include the slot's version, the same as the keys returned by create.
+    template <typename Func>
+    size_t visit_from(U32IterationCursor& cursor, size_t max_count, Func&& func) {
+        std::shared_lock lock{mutex};
+        size_t num_visited = 0;
+        uint32_t index = cursor.position;
+        for (; index < alive.size() && num_visited < max_count; index++) {
+            if (alive[index] != 0) {
+                func(make_key(index), value_at(index));
+                num_visited++;
+            }
+        }
+
+        // Skip trailing erased slots so that finished is set as soon as the last element has been visited.
+        while (index < alive.size() && alive[index] == 0) {
+            index++;
+        }
+        cursor.position = index;
+        cursor.finished = index >= alive.size();
+        return num_visited;
+    }
+
+    // Saves the slot versions and free list along with the values, so keys that mods hold stay valid after a restore.
+    void save(SnapshotWriter& writer) {
+        std::shared_lock lock{mutex};
+        writer.write_vector(versions);
+        writer.write_vector(alive);
+        for (size_t base = 0; base < versions.size(); base += page_size) {
+            writer.write_array(pages[base / page_size]->data(), std::min<size_t>(page_size, versions.size() - base));
+        }
+        writer.write_deque(free_indices);
+    }
+
+    bool load(SnapshotReader& reader) {
+        std::lock_guard lock{mutex};
+        pages.clear();
+        free_indices.clear();
+        count = 0;
+        if (!reader.read_vector(versions) || !reader.read_vector(alive) || alive.size() != versions.size() ||
+            versions.size() > index_mask + 1)
+        {
+            versions.clear();
+            alive.clear();
+            return false;
+        }
+
+        for (size_t base = 0; base < versions.size(); base += page_size) {
+            pages.push_back(std::make_unique<Page>());
+            if (!reader.read_array(pages.back()->data(), std::min<size_t>(page_size, versions.size() - base))) {
+                return false;
+            }
+        }
+        if (!reader.read_deque(free_indices)) {
+            return false;
+        }
+
+        for (size_t index = 0; index < alive.size(); index++) {
+            if (versions[index] == 0 || versions[index] > max_version) {
+                return false;
+            }
+            count += alive[index] != 0;
+        }
+        for (uint32_t index : free_indices) {
+            if (index >= alive.size() || alive[index] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Table of the containers created by mods, indexed by the handles that mods pass to every data API call.
+// Resolving a handle doesn't take any locks: slots live in fixed-size pages that are never moved or freed, and each
+// slot publishes the handle it currently holds with a release store after the container is constructed. A resolved
+// handle is a Ref, which counts as a reader of its slot until it's destroyed, and a container is only destroyed once its
+// handle is unpublished and its slot has no readers left. Creating and destroying containers is serialized by a mutex.
+// Handles use the same layout as dod::slot_map32 keys (10-bit version, 20-bit index) and are never 0. Erasing a
+// container bumps its slot's version, and a slot that runs out of versions is retired instead of reused, so a stale
+// handle never matches a newer container.
+template <typename ValueType>
+class HandleTable {
+private:
+    static constexpr uint32_t page_size = 1024;
+    static constexpr uint32_t max_pages = 1024;
+    static constexpr uint32_t index_mask = 0x000FFFFF;
+    static constexpr uint32_t version_shift = 20;
+    static constexpr uint32_t max_version = 0x3FF;
+    // Freed slots aren't reused until this many are waiting, so a stale handle is less likely to match a new container.
+    static constexpr size_t min_free_indices = 64;
+
+    struct Slot {
+        std::atomic_uint32_t handle = 0;
+        std::atomic_uint32_t readers = 0;
+        uint32_t version = 1;
+        std::optional<ValueType> value;
+    };
+
+    struct Page {
+        std::array<Slot, page_size> slots;
+    };
+
+    std::array<std::atomic<Page*>, max_pages> pages{};
+    recomputil::TimedMutex<std::mutex> mutex{};
+    std::deque<uint32_t> free_indices{};
+    uint32_t num_indices = 0;
+    std::atomic_size_t count = 0;
+
+    Slot* slot_for_index(uint32_t index) {
+        Page* page = pages[index / page_size].load(std::memory_order_acquire);
+        if (page == nullptr) {
+            return nullptr;
+        }
+        return &page->slots[index % page_size];
+    }
+
+    // Called with the mutex held after the slot's handle has been cleared. New readers can't get past the handle check
+    // from here on, so this only waits for the ones that already hold a Ref.
+    static void wait_for_readers(Slot* slot) {
+        while (slot->readers.load(std::memory_order_seq_cst) != 0) {
+            std::this_thread::yield();
+        }
+    }
+public:
+    // A resolved handle. Keeps the container alive until it's destroyed, which blocks erasing or loading the table
+    // until then, so a Ref must not be held across a call that creates or destroys containers in the same table.
+    class Ref {
+    public:
+        Ref() = default;
+        Ref(const Ref&) = delete;
+        Ref& operator=(const Ref&) = delete;
+        Ref(Ref&& rhs) noexcept : slot(std::exchange(rhs.slot, nullptr)) {}
+        Ref& operator=(Ref&& rhs) noexcept {
+            if (this != &rhs) {
+                release();
+                slot = std::exchange(rhs.slot, nullptr);
+            }
+            return *this;
+        }
+        ~Ref() {
+            release();
+        }
+
+        explicit operator bool() const {
+            return slot != nullptr;
+        }
+        ValueType& operator*() const {
+            return *slot->value;
+        }
+        ValueType* operator->() const {
+            return &*slot->value;
+        }
+    private:
+        friend class HandleTable;
+        explicit Ref(Slot* slot) : slot(slot) {}
+
+        void release() {
+            if (slot != nullptr) {
+                slot->readers.fetch_sub(1, std::memory_order_release);
+                slot = nullptr;
+            }
+        }
+
+        Slot* slot = nullptr;
+    };
+
+    ~HandleTable() {
+        for (std::atomic<Page*>& page : pages) {
+            delete page.load();
+        }
+    }
+
+    Ref get(uint32_t handle) {
+        uint32_t index = handle & index_mask;
+        Slot* slot = handle != 0 && index / page_size < max_pages ? slot_for_index(index) : nullptr;
+        if (slot == nullptr) {
+            return Ref{};
+        }
+
+        // Register as a reader before checking the handle. erase clears the handle before waiting for readers, so either
+        // this sees the cleared handle or erase sees this reader.
+        slot->readers.fetch_add(1, std::memory_order_seq_cst);
+        if (slot->handle.load(std::memory_order_seq_cst) != handle) {
+            slot->readers.fetch_sub(1, std::memory_order_release);
+            return Ref{};
+        }
+        return Ref{ slot };
+    }
 
-        if (it == map.items().end()) {
+    uint32_t create() {
+        std::lock_guard lock{mutex};
+        uint32_t index;
+        if (free_indices.size() >= min_free_indices || num_indices == page_size * max_pages) {
+            if (free_indices.empty()) {
+                return 0;
+            }
+            index = free_indices.front();
+            free_indices.pop_front();
+        }
+        else {
+            index = num_indices++;
+            // Pages are kept when a snapshot load shrinks the table, so only allocate one if it doesn't exist yet.
+            if (pages[index / page_size].load(std::memory_order_relaxed) == nullptr) {
+                pages[index / page_size].store(new Page{}, std::memory_order_release);
+            }
+        }
+
+        Slot* slot = slot_for_index(index);
+        slot->value.emplace();
+        count++;
+        uint32_t handle = (slot->version << version_shift) | index;
+        slot->handle.store(handle, std::memory_order_release);
+        return handle;
+    }
+
+    // Unpublishes the container, waits for its readers and then calls on_erase with it right before destroying it.
+    template <typename Func>
+    bool erase(uint32_t handle, Func&& on_erase) {
+        std::lock_guard lock{mutex};
+        uint32_t index = handle & index_mask;
+        Slot* slot = index < num_indices ? slot_for_index(index) : nullptr;
+        if (handle == 0 || slot == nullptr || slot->handle.load(std::memory_order_relaxed) != handle) {
             return false;
         }
 
-        out = it->second;
-        map.erase(it->first);
+        slot->handle.store(0, std::memory_order_seq_cst);
+        wait_for_readers(slot);
+        on_erase(*slot->value);
+        slot->value.reset();
+        count--;
+        if (slot->version < max_version) {
+            slot->version++;
+            free_indices.push_back(index);
+        }
         return true;
     }
 
+    bool erase(uint32_t handle) {
+        return erase(handle, [](ValueType&) {});
+    }
+
     size_t size() {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    template <typename Func>
+    void for_each(Func&& func) {
+        std::lock_guard lock{mutex};
+        for (uint32_t index = 0; index < num_indices; index++) {
+            Slot* slot = slot_for_index(index);
+            if (slot->handle.load(std::memory_order_relaxed) != 0) {
+                func(*slot->value);
+            }
+        }
+    }
+
+    // Saves every slot's version and the free list, then calls save_value on each live container in slot order.
+    template <typename Func>
+    void save(SnapshotWriter& writer, Func&& save_value) {
         std::lock_guard lock{mutex};
+        std::vector<uint16_t> versions(num_indices);
+        std::vector<uint8_t> alive(num_indices);
+        for (uint32_t index = 0; index < num_indices; index++) {
+            Slot* slot = slot_for_index(index);
+            versions[index] = static_cast<uint16_t>(slot->version);
+            alive[index] = slot->handle.load(std::memory_order_relaxed) != 0;
+        }
 
-        return map.size();
+        writer.write_vector(versions);
+        writer.write_vector(alive);
+        writer.write_deque(free_indices);
+        for (uint32_t index = 0; index < num_indices; index++) {
+            if (alive[index] != 0) {
+                save_value(writer, *slot_for_index(index)->value);
+            }
+        }
+    }
+
+    // Destroys every container and recreates the saved ones with the same handles, calling load_value to restore each
+    // one. Containers are only published once they're fully loaded. Returns false if the data is invalid, in which case
+    // the table is left empty.
+    template <typename Func>
+    bool load(SnapshotReader& reader, Func&& load_value) {
+        std::lock_guard lock{mutex};
+        for (uint32_t index = 0; index < num_indices; index++) {
+            Slot* slot = slot_for_index(index);
+            slot->handle.store(0, std::memory_order_seq_cst);
+            wait_for_readers(slot);
+            slot->value.reset();
+            slot->version = 1;
+        }
+        free_indices.clear();
+        num_indices = 0;
+        count = 0;
+
+        std::vector<uint16_t> versions;
+        std::vector<uint8_t> alive;
+        std::deque<uint32_t> saved_free_indices;
+        if (!reader.read_vector(versions) || !reader.read_vector(alive) || alive.size() != versions.size() ||
+            versions.size() > page_size * max_pages || !reader.read_deque(saved_free_indices))
+        {
+            return false;
+        }
+
+        uint32_t saved_num_indices = static_cast<uint32_t>(versions.size());
+        for (uint32_t index = 0; index < saved_num_indices; index++) {
+            if (pages[index / page_size].load(std::memory_order_relaxed) == nullptr) {
+                pages[index / page_size].store(new Page{}, std::memory_order_release);
+            }
+            if (versions[index] == 0 || versions[index] > max_version) {
+                return false;
+            }
+        }
+        for (uint32_t index : saved_free_indices) {
+            if (index >= saved_num_indices || alive[index] != 0) {
+                return false;
+            }
+        }
+
+        num_indices = saved_num_indices;
+        bool success = true;
+        for (uint32_t index = 0; index < num_indices && success; index++) {
+            Slot* slot = slot_for_index(index);
+            slot->version = versions[index];
+            if (alive[index] != 0) {
+                slot->value.emplace();
+                success = load_value(reader, *slot->value);
+            }
+        }
+
+        if (!success) {
+            for (uint32_t index = 0; index < num_indices; index++) {
+                Slot* slot = slot_for_index(index);
+                slot->value.reset();
+                slot->version = 1;
+            }
+            num_indices = 0;
+            return false;
+        }
+
+        for (uint32_t index = 0; index < num_indices; index++) {
+            Slot* slot = slot_for_index(index);
+            if (slot->value.has_value()) {
+                slot->handle.store((slot->version << version_shift) | index, std::memory_order_release);
+                count++;
+            }
+        }
+        free_indices = std::move(saved_free_indices);
+        return true;
+    }
+};
+
+// Allocator for the fixed-size elements of a memory hashmap or memory slotmap. Elements are handed out from chunks
+// allocated on the recomp heap, so a container makes a handful of heap allocations instead of one per element. Chunks
+// start small and double in size up to max_chunk_bytes, which keeps containers with few elements cheap. Freed elements
+// go on a free list and are reused first, and every chunk is released at once when the container is destroyed.
+class RdramSlab {
+private:
+    static constexpr uint32_t min_chunk_elements = 4;
+    static constexpr uint32_t max_chunk_bytes = 64 * 1024;
+    static constexpr uint32_t element_alignment = 8;
+
+    recomputil::TimedMutex<std::mutex> mutex{};
+    uint32_t element_size = 0;
+    uint32_t stride = element_alignment;
+    uint32_t next_chunk_elements = min_chunk_elements;
+    std::vector<PTR(void)> chunks{};
+    std::vector<PTR(void)> free_elements{};
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t chunk_bytes = 0;
+
+    void print_occupancy_locked(const char* event) {
+        if (zelda64::get_debug_mode_enabled()) {
+            printf("Data API arena (%u byte elements) %s: %zu/%zu elements used, %zu chunks, %zu bytes\n",
+                element_size, event, used, capacity, chunks.size(), chunk_bytes);
+        }
+    }
+public:
+    void set_element_size(uint32_t size) {
+        std::lock_guard lock{mutex};
+        element_size = size;
+        stride = std::max(element_alignment, (size + element_alignment - 1) & ~(element_alignment - 1));
+    }
+
+    uint32_t get_element_size() {
+        std::lock_guard lock{mutex};
+        return element_size;
+    }
+
+    // Returns a zeroed element.
+    PTR(void) alloc(uint8_t* rdram) {
+        std::lock_guard lock{mutex};
+        if (free_elements.empty()) {
+            uint32_t num_elements = std::max(1u, std::min(next_chunk_elements, max_chunk_bytes / stride));
+            void* mem = recomp::alloc(rdram, num_elements * stride);
+            gpr addr = reinterpret_cast<uint8_t*>(mem) - rdram + 0xFFFFFFFF80000000ULL;
+            chunks.push_back(static_cast<PTR(void)>(addr));
+
+            // Push the elements in reverse so they're handed out in address order.
+            for (uint32_t i = num_elements; i > 0; i--) {
+                free_elements.push_back(static_cast<PTR(void)>(addr + (i - 1) * stride));
+            }
+            capacity += num_elements;
+            chunk_bytes += num_elements * stride;
+            next_chunk_elements *= 2;
+            print_occupancy_locked("grew");
+        }
+
+        PTR(void) ret = free_elements.back();
+        free_elements.pop_back();
+        used++;
+
+        // Zeroing doesn't depend on byte order, so the element can be cleared directly.
+        std::memset(TO_PTR(void, ret), 0, stride);
+        return ret;
+    }
+
+    void free(PTR(void) addr) {
+        std::lock_guard lock{mutex};
+        free_elements.push_back(addr);
+        used--;
+    }
+
+    // Frees every chunk, which invalidates all elements that were allocated from the slab.
+    void release(uint8_t* rdram) {
+        std::lock_guard lock{mutex};
+        if (!chunks.empty()) {
+            print_occupancy_locked("released");
+        }
+        for (PTR(void) chunk : chunks) {
+            recomp::free(rdram, TO_PTR(void, chunk));
+        }
+        chunks.clear();
+        free_elements.clear();
+        free_elements.shrink_to_fit();
+        capacity = 0;
+        used = 0;
+        chunk_bytes = 0;
+        next_chunk_elements = min_chunk_elements;
+    }
+
+    // Snapshots only save the slab's bookkeeping. The chunks themselves live in RDRAM, so restoring a snapshot has to be
+    // paired with restoring the RDRAM (including the recomp heap) from the same point in time.
+    void save(SnapshotWriter& writer) {
+        std::lock_guard lock{mutex};
+        writer.write(element_size);
+        writer.write(stride);
+        writer.write(next_chunk_elements);
+        writer.write<uint64_t>(capacity);
+        writer.write<uint64_t>(used);
+        writer.write<uint64_t>(chunk_bytes);
+        writer.write_vector(chunks);
+        writer.write_vector(free_elements);
+    }
+
+    bool load(SnapshotReader& reader) {
+        std::lock_guard lock{mutex};
+        uint64_t saved_capacity, saved_used, saved_chunk_bytes;
+        if (!reader.read(element_size) || !reader.read(stride) || !reader.read(next_chunk_elements) ||
+            !reader.read(saved_capacity) || !reader.read(saved_used) || !reader.read(saved_chunk_bytes) ||
+            !reader.read_vector(chunks) || !reader.read_vector(free_elements))
+        {
+            return false;
+        }
+        capacity = saved_capacity;
+        used = saved_used;
+        chunk_bytes = saved_chunk_bytes;
+        return stride != 0 && used + free_elements.size() == capacity;
     }
 };
 
 using U32ValueMap = LockedMap<uint32_t, uint32_t>;
-using U32MemoryMap = std::pair<LockedMap<uint32_t, PTR(void)>, u32>;
+using U32MemoryMap = std::pair<LockedMap<uint32_t, PTR(void)>, RdramSlab>;
 using U32HashSet = LockedSet<uint32_t>;
 using U32Slotmap = LockedSlotmap<uint32_t>;
-using MemorySlotmap = std::pair<LockedSlotmap<PTR(void)>, u32>;
+using MemorySlotmap = std::pair<LockedSlotmap<PTR(void)>, RdramSlab>;
 
-LockedSlotmap<U32ValueMap> u32_value_hashmaps{};
-LockedSlotmap<U32MemoryMap> u32_memory_hashmaps{};
-LockedSlotmap<U32HashSet> u32_hashsets{};
-LockedSlotmap<U32Slotmap> u32_slotmaps{};
-LockedSlotmap<MemorySlotmap> memory_slotmaps{};
+HandleTable<U32ValueMap> u32_value_hashmaps{};
+HandleTable<U32MemoryMap> u32_memory_hashmaps{};
+HandleTable<U32HashSet> u32_hashsets{};
+HandleTable<U32Slotmap> u32_slotmaps{};
+HandleTable<MemorySlotmap> memory_slotmaps{};
 
-#define REGISTER_FUNC(name) recomp::overlays::register_base_export(#name, name)
+#define REGISTER_FUNC(name) recomputil::register_timed_export<name>(#name)
 
 static void show_fatal_error_message_box(const char* funcname, const char* errstr) {
     std::string message = std::string{"Fatal error in mod - "} + funcname + " : " + errstr;
@@ -187,6 +974,67 @@ static void show_fatal_error_message_box(const char* funcname, const char* errst
     assert(false); \
     ultramodern::error_handling::quick_exit(__FILE__, __LINE__, __FUNCTION__);
 
+#define ARRAY_INVALID_ERROR() \
+    show_fatal_error_message_box(__FUNCTION__, "array pointer is misaligned"); \
+    assert(false); \
+    ultramodern::error_handling::quick_exit(__FILE__, __LINE__, __FUNCTION__);
+
+// Bulk operations take arrays of u32 keys and values in RDRAM. RDRAM is stored as native-endian 32-bit words, so a
+// word-aligned u32 array can be used directly as a host array without swapping each element.
+static uint32_t* u32_array_ptr(uint8_t* rdram, PTR(uint32_t) addr) {
+    if (addr % sizeof(uint32_t) != 0) {
+        return nullptr;
+    }
+    return TO_PTR(uint32_t, addr);
+}
+
+// Writes one result byte per key to an RDRAM byte array. Bytes are swapped within each word in RDRAM, so full words
+// are assembled on the host and written at once, with MEM_B only used for the unaligned ends of the array.
+class ResultByteWriter {
+private:
+    uint8_t* rdram;
+    gpr addr;
+    size_t count;
+    uint32_t cur_word = 0;
+public:
+    ResultByteWriter(uint8_t* rdram, PTR(uint8_t) addr, size_t count) : rdram(rdram), addr(static_cast<int32_t>(addr)), count(count) {}
+
+    void write(size_t index, bool value) {
+        gpr byte_addr = addr + index;
+        // Unaligned start of the array, or any byte of an array that doesn't fill a whole word.
+        if (((byte_addr - (byte_addr & 3)) < addr) || ((byte_addr | 3) >= addr + count)) {
+            MEM_B(0, byte_addr) = value;
+            return;
+        }
+        // Byte N of a word sits at bit (3 - N) * 8 of the host word.
+        uint32_t shift = (3 - (byte_addr & 3)) * 8;
+        cur_word |= static_cast<uint32_t>(value) << shift;
+        if ((byte_addr & 3) == 3) {
+            MEM_W(0, byte_addr & ~gpr{3}) = cur_word;
+            cur_word = 0;
+        }
+    }
+};
+
+// Iteration exports take a cursor in RDRAM, which is two words that mods zero to start iterating and otherwise leave
+// untouched: the position to resume from and a word of flags, which has cursor_finished set once every entry has been
+// visited. Each call visits up to max_count entries and returns the number visited.
+constexpr uint32_t cursor_finished = 1 << 0;
+constexpr uint32_t cursor_key_order = 1 << 1;
+
+template <typename Container, typename Func>
+static uint32_t iterate_container(Container& container, uint32_t* cursor, uint32_t max_count, Func&& func) {
+    U32IterationCursor position{ cursor[0], (cursor[1] & cursor_key_order) != 0, (cursor[1] & cursor_finished) != 0 };
+    if (position.finished) {
+        return 0;
+    }
+
+    size_t num_visited = container.visit_from(position, max_count, func);
+    cursor[0] = position.position;
+    cursor[1] = (position.finished ? cursor_finished : 0) | (position.key_order ? cursor_key_order : 0);
+    return static_cast<uint32_t>(num_visited);
+}
+
 // u32 -> 32-bit value hashmap.
 
 void recomputil_create_u32_value_hashmap(uint8_t* rdram, recomp_context* ctx) {
@@ -206,8 +1054,8 @@ void recomputil_u32_value_hashmap_contains(uint8_t* rdram, recomp_context* ctx)
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     
-    U32ValueMap* map;
-    if (!u32_value_hashmaps.get(mapkey, &map)) {
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -219,8 +1067,8 @@ void recomputil_u32_value_hashmap_insert(uint8_t* rdram, recomp_context* ctx) {
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     uint32_t value = _arg<2, uint32_t>(rdram, ctx);
 
-    U32ValueMap* map;
-    if (!u32_value_hashmaps.get(mapkey, &map)) {
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -232,8 +1080,8 @@ void recomputil_u32_value_hashmap_get(uint8_t* rdram, recomp_context* ctx) {
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     PTR(uint32_t) val_out = _arg<2, PTR(uint32_t)>(rdram, ctx);
     
-    U32ValueMap* map;
-    if (!u32_value_hashmaps.get(mapkey, &map)) {
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -253,8 +1101,8 @@ void recomputil_u32_value_hashmap_erase(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
 
-    U32ValueMap* map;
-    if (!u32_value_hashmaps.get(mapkey, &map)) {
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -264,14 +1112,117 @@ void recomputil_u32_value_hashmap_erase(uint8_t* rdram, recomp_context* ctx) {
 void recomputil_u32_value_hashmap_size(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
 
-    U32ValueMap* map;
-    if (!u32_value_hashmaps.get(mapkey, &map)) {
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
     _return(ctx, static_cast<uint32_t>(map->size()));
 }
 
+void recomputil_u32_value_hashmap_insert_many(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) keys_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint32_t) values_addr = _arg<2, PTR(uint32_t)>(rdram, ctx);
+    uint32_t count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* keys = u32_array_ptr(rdram, keys_addr);
+    uint32_t* values = u32_array_ptr(rdram, values_addr);
+    if (keys == nullptr || values == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, static_cast<uint32_t>(map->insert_many(keys, values, count)));
+}
+
+void recomputil_u32_value_hashmap_get_many(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) keys_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint32_t) values_out_addr = _arg<2, PTR(uint32_t)>(rdram, ctx);
+    uint32_t count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* keys = u32_array_ptr(rdram, keys_addr);
+    uint32_t* values_out = u32_array_ptr(rdram, values_out_addr);
+    if (keys == nullptr || values_out == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, static_cast<uint32_t>(map->get_many(keys, values_out, count)));
+}
+
+void recomputil_u32_value_hashmap_erase_many(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) keys_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    uint32_t count = _arg<2, uint32_t>(rdram, ctx);
+
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* keys = u32_array_ptr(rdram, keys_addr);
+    if (keys == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, static_cast<uint32_t>(map->erase_many(keys, count)));
+}
+
+void recomputil_u32_value_hashmap_contains_many(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) keys_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint8_t) results_out = _arg<2, PTR(uint8_t)>(rdram, ctx);
+    uint32_t count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* keys = u32_array_ptr(rdram, keys_addr);
+    if (keys == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    ResultByteWriter writer{ rdram, results_out, count };
+    _return(ctx, static_cast<uint32_t>(map->contains_many(keys, count,
+        [&writer](size_t index, bool found) { writer.write(index, found); })));
+}
+
+void recomputil_u32_value_hashmap_iterate(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) cursor_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint32_t) pairs_out_addr = _arg<2, PTR(uint32_t)>(rdram, ctx);
+    uint32_t max_count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto map = u32_value_hashmaps.get(mapkey);
+    if (!map) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* cursor = u32_array_ptr(rdram, cursor_addr);
+    uint32_t* pairs_out = u32_array_ptr(rdram, pairs_out_addr);
+    if (cursor == nullptr || pairs_out == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, iterate_container(*map, cursor, max_count,
+        [&pairs_out](uint32_t key, const auto& value) {
+            *pairs_out++ = key;
+            *pairs_out++ = static_cast<uint32_t>(value);
+        }));
+}
+
 // u32 -> memory hashmap.
 
 void recomputil_create_u32_memory_hashmap(uint8_t* rdram, recomp_context* ctx) {
@@ -281,9 +1232,7 @@ void recomputil_create_u32_memory_hashmap(uint8_t* rdram, recomp_context* ctx) {
     uint32_t map_key = u32_memory_hashmaps.create();
 
     // Retrieve the map and set its element size to the provided value.
-    U32MemoryMap* map;
-    u32_memory_hashmaps.get(map_key, &map);
-    map->second = element_size;
+    u32_memory_hashmaps.get(map_key)->second.set_element_size(element_size);
 
     // Return the created map's key.
     _return(ctx, map_key);
@@ -292,28 +1241,22 @@ void recomputil_create_u32_memory_hashmap(uint8_t* rdram, recomp_context* ctx) {
 void recomputil_destroy_u32_memory_hashmap(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
 
-    // Retrieve the map.
-    U32MemoryMap* map;
-    if (!u32_memory_hashmaps.get(mapkey, &map)) {
+    // Free all of the entries in the map by releasing its arena, then destroy the map itself.
+    bool erased = u32_memory_hashmaps.erase(mapkey, [rdram](U32MemoryMap& map) {
+        map.first.clear();
+        map.second.release(rdram);
+    });
+    if (!erased) {
         HANDLE_INVALID_ERROR();
     }
-
-    // Free all of the entries in the map.
-    PTR(void) cur_mem;
-    while (map->first.erase_first(cur_mem)) {
-        recomp::free(rdram, TO_PTR(void, cur_mem));
-    }
-
-    // Destroy the map itself.
-    u32_memory_hashmaps.erase(mapkey);
 }
 
 void recomputil_u32_memory_hashmap_contains(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     
-    U32MemoryMap* map;
-    if (!u32_memory_hashmaps.get(mapkey, &map)) {
+    auto map = u32_memory_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -324,8 +1267,8 @@ void recomputil_u32_memory_hashmap_create(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
 
-    U32MemoryMap* map;
-    if (!u32_memory_hashmaps.get(mapkey, &map)) {
+    auto map = u32_memory_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
     
@@ -336,16 +1279,8 @@ void recomputil_u32_memory_hashmap_create(uint8_t* rdram, recomp_context* ctx) {
         return;
     }
 
-    // Allocate the map's size and return the pointer.
-    void* mem = recomp::alloc(rdram, map->second);
-    gpr addr = reinterpret_cast<uint8_t*>(mem) - rdram + 0xFFFFFFFF80000000ULL;
-
-    // Zero the memory.
-    for (size_t i = 0; i < map->second; i++) {
-        MEM_B(i, addr) = 0;
-    }
-
-    PTR(void) ret = static_cast<PTR(void)>(addr);
+    // Allocate a zeroed element from the map's arena.
+    PTR(void) ret = map->second.alloc(rdram);
     map->first.insert(key, ret);
     _return(ctx, 1);
 }
@@ -354,8 +1289,8 @@ void recomputil_u32_memory_hashmap_get(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     
-    U32MemoryMap* map;
-    if (!u32_memory_hashmaps.get(mapkey, &map)) {
+    auto map = u32_memory_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -374,33 +1309,56 @@ void recomputil_u32_memory_hashmap_erase(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
 
-    U32MemoryMap* map;
-    if (!u32_memory_hashmaps.get(mapkey, &map)) {
+    auto map = u32_memory_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
     
     // Free the memory for this key if the key exists.
     PTR(void) addr;
-    bool has_value = map->first.get(key, addr);
+    bool has_value = map->first.erase(key, addr);
     if (has_value) {
-        void* mem = TO_PTR(void, addr);
-        recomp::free(rdram, mem);
+        map->second.free(addr);
     }
 
-    _return(ctx, map->first.erase(key));
+    _return(ctx, has_value);
 }
 
 void recomputil_u32_memory_hashmap_size(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
 
-    U32MemoryMap* map;
-    if (!u32_memory_hashmaps.get(mapkey, &map)) {
+    auto map = u32_memory_hashmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
     _return(ctx, static_cast<uint32_t>(map->first.size()));
 }
 
+void recomputil_u32_memory_hashmap_iterate(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) cursor_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint32_t) pairs_out_addr = _arg<2, PTR(uint32_t)>(rdram, ctx);
+    uint32_t max_count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto map = u32_memory_hashmaps.get(mapkey);
+    if (!map) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* cursor = u32_array_ptr(rdram, cursor_addr);
+    uint32_t* pairs_out = u32_array_ptr(rdram, pairs_out_addr);
+    if (cursor == nullptr || pairs_out == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, iterate_container(map->first, cursor, max_count,
+        [&pairs_out](uint32_t key, const auto& value) {
+            *pairs_out++ = key;
+            *pairs_out++ = static_cast<uint32_t>(value);
+        }));
+}
+
 // u32 hashset.
 
 void recomputil_create_u32_hashset(uint8_t* rdram, recomp_context* ctx) {
@@ -420,8 +1378,8 @@ void recomputil_u32_hashset_contains(uint8_t* rdram, recomp_context* ctx) {
     uint32_t setkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     
-    U32HashSet* set;
-    if (!u32_hashsets.get(setkey, &set)) {
+    auto set = u32_hashsets.get(setkey);
+    if (!set) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -432,8 +1390,8 @@ void recomputil_u32_hashset_insert(uint8_t* rdram, recomp_context* ctx) {
     uint32_t setkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
 
-    U32HashSet* set;
-    if (!u32_hashsets.get(setkey, &set)) {
+    auto set = u32_hashsets.get(setkey);
+    if (!set) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -444,8 +1402,8 @@ void recomputil_u32_hashset_erase(uint8_t* rdram, recomp_context* ctx) {
     uint32_t setkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
 
-    U32HashSet* set;
-    if (!u32_hashsets.get(setkey, &set)) {
+    auto set = u32_hashsets.get(setkey);
+    if (!set) {
         HANDLE_INVALID_ERROR();
     }
     
@@ -455,14 +1413,94 @@ void recomputil_u32_hashset_erase(uint8_t* rdram, recomp_context* ctx) {
 void recomputil_u32_hashset_size(uint8_t* rdram, recomp_context* ctx) {
     uint32_t setkey = _arg<0, uint32_t>(rdram, ctx);
 
-    U32HashSet* set;
-    if (!u32_hashsets.get(setkey, &set)) {
+    auto set = u32_hashsets.get(setkey);
+    if (!set) {
         HANDLE_INVALID_ERROR();
     }
 
     _return(ctx, static_cast<uint32_t>(set->size()));
 }
 
+void recomputil_u32_hashset_insert_many(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t setkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) keys_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    uint32_t count = _arg<2, uint32_t>(rdram, ctx);
+
+    auto set = u32_hashsets.get(setkey);
+    if (!set) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* keys = u32_array_ptr(rdram, keys_addr);
+    if (keys == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, static_cast<uint32_t>(set->insert_many(keys, count)));
+}
+
+void recomputil_u32_hashset_erase_many(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t setkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) keys_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    uint32_t count = _arg<2, uint32_t>(rdram, ctx);
+
+    auto set = u32_hashsets.get(setkey);
+    if (!set) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* keys = u32_array_ptr(rdram, keys_addr);
+    if (keys == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, static_cast<uint32_t>(set->erase_many(keys, count)));
+}
+
+void recomputil_u32_hashset_contains_many(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t setkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) keys_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint8_t) results_out = _arg<2, PTR(uint8_t)>(rdram, ctx);
+    uint32_t count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto set = u32_hashsets.get(setkey);
+    if (!set) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* keys = u32_array_ptr(rdram, keys_addr);
+    if (keys == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    ResultByteWriter writer{ rdram, results_out, count };
+    _return(ctx, static_cast<uint32_t>(set->contains_many(keys, count,
+        [&writer](size_t index, bool found) { writer.write(index, found); })));
+}
+
+void recomputil_u32_hashset_iterate(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t setkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) cursor_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint32_t) keys_out_addr = _arg<2, PTR(uint32_t)>(rdram, ctx);
+    uint32_t max_count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto set = u32_hashsets.get(setkey);
+    if (!set) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* cursor = u32_array_ptr(rdram, cursor_addr);
+    uint32_t* keys_out = u32_array_ptr(rdram, keys_out_addr);
+    if (cursor == nullptr || keys_out == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, iterate_container(*set, cursor, max_count,
+        [&keys_out](uint32_t key) {
+            *keys_out++ = key;
+        }));
+}
+
 // u32 value slotmap.
 
 void recomputil_create_u32_slotmap(uint8_t* rdram, recomp_context* ctx) {
@@ -482,8 +1520,8 @@ void recomputil_u32_slotmap_contains(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     
-    U32Slotmap* map;
-    if (!u32_slotmaps.get(mapkey, &map)) {
+    auto map = u32_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -494,8 +1532,8 @@ void recomputil_u32_slotmap_contains(uint8_t* rdram, recomp_context* ctx) {
 void recomputil_u32_slotmap_create(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
 
-    U32Slotmap* map;
-    if (!u32_slotmaps.get(mapkey, &map)) {
+    auto map = u32_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -507,8 +1545,8 @@ void recomputil_u32_slotmap_get(uint8_t* rdram, recomp_context* ctx) {
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     PTR(uint32_t) val_out = _arg<2, PTR(uint32_t)>(rdram, ctx);
     
-    U32Slotmap* map;
-    if (!u32_slotmaps.get(mapkey, &map)) {
+    auto map = u32_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -525,8 +1563,8 @@ void recomputil_u32_slotmap_set(uint8_t* rdram, recomp_context* ctx) {
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     uint32_t value = _arg<2, uint32_t>(rdram, ctx);
 
-    U32Slotmap* map;
-    if (!u32_slotmaps.get(mapkey, &map)) {
+    auto map = u32_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -543,8 +1581,8 @@ void recomputil_u32_slotmap_erase(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
 
-    U32Slotmap* map;
-    if (!u32_slotmaps.get(mapkey, &map)) {
+    auto map = u32_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
     
@@ -558,46 +1596,72 @@ void recomputil_u32_slotmap_erase(uint8_t* rdram, recomp_context* ctx) {
 void recomputil_u32_slotmap_size(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
 
-    U32Slotmap* map;
-    if (!u32_slotmaps.get(mapkey, &map)) {
+    auto map = u32_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
     _return(ctx, static_cast<uint32_t>(map->size()));
 }
 
+void recomputil_u32_slotmap_iterate(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) cursor_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint32_t) pairs_out_addr = _arg<2, PTR(uint32_t)>(rdram, ctx);
+    uint32_t max_count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto map = u32_slotmaps.get(mapkey);
+    if (!map) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* cursor = u32_array_ptr(rdram, cursor_addr);
+    uint32_t* pairs_out = u32_array_ptr(rdram, pairs_out_addr);
+    if (cursor == nullptr || pairs_out == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, iterate_container(*map, cursor, max_count,
+        [&pairs_out](uint32_t key, const auto& value) {
+            *pairs_out++ = key;
+            *pairs_out++ = static_cast<uint32_t>(value);
+        }));
+}
+
 // memory slotmap.
 
 void recomputil_create_memory_slotmap(uint8_t* rdram, recomp_context* ctx) {
-    (void)rdram;
-    _return(ctx, memory_slotmaps.create());
+    uint32_t element_size = _arg<0, uint32_t>(rdram, ctx);
+
+    // Create the map.
+    uint32_t map_key = memory_slotmaps.create();
+
+    // Retrieve the map and set its element size to the provided value.
+    memory_slotmaps.get(map_key)->second.set_element_size(element_size);
+
+    // Return the created map's key.
+    _return(ctx, map_key);
 }
 
 void recomputil_destroy_memory_slotmap(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
 
-    // Retrieve the map.
-    MemorySlotmap* map;
-    if (!memory_slotmaps.get(mapkey, &map)) {
+    // Free all of the entries in the map by releasing its arena, then destroy the map itself.
+    bool erased = memory_slotmaps.erase(mapkey, [rdram](MemorySlotmap& map) {
+        map.first.clear();
+        map.second.release(rdram);
+    });
+    if (!erased) {
         HANDLE_INVALID_ERROR();
     }
-
-    // Free all of the entries in the map.
-    PTR(void) cur_mem;
-    while (map->first.erase_first(cur_mem)) {
-        recomp::free(rdram, TO_PTR(void, cur_mem));
-    }
-
-    // Destroy the map itself.
-    memory_slotmaps.erase(mapkey);
 }
 
 void recomputil_memory_slotmap_contains(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     
-    MemorySlotmap* map;
-    if (!memory_slotmaps.get(mapkey, &map)) {
+    auto map = memory_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -608,27 +1672,21 @@ void recomputil_memory_slotmap_contains(uint8_t* rdram, recomp_context* ctx) {
 void recomputil_memory_slotmap_create(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
 
-    MemorySlotmap* map;
-    if (!memory_slotmaps.get(mapkey, &map)) {
+    auto map = memory_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
     // Create the slotmap element.
     u32 key = map->first.create();
 
-    // Allocate the map's element size.
-    void* mem = recomp::alloc(rdram, map->second);
-    gpr addr = reinterpret_cast<uint8_t*>(mem) - rdram + 0xFFFFFFFF80000000ULL;
-
-    // Zero the memory.
-    for (size_t i = 0; i < map->second; i++) {
-        MEM_B(i, addr) = 0;
-    }
+    // Allocate a zeroed element from the map's arena.
+    PTR(void) addr = map->second.alloc(rdram);
 
     // Store the allocated pointer.
     PTR(void)* value_ptr;
     map->first.get(key, &value_ptr);
-    MEM_W(0, *value_ptr) = addr;
+    *value_ptr = addr;
 
     // Return the key.
     _return(ctx, key);
@@ -639,8 +1697,8 @@ void recomputil_memory_slotmap_get(uint8_t* rdram, recomp_context* ctx) {
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
     PTR(uint32_t) val_out = _arg<2, PTR(uint32_t)>(rdram, ctx);
     
-    MemorySlotmap* map;
-    if (!memory_slotmaps.get(mapkey, &map)) {
+    auto map = memory_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
@@ -655,33 +1713,329 @@ void recomputil_memory_slotmap_erase(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
     uint32_t key = _arg<1, uint32_t>(rdram, ctx);
 
-    MemorySlotmap* map;
-    if (!memory_slotmaps.get(mapkey, &map)) {
+    auto map = memory_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
     
     // Free the memory for this key if the key exists.
-    PTR(void)* addr;
-    bool has_value = map->first.get(key, &addr);
+    PTR(void) addr;
+    bool has_value = map->first.erase(key, addr);
     if (has_value) {
-        void* mem = TO_PTR(void, addr);
-        recomp::free(rdram, mem);
+        map->second.free(addr);
     }
 
-    _return(ctx, map->first.erase(key));
+    _return(ctx, has_value);
 }
 
 void recomputil_memory_slotmap_size(uint8_t* rdram, recomp_context* ctx) {
     uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
 
-    MemorySlotmap* map;
-    if (!memory_slotmaps.get(mapkey, &map)) {
+    auto map = memory_slotmaps.get(mapkey);
+    if (!map) {
         HANDLE_INVALID_ERROR();
     }
 
     _return(ctx, static_cast<uint32_t>(map->first.size()));
 }
 
+void recomputil_memory_slotmap_iterate(uint8_t* rdram, recomp_context* ctx) {
+    uint32_t mapkey = _arg<0, uint32_t>(rdram, ctx);
+    PTR(uint32_t) cursor_addr = _arg<1, PTR(uint32_t)>(rdram, ctx);
+    PTR(uint32_t) pairs_out_addr = _arg<2, PTR(uint32_t)>(rdram, ctx);
+    uint32_t max_count = _arg<3, uint32_t>(rdram, ctx);
+
+    auto map = memory_slotmaps.get(mapkey);
+    if (!map) {
+        HANDLE_INVALID_ERROR();
+    }
+
+    uint32_t* cursor = u32_array_ptr(rdram, cursor_addr);
+    uint32_t* pairs_out = u32_array_ptr(rdram, pairs_out_addr);
+    if (cursor == nullptr || pairs_out == nullptr) {
+        ARRAY_INVALID_ERROR();
+    }
+
+    _return(ctx, iterate_container(map->first, cursor, max_count,
+        [&pairs_out](uint32_t key, const auto& value) {
+            *pairs_out++ = key;
+            *pairs_out++ = static_cast<uint32_t>(value);
+        }));
+}
+
+// Snapshots.
+
+// Snapshot format: char[8] "DM64DAT", u32 version, then each handle table in the order below.
+constexpr char data_snapshot_magic[8] = "DM64DAT";
+constexpr uint32_t data_snapshot_version = 2;
+
+template <typename First, typename Second>
+static void save_pair(SnapshotWriter& writer, std::pair<First, Second>& value) {
+    value.first.save(writer);
+    value.second.save(writer);
+}
+
+template <typename First, typename Second>
+static bool load_pair(SnapshotReader& reader, std::pair<First, Second>& value) {
+    return value.first.load(reader) && value.second.load(reader);
+}
+
+void recomputil::save_data_snapshot(std::vector<uint8_t>& out) {
+    SnapshotWriter writer{ out };
+    writer.write_array(data_snapshot_magic, sizeof(data_snapshot_magic));
+    writer.write(data_snapshot_version);
+
+    u32_value_hashmaps.save(writer, [](SnapshotWriter& writer, U32ValueMap& map) { map.save(writer); });
+    u32_memory_hashmaps.save(writer, [](SnapshotWriter& writer, U32MemoryMap& map) { save_pair(writer, map); });
+    u32_hashsets.save(writer, [](SnapshotWriter& writer, U32HashSet& set) { set.save(writer); });
+    u32_slotmaps.save(writer, [](SnapshotWriter& writer, U32Slotmap& map) { map.save(writer); });
+    memory_slotmaps.save(writer, [](SnapshotWriter& writer, MemorySlotmap& map) { save_pair(writer, map); });
+}
+
+bool recomputil::load_data_snapshot(std::span<const uint8_t> data) {
+    SnapshotReader reader{ data };
+    char magic[sizeof(data_snapshot_magic)];
+    uint32_t version;
+    if (!reader.read_array(magic, sizeof(magic)) || std::memcmp(magic, data_snapshot_magic, sizeof(magic)) != 0 ||
+        !reader.read(version) || version != data_snapshot_version)
+    {
+        printf("Data API snapshot has an unknown format\n");
+        return false;
+    }
+
+    bool success =
+        u32_value_hashmaps.load(reader, [](SnapshotReader& reader, U32ValueMap& map) { return map.load(reader); }) &&
+        u32_memory_hashmaps.load(reader, [](SnapshotReader& reader, U32MemoryMap& map) { return load_pair(reader, map); }) &&
+        u32_hashsets.load(reader, [](SnapshotReader& reader, U32HashSet& set) { return set.load(reader); }) &&
+        u32_slotmaps.load(reader, [](SnapshotReader& reader, U32Slotmap& map) { return map.load(reader); }) &&
+        memory_slotmaps.load(reader, [](SnapshotReader& reader, MemorySlotmap& map) { return load_pair(reader, map); }) &&
+        reader.at_end();
+
+    if (!success) {
+        printf("Data API snapshot is corrupt\n");
+    }
+    return success;
+}
+
+// Telemetry.
+
+template <typename ValueType, typename Func>
+static recomputil::DataContainerStats container_stats(const char* type, HandleTable<ValueType>& table, Func&& get_size) {
+    recomputil::DataContainerStats stats{ type, 0, 0, 0 };
+    table.for_each([&](ValueType& value) {
+        size_t entries = get_size(value);
+        stats.containers++;
+        stats.total_entries += entries;
+        stats.max_entries = std::max(stats.max_entries, entries);
+    });
+    return stats;
+}
+
+std::vector<recomputil::DataContainerStats> recomputil::get_data_container_stats() {
+    return {
+        container_stats("u32 value hashmap", u32_value_hashmaps, [](U32ValueMap& map) { return map.size(); }),
+        container_stats("u32 memory hashmap", u32_memory_hashmaps, [](U32MemoryMap& map) { return map.first.size(); }),
+        container_stats("u32 hashset", u32_hashsets, [](U32HashSet& set) { return set.size(); }),
+        container_stats("u32 slotmap", u32_slotmaps, [](U32Slotmap& map) { return map.size(); }),
+        container_stats("memory slotmap", memory_slotmaps, [](MemorySlotmap& map) { return map.first.size(); }),
+    };
+}
+
+// Benchmarks.
+
+// Measures insert, get and erase throughput of the map backend against std::unordered_map, which the data API
+// containers used previously. Each size is run enough times to perform at least 1M operations per phase.
+template <typename Map, typename Insert, typename Get, typename Erase>
+static void benchmark_map_backend(const std::vector<uint32_t>& keys, const std::vector<uint32_t>& lookup_order,
+    size_t rounds, double mops_out[3], Insert&& insert, Get&& get, Erase&& erase)
+{
+    using clock = std::chrono::steady_clock;
+    double seconds[3] = {};
+    uint32_t checksum = 0;
+
+    for (size_t round = 0; round < rounds; round++) {
+        Map map{};
+
+        auto start = clock::now();
+        for (uint32_t key : keys) {
+            insert(map, key, key ^ 0x5A5A5A5A);
+        }
+        auto after_insert = clock::now();
+        for (uint32_t key : lookup_order) {
+            checksum += get(map, key);
+        }
+        auto after_get = clock::now();
+        for (uint32_t key : lookup_order) {
+            erase(map, key);
+        }
+        auto after_erase = clock::now();
+
+        seconds[0] += std::chrono::duration<double>(after_insert - start).count();
+        seconds[1] += std::chrono::duration<double>(after_get - after_insert).count();
+        seconds[2] += std::chrono::duration<double>(after_erase - after_get).count();
+    }
+
+    double total_ops = static_cast<double>(keys.size()) * rounds;
+    for (size_t i = 0; i < 3; i++) {
+        mops_out[i] = total_ops / seconds[i] / 1e6;
+    }
+
+    // Keep the lookups from being optimized out.
+    if (checksum == 0xFFFFFFFF) {
+        printf(" ");
+    }
+}
+
+std::string recomputil::benchmark_data_containers() {
+    constexpr size_t sizes[] = { 1000, 10000, 100000, 1000000 };
+    constexpr size_t min_ops = 1000000;
+
+    std::mt19937 rng{ 0x5EED };
+    std::string summary;
+    printf("Data API map benchmark (Mops/s, insert / get / erase):\n");
+
+    for (size_t size : sizes) {
+        std::vector<uint32_t> keys(size);
+        for (uint32_t& key : keys) {
+            key = rng();
+        }
+        std::vector<uint32_t> lookup_order = keys;
+        std::shuffle(lookup_order.begin(), lookup_order.end(), rng);
+        size_t rounds = std::max<size_t>(1, min_ops / size);
+
+        double std_mops[3];
+        benchmark_map_backend<std::unordered_map<uint32_t, uint32_t>>(keys, lookup_order, rounds, std_mops,
+            [](auto& map, uint32_t key, uint32_t value) { map.insert_or_assign(key, value); },
+            [](auto& map, uint32_t key) { auto it = map.find(key); return it == map.end() ? 0u : it->second; },
+            [](auto& map, uint32_t key) { map.erase(key); });
+
+        double flat_mops[3];
+        benchmark_map_backend<FlatU32Map<uint32_t>>(keys, lookup_order, rounds, flat_mops,
+            [](auto& map, uint32_t key, uint32_t value) { map.insert_or_assign(key, value); },
+            [](auto& map, uint32_t key) { uint32_t* value = map.find(key); return value == nullptr ? 0u : *value; },
+            [](auto& map, uint32_t key) { map.erase(key); });
+
+        printf("  %7zu entries: unordered_map %6.1f / %6.1f / %6.1f, flat %6.1f / %6.1f / %6.1f\n", size,
+            std_mops[0], std_mops[1], std_mops[2], flat_mops[0], flat_mops[1], flat_mops[2]);
+
+        char line[64];
+        snprintf(line, sizeof(line), "%s%zuK get %.1fx", summary.empty() ? "" : ", ", size / 1000, flat_mops[1] / std_mops[1]);
+        summary += line;
+    }
+
+    return summary;
+}
+
+// Runs the provided read function from several threads at once and returns the combined throughput in Mops/s.
+template <typename Read>
+static double run_contention_benchmark(size_t num_threads, size_t ops_per_thread, Read&& read) {
+    using clock = std::chrono::steady_clock;
+    std::atomic_bool go = false;
+    std::atomic_uint32_t checksum = 0;
+    std::vector<std::thread> threads;
+
+    for (size_t thread_index = 0; thread_index < num_threads; thread_index++) {
+        threads.emplace_back([&, thread_index]() {
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            uint32_t local_checksum = 0;
+            for (size_t i = 0; i < ops_per_thread; i++) {
+                local_checksum += read(thread_index, static_cast<uint32_t>(i));
+            }
+            checksum += local_checksum;
+        });
+    }
+
+    auto start = clock::now();
+    go.store(true);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    // Keep the reads from being optimized out.
+    if (checksum.load() == 0xFFFFFFFF) {
+        printf(" ");
+    }
+    return static_cast<double>(num_threads * ops_per_thread) / seconds / 1e6;
+}
+
+std::string recomputil::benchmark_data_contention() {
+    constexpr size_t thread_counts[] = { 1, 2, 4, 8 };
+    constexpr size_t max_threads = 8;
+    constexpr uint32_t entries_per_map = 4096;
+    constexpr size_t ops_per_thread = 1000000;
+
+    // Every read resolves the map's handle and then looks up a key, the same as recomputil_u32_value_hashmap_get. The
+    // maps live in a table of their own so the benchmark never touches the containers that mods are using.
+    auto table = std::make_unique<HandleTable<U32ValueMap>>();
+    std::array<uint32_t, max_threads> handles;
+    for (uint32_t& handle : handles) {
+        handle = table->create();
+        auto map = table->get(handle);
+        for (uint32_t key = 0; key < entries_per_map; key++) {
+            map->insert(key, key);
+        }
+    }
+
+    // Baseline: a single mutex for handle resolution and an exclusive mutex per map, like the previous implementation.
+    struct ExclusiveMap {
+        std::mutex mutex;
+        FlatU32Map<uint32_t> map;
+    };
+    std::mutex baseline_table_mutex;
+    std::array<ExclusiveMap, max_threads> baseline_maps;
+    for (ExclusiveMap& map : baseline_maps) {
+        for (uint32_t key = 0; key < entries_per_map; key++) {
+            map.map.insert_or_assign(key, key);
+        }
+    }
+
+    auto read_current = [&table, &handles](size_t map_index, uint32_t i) {
+        uint32_t value = 0;
+        if (auto map = table->get(handles[map_index])) {
+            map->get(i % entries_per_map, value);
+        }
+        return value;
+    };
+    auto read_baseline = [&baseline_table_mutex, &baseline_maps](size_t map_index, uint32_t i) {
+        ExclusiveMap* map;
+        {
+            std::lock_guard lock{ baseline_table_mutex };
+            map = &baseline_maps[map_index];
+        }
+        std::lock_guard lock{ map->mutex };
+        uint32_t* value = map->map.find(i % entries_per_map);
+        return value == nullptr ? 0u : *value;
+    };
+
+    std::string summary;
+    printf("Data API contention benchmark (Mops/s, current / previous locking):\n");
+    for (size_t num_threads : thread_counts) {
+        double separate = run_contention_benchmark(num_threads, ops_per_thread,
+            [&](size_t thread_index, uint32_t i) { return read_current(thread_index, i); });
+        double separate_baseline = run_contention_benchmark(num_threads, ops_per_thread,
+            [&](size_t thread_index, uint32_t i) { return read_baseline(thread_index, i); });
+        double shared = run_contention_benchmark(num_threads, ops_per_thread,
+            [&](size_t, uint32_t i) { return read_current(0, i); });
+        double shared_baseline = run_contention_benchmark(num_threads, ops_per_thread,
+            [&](size_t, uint32_t i) { return read_baseline(0, i); });
+
+        printf("  %zu threads: separate maps %6.1f / %6.1f, same map %6.1f / %6.1f\n", num_threads,
+            separate, separate_baseline, shared, shared_baseline);
+
+        if (num_threads == max_threads) {
+            char line[96];
+            snprintf(line, sizeof(line), "%zu threads: separate maps %.1fx, same map %.1fx", num_threads,
+                separate / separate_baseline, shared / shared_baseline);
+            summary = line;
+        }
+    }
+
+    return summary;
+}
+
 // Exports.
 
 void recomputil::register_data_api_exports() {
@@ -692,6 +2046,11 @@ void recomputil::register_data_api_exports() {
     REGISTER_FUNC(recomputil_u32_value_hashmap_get);
     REGISTER_FUNC(recomputil_u32_value_hashmap_erase);
     REGISTER_FUNC(recomputil_u32_value_hashmap_size);
+    REGISTER_FUNC(recomputil_u32_value_hashmap_insert_many);
+    REGISTER_FUNC(recomputil_u32_value_hashmap_get_many);
+    REGISTER_FUNC(recomputil_u32_value_hashmap_erase_many);
+    REGISTER_FUNC(recomputil_u32_value_hashmap_contains_many);
+    REGISTER_FUNC(recomputil_u32_value_hashmap_iterate);
     
     REGISTER_FUNC(recomputil_create_u32_memory_hashmap);
     REGISTER_FUNC(recomputil_destroy_u32_memory_hashmap);
@@ -700,6 +2059,7 @@ void recomputil::register_data_api_exports() {
     REGISTER_FUNC(recomputil_u32_memory_hashmap_get);
     REGISTER_FUNC(recomputil_u32_memory_hashmap_erase);
     REGISTER_FUNC(recomputil_u32_memory_hashmap_size);
+    REGISTER_FUNC(recomputil_u32_memory_hashmap_iterate);
     
     REGISTER_FUNC(recomputil_create_u32_hashset);
     REGISTER_FUNC(recomputil_destroy_u32_hashset);
@@ -707,6 +2067,10 @@ void recomputil::register_data_api_exports() {
     REGISTER_FUNC(recomputil_u32_hashset_insert);
     REGISTER_FUNC(recomputil_u32_hashset_erase);
     REGISTER_FUNC(recomputil_u32_hashset_size);
+    REGISTER_FUNC(recomputil_u32_hashset_insert_many);
+    REGISTER_FUNC(recomputil_u32_hashset_erase_many);
+    REGISTER_FUNC(recomputil_u32_hashset_contains_many);
+    REGISTER_FUNC(recomputil_u32_hashset_iterate);
 
     REGISTER_FUNC(recomputil_create_u32_slotmap);
     REGISTER_FUNC(recomputil_destroy_u32_slotmap);
@@ -716,6 +2080,7 @@ void recomputil::register_data_api_exports() {
     REGISTER_FUNC(recomputil_u32_slotmap_set);
     REGISTER_FUNC(recomputil_u32_slotmap_erase);
     REGISTER_FUNC(recomputil_u32_slotmap_size);
+    REGISTER_FUNC(recomputil_u32_slotmap_iterate);
 
     REGISTER_FUNC(recomputil_create_memory_slotmap);
     REGISTER_FUNC(recomputil_destroy_memory_slotmap);
@@ -724,4 +2089,5 @@ void recomputil::register_data_api_exports() {
     REGISTER_FUNC(recomputil_memory_slotmap_get);
     REGISTER_FUNC(recomputil_memory_slotmap_erase);
     REGISTER_FUNC(recomputil_memory_slotmap_size);
+    REGISTER_FUNC(recomputil_memory_slotmap_iterate);
 }
@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "ultramodern/ultramodern.hpp"
+
+#include "dirty_page_tracker.h"
+#include "recomp_data.h"
+#include "rewind.h"
+#include "zelda_game.h"
+
+// Rewind buffer.
+//
+// While rewind is enabled, a snapshot of the game is captured through the quicksave handshake every few VIs. The newest
+// snapshot's RDRAM is kept in full (the head), and each snapshot before it is only kept as the difference between it
+// and the one after it: the XOR of the two, run-length encoded so that unchanged bytes take no space. XOR is its own
+// inverse, so applying a snapshot's delta to the head turns it back into the previous snapshot.
+//
+// Only pages written since the previous capture can differ from the head, so a capture only has to diff the pages that
+// a DirtyPageTracker reports. While the rewind button is held, each step restores the head into RDRAM and then moves
+// the head back by one snapshot. The oldest snapshots are dropped once the buffer is over its time or memory budget.
+//
+// Delta format: for each changed page, u32 page index, u32 size of the runs that follow, then runs of u16 unchanged
+// bytes to skip, u16 changed byte count, XOR of the changed bytes.
+
+constexpr uint32_t capture_interval_vis = 2;
+constexpr uint32_t step_interval_vis = 2;
+constexpr double vis_per_second = 60.0;
+constexpr double max_seconds = 30.0;
+constexpr size_t max_entries = static_cast<size_t>(max_seconds * vis_per_second / capture_interval_vis);
+// Budget for the deltas, contexts and data API snapshots. The head adds one RDRAM's worth on top of this.
+constexpr size_t max_bytes = 56 * 1024 * 1024;
+// Changed bytes separated by fewer unchanged bytes than this are merged into one run, since a run header costs 4 bytes.
+constexpr size_t min_skip = 8;
+constexpr double stats_interval_seconds = 10.0;
+
+struct RewindEntry {
+    // XOR delta between this entry's RDRAM and the next entry's. Empty for the newest entry, whose RDRAM is the head.
+    std::vector<uint8_t> delta;
+    zelda64::ThreadContexts contexts;
+    std::vector<uint8_t> data;
+
+    size_t bytes() const {
+        return delta.size() + contexts.size() * sizeof(contexts[0]) + data.size();
+    }
+};
+
+static struct {
+    std::mutex mutex;
+    std::atomic_bool enabled = false;
+    std::atomic_bool held = false;
+    // Set while a step is waiting on the handshake, since the threads load the step's contexts before rewind_step runs
+    // and the buffer can't be released under it.
+    bool step_pending = false;
+    bool release_pending = false;
+    uint32_t vi_count = 0;
+    DirtyPageTracker tracker;
+    std::vector<uint8_t> head;
+    // Pages where the head differs from RDRAM without the tracker knowing, because the head was moved back by a step.
+    std::vector<uint8_t> stale_pages;
+    std::deque<RewindEntry> entries;
+    size_t total_bytes = 0;
+    std::vector<uint32_t> pages;
+
+    uint64_t num_captures = 0;
+    double capture_ms_total = 0.0;
+    double capture_ms_max = 0.0;
+    uint64_t num_steps = 0;
+    double step_ms_total = 0.0;
+    std::chrono::steady_clock::time_point last_stats_time;
+} Rewind;
+
+static void write_u16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+static void write_u32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+static uint32_t read_u32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static bool same_u64(const uint8_t* a, const uint8_t* b) {
+    uint64_t a_word, b_word;
+    std::memcpy(&a_word, a, sizeof(a_word));
+    std::memcpy(&b_word, b, sizeof(b_word));
+    return a_word == b_word;
+}
+
+// Appends the delta between one page of RDRAM and the head, then copies the page into the head. Nothing is appended if
+// the page is unchanged.
+static void encode_page(std::vector<uint8_t>& out, uint32_t page, const uint8_t* cur, uint8_t* head, size_t page_size) {
+    size_t header_pos = out.size();
+    write_u32(out, page);
+    write_u32(out, 0);
+    size_t runs_start = out.size();
+
+    size_t pos = 0;
+    while (pos < page_size) {
+        size_t skip_start = pos;
+        while (pos + 8 <= page_size && same_u64(cur + pos, head + pos)) {
+            pos += 8;
+        }
+        while (pos < page_size && cur[pos] == head[pos]) {
+            pos++;
+        }
+        if (pos == page_size) {
+            break;
+        }
+
+        // Extend the changed run until there are at least min_skip unchanged bytes in a row.
+        size_t run_start = pos;
+        size_t run_end = pos;
+        while (pos < page_size && pos - run_end < min_skip && pos - run_start < 0xFFFF) {
+            if (cur[pos] != head[pos]) {
+                run_end = pos + 1;
+            }
+            pos++;
+        }
+        pos = run_end;
+
+        write_u16(out, static_cast<uint16_t>(run_start - skip_start));
+        write_u16(out, static_cast<uint16_t>(run_end - run_start));
+        for (size_t i = run_start; i < run_end; i++) {
+            out.push_back(cur[i] ^ head[i]);
+        }
+    }
+
+    if (out.size() == runs_start) {
+        out.resize(header_pos);
+        return;
+    }
+
+    uint32_t runs_size = static_cast<uint32_t>(out.size() - runs_start);
+    for (int i = 0; i < 4; i++) {
+        out[header_pos + 4 + i] = static_cast<uint8_t>(runs_size >> (i * 8));
+    }
+    std::memcpy(head, cur, page_size);
+}
+
+// Applies a delta to the head, and marks the pages it touched as stale.
+static void apply_delta(const std::vector<uint8_t>& delta, size_t page_size) {
+    size_t pos = 0;
+    while (pos < delta.size()) {
+        uint32_t page = read_u32(&delta[pos]);
+        uint32_t runs_size = read_u32(&delta[pos + 4]);
+        pos += 8;
+        size_t runs_end = pos + runs_size;
+
+        uint8_t* head_page = Rewind.head.data() + static_cast<size_t>(page) * page_size;
+        size_t offset = 0;
+        while (pos < runs_end) {
+            offset += delta[pos] | (delta[pos + 1] << 8);
+            size_t count = delta[pos + 2] | (delta[pos + 3] << 8);
+            pos += 4;
+            for (size_t i = 0; i < count; i++) {
+                head_page[offset + i] ^= delta[pos + i];
+            }
+            offset += count;
+            pos += count;
+        }
+        Rewind.stale_pages[page] = 1;
+    }
+}
+
+// Pages where RDRAM may differ from the head: those written since the last capture or step, plus stale ones.
+static void collect_changed_pages() {
+    Rewind.pages.clear();
+    Rewind.tracker.take_dirty_pages(Rewind.pages);
+    for (uint32_t page : Rewind.pages) {
+        Rewind.stale_pages[page] = 0;
+    }
+    for (size_t page = 0; page < Rewind.stale_pages.size(); page++) {
+        if (Rewind.stale_pages[page] != 0) {
+            Rewind.pages.push_back(static_cast<uint32_t>(page));
+            Rewind.stale_pages[page] = 0;
+        }
+    }
+}
+
+static void drop_oldest_entries() {
+    while (Rewind.entries.size() > 1 && (Rewind.entries.size() > max_entries || Rewind.total_bytes > max_bytes)) {
+        Rewind.total_bytes -= Rewind.entries.front().bytes();
+        Rewind.entries.pop_front();
+    }
+}
+
+static void release_buffer() {
+    Rewind.tracker.stop();
+    Rewind.entries.clear();
+    Rewind.total_bytes = 0;
+    Rewind.head = {};
+    Rewind.stale_pages = {};
+    Rewind.release_pending = false;
+}
+
+static std::string rewind_stats_locked() {
+    double seconds = Rewind.entries.size() * capture_interval_vis / vis_per_second;
+    double mb = (Rewind.total_bytes + Rewind.head.size()) / (1024.0 * 1024.0);
+    double capture_avg = Rewind.num_captures == 0 ? 0.0 : Rewind.capture_ms_total / Rewind.num_captures;
+    double step_avg = Rewind.num_steps == 0 ? 0.0 : Rewind.step_ms_total / Rewind.num_steps;
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%.1f s in %.1f MB, capture %.3f ms avg / %.3f ms max, step %.3f ms avg",
+        seconds, mb, capture_avg, Rewind.capture_ms_max, step_avg);
+    return buf;
+}
+
+void zelda64::rewind_capture(uint8_t* rdram, const std::unordered_map<int32_t, recomp_context>& contexts) {
+    std::lock_guard lock{ Rewind.mutex };
+    if (!Rewind.enabled.load()) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    RewindEntry entry{};
+    entry.contexts.assign(contexts.begin(), contexts.end());
+    recomputil::save_data_snapshot(entry.data);
+
+    if (!Rewind.tracker.is_started()) {
+        // First capture: the head starts out as a full copy and there's nothing to diff against.
+        Rewind.tracker.start(rdram, ultramodern::rdram_size);
+        Rewind.pages.clear();
+        Rewind.tracker.take_dirty_pages(Rewind.pages);
+        Rewind.head.assign(rdram, rdram + ultramodern::rdram_size);
+        Rewind.stale_pages.assign(Rewind.tracker.num_pages(), 0);
+    }
+    else {
+        // The delta belongs to the previous entry, since it turns this snapshot's RDRAM back into the previous one's.
+        collect_changed_pages();
+        std::sort(Rewind.pages.begin(), Rewind.pages.end());
+        std::vector<uint8_t> delta;
+        size_t page_size = Rewind.tracker.page_size();
+        for (uint32_t page : Rewind.pages) {
+            size_t offset = static_cast<size_t>(page) * page_size;
+            encode_page(delta, page, rdram + offset, Rewind.head.data() + offset, page_size);
+        }
+        if (!Rewind.entries.empty()) {
+            RewindEntry& previous = Rewind.entries.back();
+            Rewind.total_bytes += delta.size() - previous.delta.size();
+            previous.delta = std::move(delta);
+        }
+    }
+
+    Rewind.total_bytes += entry.bytes();
+    Rewind.entries.push_back(std::move(entry));
+    drop_oldest_entries();
+
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    Rewind.num_captures++;
+    Rewind.capture_ms_total += elapsed_ms;
+    Rewind.capture_ms_max = std::max(Rewind.capture_ms_max, elapsed_ms);
+}
+
+void zelda64::rewind_step(uint8_t* rdram) {
+    std::lock_guard lock{ Rewind.mutex };
+    Rewind.step_pending = false;
+    if (Rewind.entries.empty()) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t page_size = Rewind.tracker.page_size();
+
+    // Put RDRAM back to the newest snapshot. The restored pages are reported by the tracker again, which is harmless.
+    collect_changed_pages();
+    for (uint32_t page : Rewind.pages) {
+        size_t offset = static_cast<size_t>(page) * page_size;
+        std::memcpy(rdram + offset, Rewind.head.data() + offset, page_size);
+    }
+    recomputil::load_data_snapshot(Rewind.entries.back().data);
+
+    // Move the head back to the previous snapshot for the next step. The oldest snapshot stays as the floor.
+    if (Rewind.entries.size() > 1) {
+        Rewind.total_bytes -= Rewind.entries.back().bytes();
+        Rewind.entries.pop_back();
+        RewindEntry& previous = Rewind.entries.back();
+        apply_delta(previous.delta, page_size);
+        Rewind.total_bytes -= previous.delta.size();
+        previous.delta.clear();
+    }
+
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    Rewind.num_steps++;
+    Rewind.step_ms_total += elapsed_ms;
+
+    if (Rewind.release_pending) {
+        release_buffer();
+    }
+}
+
+void zelda64::rewind_step_cancelled() {
+    std::lock_guard lock{ Rewind.mutex };
+    Rewind.step_pending = false;
+    if (Rewind.release_pending) {
+        release_buffer();
+    }
+}
+
+void zelda64::set_rewind_enabled(bool enabled) {
+    std::lock_guard lock{ Rewind.mutex };
+    if (Rewind.enabled.exchange(enabled) == enabled) {
+        return;
+    }
+
+    if (enabled) {
+        Rewind.release_pending = false;
+        Rewind.vi_count = 0;
+        Rewind.num_captures = 0;
+        Rewind.capture_ms_total = 0.0;
+        Rewind.capture_ms_max = 0.0;
+        Rewind.num_steps = 0;
+        Rewind.step_ms_total = 0.0;
+        Rewind.last_stats_time = std::chrono::steady_clock::now();
+        printf("Rewind enabled\n");
+    }
+    else {
+        printf("Rewind disabled: %s\n", rewind_stats_locked().c_str());
+        if (Rewind.step_pending) {
+            Rewind.release_pending = true;
+        }
+        else {
+            release_buffer();
+        }
+    }
+}
+
+bool zelda64::get_rewind_enabled() {
+    return Rewind.enabled.load();
+}
+
+void zelda64::set_rewind_held(bool held) {
+    Rewind.held.store(held);
+}
+
+std::string zelda64::get_rewind_stats() {
+    std::lock_guard lock{ Rewind.mutex };
+    return rewind_stats_locked();
+}
+
+void zelda64::rewind_on_vi() {
+    if (!Rewind.enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Skip this VI rather than hold up the VI thread while a capture or step is running.
+    std::unique_lock lock{ Rewind.mutex, std::try_to_lock };
+    if (!lock.owns_lock()) {
+        return;
+    }
+    Rewind.vi_count++;
+    if (Rewind.held.load()) {
+        if (Rewind.vi_count % step_interval_vis == 0 && !Rewind.step_pending && !Rewind.entries.empty()) {
+            Rewind.step_pending = request_rewind_step(Rewind.entries.back().contexts);
+        }
+    }
+    else if (Rewind.vi_count % capture_interval_vis == 0) {
+        request_rewind_capture();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - Rewind.last_stats_time).count() >= stats_interval_seconds) {
+        printf("Rewind: %s\n", rewind_stats_locked().c_str());
+        Rewind.last_stats_time = now;
+    }
+}
@@ -0,0 +1,111 @@
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+#include "json/json.hpp"
+#include "librecomp/game.hpp"
+
+#include "zelda_config.h"
+#include "zelda_game.h"
+
+// Cache of verified ROMs.
+//
+// Checking the stored ROM means reading the whole file and hashing it, which the launcher used to do on every start.
+// Once a ROM has passed the runtime's check, its size and modification time are saved in rom_cache.json in the app
+// folder together with the hash it matched, keyed by its path. Later starts only compare the file's size and
+// modification time against that entry, and do the full check again if either changed or the supported hash did.
+
+static std::filesystem::path stored_rom_path(const std::u8string& game_id) {
+    return zelda64::get_app_folder_path() / (game_id + u8".z64");
+}
+
+static std::filesystem::path rom_cache_path() {
+    return zelda64::get_app_folder_path() / "rom_cache.json";
+}
+
+static std::string rom_cache_key(const std::filesystem::path& path) {
+    std::u8string utf8 = path.u8string();
+    return std::string{ reinterpret_cast<const char*>(utf8.data()), utf8.size() };
+}
+
+static bool get_rom_stamp(const std::filesystem::path& path, uint64_t& size, int64_t& mtime) {
+    std::error_code ec;
+    size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        return false;
+    }
+    mtime = static_cast<int64_t>(time.time_since_epoch().count());
+    return true;
+}
+
+static nlohmann::json load_rom_cache() {
+    std::ifstream file{ rom_cache_path() };
+    if (!file.good()) {
+        return nlohmann::json::object();
+    }
+    nlohmann::json json = nlohmann::json::parse(file, nullptr, false);
+    if (json.is_discarded() || !json.is_object()) {
+        return nlohmann::json::object();
+    }
+    return json;
+}
+
+void zelda64::record_verified_rom(const std::u8string& game_id) {
+    std::filesystem::path path = stored_rom_path(game_id);
+    uint64_t size;
+    int64_t mtime;
+    if (!get_rom_stamp(path, size, mtime)) {
+        return;
+    }
+
+    nlohmann::json json = load_rom_cache();
+    nlohmann::json entry{};
+    entry["size"] = size;
+    entry["mtime"] = mtime;
+    entry["hash"] = rom_hash;
+    json[rom_cache_key(path)] = std::move(entry);
+
+    std::ofstream file{ rom_cache_path() };
+    file << std::setw(4) << json;
+    if (!file.good()) {
+        printf("Failed to write %s\n", rom_cache_path().string().c_str());
+    }
+}
+
+bool zelda64::is_stored_rom_valid(const std::u8string& game_id) {
+    auto start = std::chrono::steady_clock::now();
+    auto ms_since_start = [&start]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::filesystem::path path = stored_rom_path(game_id);
+    uint64_t size;
+    int64_t mtime;
+    if (get_rom_stamp(path, size, mtime)) {
+        nlohmann::json json = load_rom_cache();
+        auto find_it = json.find(rom_cache_key(path));
+        if (find_it != json.end() && find_it->is_object() &&
+            find_it->value("size", uint64_t{0}) == size &&
+            find_it->value("mtime", int64_t{0}) == mtime &&
+            find_it->value("hash", uint64_t{0}) == rom_hash)
+        {
+            printf("ROM check: cached, %.2f ms\n", ms_since_start());
+            return true;
+        }
+    }
+
+    bool valid = recomp::is_rom_valid(game_id);
+    if (valid) {
+        record_verified_rom(game_id);
+    }
+    printf("ROM check: full, %.2f ms\n", ms_since_start());
+    return valid;
+}
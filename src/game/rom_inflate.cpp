@@ -0,0 +1,559 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "recomp.h"
+#include "librecomp/game.hpp"
+#include "librecomp/helpers.hpp"
+
+#include "zelda_config.h"
+
+// Native inflate for compressed ROM segments.
+//
+// Most of the game's assets are stored in ROM as gzip files and inflated by expand_gzip (through DecompressRomToRam
+// and DmaData_RomToRam) every time a scene loads. The recompiled version DMAs the segment through a small buffer in
+// RDRAM and decodes it a bit at a time through the emulated registers. A hook at the start of expand_gzip calls
+// recomp_inflate_rom_gzip instead, which reads the segment straight from the ROM image, inflates it into a host buffer
+// with table based Huffman decoding and then copies the output into RDRAM.
+//
+// The output is only copied if it inflated cleanly and matches the CRC and size in the gzip trailer. Otherwise the
+// failure is logged and the original expand_gzip runs as if there were no hook, so a segment the native inflater can't
+// handle loads slowly instead of corrupt. In debug mode every segment is also inflated by the original and compared
+// against the native output, and the original's output is the one the game gets.
+
+namespace {
+    constexpr uint32_t gzip_header_size = 10;
+    constexpr uint32_t gzip_trailer_size = 8;
+    constexpr uint8_t gzip_flag_hcrc = 0x02;
+    constexpr uint8_t gzip_flag_extra = 0x04;
+    constexpr uint8_t gzip_flag_name = 0x08;
+    constexpr uint8_t gzip_flag_comment = 0x10;
+
+    // Bigger than anything the game loads, so a corrupt segment can't write past the end of RDRAM.
+    constexpr size_t max_output_size = 0x800000;
+
+    constexpr int max_code_bits = 15;
+    constexpr int fast_bits = 10;
+    constexpr int num_literal_codes = 288;
+    constexpr int num_distance_codes = 30;
+    constexpr int num_code_length_codes = 19;
+
+    constexpr std::array<uint16_t, 29> length_base = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    constexpr std::array<uint8_t, 29> length_extra = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    constexpr std::array<uint16_t, 30> distance_base = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    constexpr std::array<uint8_t, 30> distance_extra = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+    constexpr std::array<uint8_t, num_code_length_codes> code_length_order = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+
+    constexpr std::array<uint32_t, 256> make_crc_table() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        return table;
+    }
+    constexpr std::array<uint32_t, 256> crc_table = make_crc_table();
+
+    uint32_t crc32(std::span<const uint8_t> data) {
+        uint32_t crc = 0xFFFFFFFFu;
+        for (uint8_t byte : data) {
+            crc = crc_table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    // LSB-first bit reader. Reading past the end of the input returns zero bits and sets overrun.
+    class BitReader {
+    public:
+        BitReader(std::span<const uint8_t> input, size_t pos) : input(input), pos(pos) {}
+
+        void refill() {
+            while (count <= 56) {
+                uint64_t byte = 0;
+                if (pos < input.size()) {
+                    byte = input[pos];
+                }
+                else {
+                    past_end++;
+                }
+                pos++;
+                bits |= byte << count;
+                count += 8;
+            }
+        }
+
+        uint32_t peek(int n) {
+            if (count < n) {
+                refill();
+            }
+            return static_cast<uint32_t>(bits & ((uint64_t{1} << n) - 1));
+        }
+
+        void consume(int n) {
+            bits >>= n;
+            count -= n;
+        }
+
+        uint32_t read(int n) {
+            uint32_t ret = peek(n);
+            consume(n);
+            return ret;
+        }
+
+        void align_to_byte() {
+            consume(count % 8);
+        }
+
+        // Position of the next unread byte. Only meaningful after align_to_byte.
+        size_t byte_pos() const {
+            return pos - count / 8;
+        }
+
+        bool overrun() const {
+            // Bytes that were only buffered and never consumed don't count.
+            return past_end * 8 > static_cast<size_t>(count);
+        }
+
+    private:
+        std::span<const uint8_t> input;
+        size_t pos;
+        uint64_t bits = 0;
+        int count = 0;
+        size_t past_end = 0;
+    };
+
+    // Canonical Huffman decoder. Codes up to fast_bits long are decoded with a single table lookup, longer ones
+    // are walked a bit at a time from the per-length counts.
+    class HuffmanTable {
+    public:
+        bool build(const uint8_t* lengths, int num_symbols) {
+            counts.fill(0);
+            for (int i = 0; i < num_symbols; i++) {
+                counts[lengths[i]]++;
+            }
+            counts[0] = 0;
+
+            // Reject over-subscribed code sets. Incomplete ones are allowed, as they're legal for a single distance code.
+            int left = 1;
+            for (int len = 1; len <= max_code_bits; len++) {
+                left <<= 1;
+                left -= counts[len];
+                if (left < 0) {
+                    return false;
+                }
+            }
+
+            std::array<uint16_t, max_code_bits + 1> offsets{};
+            for (int len = 1; len < max_code_bits; len++) {
+                offsets[len + 1] = offsets[len] + counts[len];
+            }
+            for (int i = 0; i < num_symbols; i++) {
+                if (lengths[i] != 0) {
+                    symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+                }
+            }
+
+            fast.fill(0);
+            uint32_t code = 0;
+            int index = 0;
+            for (int len = 1; len <= fast_bits; len++) {
+                for (int i = 0; i < counts[len]; i++, index++, code++) {
+                    // Codes are stored MSB first but read LSB first, so the table is indexed by the reversed code.
+                    uint32_t reversed = 0;
+                    for (int bit = 0; bit < len; bit++) {
+                        reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+                    }
+                    uint16_t entry = static_cast<uint16_t>((symbols[index] << 4) | len);
+                    for (uint32_t j = reversed; j < fast.size(); j += 1u << len) {
+                        fast[j] = entry;
+                    }
+                }
+                code <<= 1;
+            }
+            return true;
+        }
+
+        // Returns the decoded symbol, or -1 if the bits don't form a code.
+        int decode(BitReader& reader) const {
+            uint32_t bits = reader.peek(max_code_bits);
+            uint16_t entry = fast[bits & ((1u << fast_bits) - 1)];
+            if (entry != 0) {
+                reader.consume(entry & 0xF);
+                return entry >> 4;
+            }
+
+            int code = 0;
+            int first = 0;
+            int index = 0;
+            for (int len = 1; len <= max_code_bits; len++) {
+                code |= (bits >> (len - 1)) & 1;
+                int count = counts[len];
+                if (code - count < first) {
+                    reader.consume(len);
+                    return symbols[index + (code - first)];
+                }
+                index += count;
+                first += count;
+                first <<= 1;
+                code <<= 1;
+            }
+            return -1;
+        }
+
+    private:
+        std::array<uint16_t, 1 << fast_bits> fast;
+        std::array<uint16_t, max_code_bits + 1> counts;
+        std::array<uint16_t, num_literal_codes> symbols;
+    };
+
+    class Inflater {
+    public:
+        Inflater(std::span<const uint8_t> input, size_t pos, std::vector<uint8_t>& output) : reader(input, pos), output(output) {}
+
+        bool run() {
+            bool last_block;
+            do {
+                last_block = reader.read(1) != 0;
+                uint32_t type = reader.read(2);
+                bool ok;
+                switch (type) {
+                case 0:
+                    ok = stored_block();
+                    break;
+                case 1:
+                    ok = fixed_block();
+                    break;
+                case 2:
+                    ok = dynamic_block();
+                    break;
+                default:
+                    ok = false;
+                    break;
+                }
+                if (!ok || reader.overrun()) {
+                    return false;
+                }
+            } while (!last_block);
+            return true;
+        }
+
+        // Position of the first byte after the deflate stream.
+        size_t end_pos() {
+            reader.align_to_byte();
+            return reader.byte_pos();
+        }
+
+    private:
+        BitReader reader;
+        std::vector<uint8_t>& output;
+        HuffmanTable literals;
+        HuffmanTable distances;
+
+        bool stored_block() {
+            reader.align_to_byte();
+            uint32_t length = reader.read(16);
+            uint32_t inverse = reader.read(16);
+            if ((length ^ 0xFFFF) != inverse) {
+                return false;
+            }
+            if (output.size() + length > max_output_size) {
+                return false;
+            }
+            for (uint32_t i = 0; i < length; i++) {
+                output.push_back(static_cast<uint8_t>(reader.read(8)));
+            }
+            return true;
+        }
+
+        bool fixed_block() {
+            static const std::pair<HuffmanTable, HuffmanTable> fixed_tables = [] {
+                std::pair<HuffmanTable, HuffmanTable> tables;
+                std::array<uint8_t, num_literal_codes> lengths;
+                std::fill(lengths.begin(), lengths.begin() + 144, 8);
+                std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+                std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+                std::fill(lengths.begin() + 280, lengths.end(), 8);
+                tables.first.build(lengths.data(), num_literal_codes);
+                std::fill(lengths.begin(), lengths.begin() + num_distance_codes, 5);
+                tables.second.build(lengths.data(), num_distance_codes);
+                return tables;
+            }();
+            return codes(fixed_tables.first, fixed_tables.second);
+        }
+
+        bool dynamic_block() {
+            uint32_t num_literals = reader.read(5) + 257;
+            uint32_t num_distances = reader.read(5) + 1;
+            uint32_t num_code_lengths = reader.read(4) + 4;
+            if (num_literals > 286 || num_distances > num_distance_codes) {
+                return false;
+            }
+
+            std::array<uint8_t, num_literal_codes + num_distance_codes> lengths{};
+            for (uint32_t i = 0; i < num_code_lengths; i++) {
+                lengths[code_length_order[i]] = static_cast<uint8_t>(reader.read(3));
+            }
+            HuffmanTable code_lengths;
+            if (!code_lengths.build(lengths.data(), num_code_length_codes)) {
+                return false;
+            }
+
+            uint32_t index = 0;
+            lengths.fill(0);
+            while (index < num_literals + num_distances) {
+                int symbol = code_lengths.decode(reader);
+                if (symbol < 0) {
+                    return false;
+                }
+                if (symbol < 16) {
+                    lengths[index++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+
+                uint8_t value = 0;
+                uint32_t repeat;
+                if (symbol == 16) {
+                    if (index == 0) {
+                        return false;
+                    }
+                    value = lengths[index - 1];
+                    repeat = 3 + reader.read(2);
+                }
+                else if (symbol == 17) {
+                    repeat = 3 + reader.read(3);
+                }
+                else {
+                    repeat = 11 + reader.read(7);
+                }
+                if (index + repeat > num_literals + num_distances) {
+                    return false;
+                }
+                std::fill_n(lengths.begin() + index, repeat, value);
+                index += repeat;
+            }
+
+            // The end of block code has to be present.
+            if (lengths[256] == 0) {
+                return false;
+            }
+            if (!literals.build(lengths.data(), num_literals) || !distances.build(lengths.data() + num_literals, num_distances)) {
+                return false;
+            }
+            return codes(literals, distances);
+        }
+
+        bool codes(const HuffmanTable& literal_table, const HuffmanTable& distance_table) {
+            while (true) {
+                int symbol = literal_table.decode(reader);
+                if (symbol < 0) {
+                    return false;
+                }
+                if (symbol < 256) {
+                    if (output.size() == max_output_size) {
+                        return false;
+                    }
+                    output.push_back(static_cast<uint8_t>(symbol));
+                    continue;
+                }
+                if (symbol == 256) {
+                    return true;
+                }
+
+                symbol -= 257;
+                if (symbol >= static_cast<int>(length_base.size())) {
+                    return false;
+                }
+                uint32_t length = length_base[symbol] + reader.read(length_extra[symbol]);
+
+                int distance_symbol = distance_table.decode(reader);
+                if (distance_symbol < 0 || distance_symbol >= num_distance_codes) {
+                    return false;
+                }
+                uint32_t distance = distance_base[distance_symbol] + reader.read(distance_extra[distance_symbol]);
+                if (distance > output.size() || output.size() + length > max_output_size) {
+                    return false;
+                }
+
+                size_t start = output.size();
+                output.resize(start + length);
+                uint8_t* dst = output.data() + start;
+                const uint8_t* src = dst - distance;
+                if (distance >= length) {
+                    memcpy(dst, src, length);
+                }
+                else {
+                    // Overlapping copies repeat the last distance bytes, so they have to go a byte at a time.
+                    for (uint32_t i = 0; i < length; i++) {
+                        dst[i] = src[i];
+                    }
+                }
+            }
+        }
+    };
+
+    uint32_t read_u32_le(std::span<const uint8_t> data, size_t pos) {
+        return data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) | (static_cast<uint32_t>(data[pos + 3]) << 24);
+    }
+
+    // Returns the offset of the deflate stream in a gzip file, or 0 if the header isn't valid.
+    size_t skip_gzip_header(std::span<const uint8_t> input) {
+        if (input.size() < gzip_header_size + gzip_trailer_size || input[0] != 0x1F || input[1] != 0x8B || input[2] != 8) {
+            return 0;
+        }
+        uint8_t flags = input[3];
+        size_t pos = gzip_header_size;
+        if (flags & gzip_flag_extra) {
+            if (pos + 2 > input.size()) {
+                return 0;
+            }
+            pos += 2 + (input[pos] | (input[pos + 1] << 8));
+        }
+        for (uint8_t flag : { gzip_flag_name, gzip_flag_comment }) {
+            if (flags & flag) {
+                while (pos < input.size() && input[pos] != 0) {
+                    pos++;
+                }
+                pos++;
+            }
+        }
+        if (flags & gzip_flag_hcrc) {
+            pos += 2;
+        }
+        return pos < input.size() ? pos : 0;
+    }
+
+    struct {
+        std::mutex mutex;
+        uint64_t segments = 0;
+        double total_ms = 0.0;
+    } inflate_stats;
+}
+
+// The recompiled original.
+extern "C" void expand_gzip(uint8_t* rdram, recomp_context* ctx);
+
+// Compares the original's output in RDRAM against the native output.
+static void compare_with_original(uint8_t* rdram, gpr dst, uint32_t rom_offset, const std::vector<uint8_t>& output, uint32_t original_size) {
+    if (original_size != output.size()) {
+        printf("Inflate mismatch in segment 0x%08X: original size 0x%X, native size 0x%zX\n", rom_offset, original_size, output.size());
+        return;
+    }
+    for (size_t i = 0; i < output.size(); i++) {
+        uint8_t original = static_cast<uint8_t>(MEM_B(i, dst));
+        if (original != output[i]) {
+            printf("Inflate mismatch in segment 0x%08X at offset 0x%zX: original 0x%02X, native 0x%02X\n", rom_offset, i,
+                original, output[i]);
+            return;
+        }
+    }
+    printf("Inflate check: segment 0x%08X (0x%zX bytes) matches the original\n", rom_offset, output.size());
+}
+
+// Called at the start of expand_gzip. Returns nonzero if the segment was inflated, in which case expand_gzip returns
+// right away with the decompressed size, and zero to let the original run.
+extern "C" int recomp_inflate_rom_gzip(uint8_t* rdram, recomp_context* ctx) {
+    // Set while the original runs for a debug comparison, which goes through this hook again.
+    thread_local bool running_original = false;
+    if (running_original) {
+        return 0;
+    }
+
+    uint32_t rom_offset = _arg<0, u32>(rdram, ctx);
+    gpr dst = ctx->r5;
+    uint32_t compressed_size = _arg<2, u32>(rdram, ctx);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::span<const uint8_t> rom = recomp::get_rom();
+    if (rom_offset > rom.size() || compressed_size > rom.size() - rom_offset) {
+        printf("Compressed segment 0x%08X (0x%X bytes) is outside of the ROM, using the original inflate\n", rom_offset, compressed_size);
+        return 0;
+    }
+    std::span<const uint8_t> input = rom.subspan(rom_offset, compressed_size);
+
+    size_t data_pos = skip_gzip_header(input);
+    if (data_pos == 0) {
+        printf("Compressed segment 0x%08X has no gzip header, using the original inflate\n", rom_offset);
+        return 0;
+    }
+
+    // Reused between calls so scene loads don't reallocate the buffer. Segments can be inflated from different threads.
+    thread_local std::vector<uint8_t> output;
+    output.clear();
+    output.reserve(std::min<size_t>(read_u32_le(input, input.size() - 4), max_output_size));
+
+    Inflater inflater{ input, data_pos, output };
+    bool ok = inflater.run();
+    size_t trailer_pos = inflater.end_pos();
+    if (!ok) {
+        printf("Failed to inflate compressed segment 0x%08X after 0x%zX bytes, using the original inflate\n", rom_offset, output.size());
+        return 0;
+    }
+    if (trailer_pos + gzip_trailer_size > input.size()) {
+        printf("Compressed segment 0x%08X has no gzip trailer, using the original inflate\n", rom_offset);
+        return 0;
+    }
+    uint32_t expected_crc = read_u32_le(input, trailer_pos);
+    uint32_t expected_size = read_u32_le(input, trailer_pos + 4);
+    if (expected_size != static_cast<uint32_t>(output.size()) || expected_crc != crc32(output)) {
+        printf("Compressed segment 0x%08X doesn't match its gzip trailer, using the original inflate\n", rom_offset);
+        return 0;
+    }
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    size_t size = output.size();
+    {
+        std::lock_guard lock{ inflate_stats.mutex };
+        inflate_stats.segments++;
+        inflate_stats.total_ms += elapsed_ms;
+        if (zelda64::get_debug_mode_enabled()) {
+            printf("Inflated segment 0x%08X (0x%X -> 0x%zX bytes) in %.2f ms, %" PRIu64 " segments in %.2f ms total\n",
+                rom_offset, compressed_size, size, elapsed_ms, inflate_stats.segments, inflate_stats.total_ms);
+        }
+    }
+
+    if (zelda64::get_debug_mode_enabled()) {
+        running_original = true;
+        expand_gzip(rdram, ctx);
+        running_original = false;
+        compare_with_original(rdram, dst, rom_offset, output, static_cast<uint32_t>(ctx->r2));
+        return 1;
+    }
+
+    // RDRAM is stored in byteswapped words, so write whole words when the destination is aligned.
+    size_t i = 0;
+    if ((dst & 3) == 0) {
+        for (; i + 4 <= size; i += 4) {
+            MEM_W(i, dst) = static_cast<int32_t>((output[i] << 24) | (output[i + 1] << 16) | (output[i + 2] << 8) | output[i + 3]);
+        }
+    }
+    for (; i < size; i++) {
+        MEM_B(i, dst) = static_cast<int8_t>(output[i]);
+    }
+
+    _return(ctx, static_cast<u32>(size));
+    return 1;
+}
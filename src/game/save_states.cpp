@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "save_states.h"
+#include "zelda_game.h"
+
+// See save_states.h for the file format.
+
+constexpr char save_state_magic[8] = "DM64SST";
+constexpr uint32_t save_state_version = 1;
+constexpr uint32_t save_state_block_size = 64 * 1024;
+constexpr uint32_t stored_block_flag = 0x80000000;
+// Images kept around for reuse, enough for a save to be taken while the previous one is still being written.
+constexpr size_t max_free_images = 2;
+
+// Block compressor.
+//
+// Uses the LZ4 block format: each sequence is a token byte (literal count in the high nibble, match length minus 4 in
+// the low nibble, 15 meaning more length bytes follow), the literals, a u16 little-endian match offset and the extra
+// match length bytes. The last sequence has no match. Matches are found with a single-entry hash table of 4-byte
+// sequences, which is fast and does well on RDRAM, where most of the size is zeroed or repeated data. Blocks are at most
+// 64KiB, so offsets always fit in a u16.
+
+constexpr uint32_t min_match = 4;
+constexpr uint32_t hash_bits = 12;
+
+static uint32_t read_u32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t sequence_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - hash_bits);
+}
+
+static void write_length(uint8_t* dst, size_t& out, size_t length) {
+    while (length >= 255) {
+        dst[out++] = 255;
+        length -= 255;
+    }
+    dst[out++] = static_cast<uint8_t>(length);
+}
+
+static void write_sequence(uint8_t* dst, size_t& out, const uint8_t* literals, size_t num_literals, size_t offset, size_t match_length) {
+    uint8_t& token = dst[out++];
+    token = static_cast<uint8_t>(std::min<size_t>(num_literals, 15) << 4);
+    if (num_literals >= 15) {
+        write_length(dst, out, num_literals - 15);
+    }
+    std::memcpy(dst + out, literals, num_literals);
+    out += num_literals;
+
+    if (match_length == 0) {
+        return;
+    }
+
+    dst[out++] = static_cast<uint8_t>(offset);
+    dst[out++] = static_cast<uint8_t>(offset >> 8);
+    size_t extra_length = match_length - min_match;
+    token |= static_cast<uint8_t>(std::min<size_t>(extra_length, 15));
+    if (extra_length >= 15) {
+        write_length(dst, out, extra_length - 15);
+    }
+}
+
+size_t zelda64::max_compressed_size(size_t src_size) {
+    return src_size + src_size / 255 + 16;
+}
+
+size_t zelda64::compress_block(std::span<const uint8_t> src, uint8_t* dst, std::vector<uint32_t>& hash_table) {
+    const uint8_t* data = src.data();
+    size_t size = src.size();
+    size_t out = 0;
+    size_t anchor = 0;
+
+    if (size > min_match) {
+        hash_table.assign(size_t{1} << hash_bits, 0);
+        size_t pos = 0;
+        while (pos + min_match <= size) {
+            uint32_t sequence = read_u32(data + pos);
+            uint32_t& entry = hash_table[sequence_hash(sequence)];
+            size_t candidate = entry;
+            entry = static_cast<uint32_t>(pos);
+
+            if (candidate >= pos || pos - candidate > 0xFFFF || read_u32(data + candidate) != sequence) {
+                // Skip ahead faster the longer it's been since the last match, so incompressible data is cheap.
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+
+            size_t match_length = min_match;
+            while (pos + match_length < size && data[candidate + match_length] == data[pos + match_length]) {
+                match_length++;
+            }
+
+            write_sequence(dst, out, data + anchor, pos - anchor, pos - candidate, match_length);
+            pos += match_length;
+            anchor = pos;
+        }
+    }
+
+    write_sequence(dst, out, data + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+bool zelda64::decompress_block(std::span<const uint8_t> src, std::span<uint8_t> dst) {
+    size_t in = 0;
+    size_t out = 0;
+
+    auto read_length = [&](size_t& length) {
+        uint8_t byte;
+        do {
+            if (in >= src.size()) {
+                return false;
+            }
+            byte = src[in++];
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+
+    while (true) {
+        if (in >= src.size()) {
+            return false;
+        }
+        uint8_t token = src[in++];
+
+        size_t num_literals = token >> 4;
+        if (num_literals == 15 && !read_length(num_literals)) {
+            return false;
+        }
+        if (num_literals > src.size() - in || num_literals > dst.size() - out) {
+            return false;
+        }
+        std::memcpy(dst.data() + out, src.data() + in, num_literals);
+        in += num_literals;
+        out += num_literals;
+
+        // The last sequence has no match and ends the block.
+        if (out == dst.size()) {
+            return in == src.size();
+        }
+
+        if (src.size() - in < 2) {
+            return false;
+        }
+        size_t offset = src[in] | (src[in + 1] << 8);
+        in += 2;
+        size_t match_length = (token & 15) + min_match;
+        if ((token & 15) == 15 && !read_length(match_length)) {
+            return false;
+        }
+        if (offset == 0 || offset > out || match_length > dst.size() - out) {
+            return false;
+        }
+
+        uint8_t* match_dst = dst.data() + out;
+        const uint8_t* match_src = match_dst - offset;
+        if (offset >= match_length) {
+            std::memcpy(match_dst, match_src, match_length);
+        }
+        else {
+            // Overlapping match, which repeats the last offset bytes.
+            for (size_t i = 0; i < match_length; i++) {
+                match_dst[i] = match_src[i];
+            }
+        }
+        out += match_length;
+    }
+}
+
+// Writer thread.
+
+static struct {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+    bool running = false;
+    bool stopping = false;
+    std::deque<std::pair<std::filesystem::path, std::unique_ptr<zelda64::SaveStateImage>>> queue;
+    std::vector<std::unique_ptr<zelda64::SaveStateImage>> free_images;
+} SaveStateWriter;
+
+template <typename T>
+static void write_value(std::ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool read_value(std::ifstream& file, T& value) {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+static bool write_save_state_file(const std::filesystem::path& path, const zelda64::SaveStateImage& image) {
+    // Write to a temporary file and rename it over the destination, so an existing save state is never left half
+    // overwritten.
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+
+    auto start = std::chrono::steady_clock::now();
+    size_t compressed_bytes = 0;
+    {
+        std::ofstream file{ temp_path, std::ios::binary | std::ios::trunc };
+        if (!file.good()) {
+            return false;
+        }
+
+        file.write(save_state_magic, sizeof(save_state_magic));
+        write_value<uint32_t>(file, save_state_version);
+        write_value<uint32_t>(file, sizeof(recomp_context));
+        write_value<uint64_t>(file, zelda64::rom_hash);
+        write_value<uint32_t>(file, static_cast<uint32_t>(image.rdram.size()));
+        write_value<uint32_t>(file, save_state_block_size);
+        write_value<uint32_t>(file, static_cast<uint32_t>(image.contexts.size()));
+        write_value<uint32_t>(file, static_cast<uint32_t>(image.data.size()));
+        for (const auto& [thread_id, context] : image.contexts) {
+            write_value(file, thread_id);
+            write_value(file, context);
+        }
+        file.write(reinterpret_cast<const char*>(image.data.data()), image.data.size());
+
+        std::vector<uint8_t> compressed(zelda64::max_compressed_size(save_state_block_size));
+        std::vector<uint32_t> hash_table;
+        for (size_t offset = 0; offset < image.rdram.size(); offset += save_state_block_size) {
+            std::span<const uint8_t> block{ image.rdram.data() + offset, std::min<size_t>(save_state_block_size, image.rdram.size() - offset) };
+            size_t compressed_size = zelda64::compress_block(block, compressed.data(), hash_table);
+            if (compressed_size >= block.size()) {
+                write_value<uint32_t>(file, static_cast<uint32_t>(block.size()) | stored_block_flag);
+                file.write(reinterpret_cast<const char*>(block.data()), block.size());
+                compressed_bytes += block.size();
+            }
+            else {
+                write_value<uint32_t>(file, static_cast<uint32_t>(compressed_size));
+                file.write(reinterpret_cast<const char*>(compressed.data()), compressed_size);
+                compressed_bytes += compressed_size;
+            }
+        }
+
+        if (!file.good()) {
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        return false;
+    }
+
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Wrote save state %s: RDRAM %zu -> %zu bytes in %.1f ms\n", path.string().c_str(), image.rdram.size(),
+        compressed_bytes, elapsed_ms);
+    return true;
+}
+
+static void writer_thread_func() {
+    std::unique_lock lock{ SaveStateWriter.mutex };
+    while (true) {
+        SaveStateWriter.cv.wait(lock, [] { return SaveStateWriter.stopping || !SaveStateWriter.queue.empty(); });
+        if (SaveStateWriter.queue.empty()) {
+            return;
+        }
+
+        auto [path, image] = std::move(SaveStateWriter.queue.front());
+        SaveStateWriter.queue.pop_front();
+
+        lock.unlock();
+        if (!write_save_state_file(path, *image)) {
+            printf("Failed to write save state %s\n", path.string().c_str());
+        }
+        lock.lock();
+
+        if (SaveStateWriter.free_images.size() < max_free_images) {
+            SaveStateWriter.free_images.push_back(std::move(image));
+        }
+    }
+}
+
+std::unique_ptr<zelda64::SaveStateImage> zelda64::acquire_save_state_image() {
+    std::lock_guard lock{ SaveStateWriter.mutex };
+    if (SaveStateWriter.free_images.empty()) {
+        return std::make_unique<SaveStateImage>();
+    }
+    std::unique_ptr<SaveStateImage> image = std::move(SaveStateWriter.free_images.back());
+    SaveStateWriter.free_images.pop_back();
+    image->contexts.clear();
+    image->data.clear();
+    return image;
+}
+
+void zelda64::queue_save_state_write(const std::filesystem::path& path, std::unique_ptr<SaveStateImage> image) {
+    std::lock_guard lock{ SaveStateWriter.mutex };
+    if (!SaveStateWriter.running) {
+        SaveStateWriter.running = true;
+        SaveStateWriter.stopping = false;
+        SaveStateWriter.thread = std::thread{ writer_thread_func };
+    }
+    SaveStateWriter.queue.emplace_back(path, std::move(image));
+    SaveStateWriter.cv.notify_one();
+}
+
+void zelda64::stop_save_state_writer() {
+    {
+        std::lock_guard lock{ SaveStateWriter.mutex };
+        if (!SaveStateWriter.running) {
+            return;
+        }
+        SaveStateWriter.stopping = true;
+        SaveStateWriter.cv.notify_one();
+    }
+    SaveStateWriter.thread.join();
+    SaveStateWriter.running = false;
+}
+
+// Reader.
+
+bool zelda64::SaveStateReader::open(const std::filesystem::path& path) {
+    file = std::ifstream{ path, std::ios::binary };
+    if (!file.good()) {
+        printf("Failed to open save state %s\n", path.string().c_str());
+        return false;
+    }
+
+    char magic[sizeof(save_state_magic)];
+    uint32_t version, context_size, num_contexts, data_size;
+    uint64_t saved_rom_hash;
+    if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, save_state_magic, sizeof(magic)) != 0 ||
+        !read_value(file, version) || version != save_state_version || !read_value(file, context_size) ||
+        context_size != sizeof(recomp_context) || !read_value(file, saved_rom_hash) || !read_value(file, saved_rdram_size) ||
+        !read_value(file, block_size) || !read_value(file, num_contexts) || !read_value(file, data_size))
+    {
+        printf("%s is not a save state from this version\n", path.string().c_str());
+        return false;
+    }
+    if (saved_rom_hash != zelda64::rom_hash) {
+        printf("%s is a save state for a different game\n", path.string().c_str());
+        return false;
+    }
+    if (block_size == 0 || block_size > save_state_block_size || num_contexts > 256 || data_size > 256 * 1024 * 1024) {
+        printf("Save state %s is corrupt\n", path.string().c_str());
+        return false;
+    }
+
+    saved_contexts.resize(num_contexts);
+    for (auto& [thread_id, context] : saved_contexts) {
+        if (!read_value(file, thread_id) || !read_value(file, context)) {
+            printf("Save state %s is truncated\n", path.string().c_str());
+            return false;
+        }
+    }
+    saved_data.resize(data_size);
+    if (!file.read(reinterpret_cast<char*>(saved_data.data()), data_size)) {
+        printf("Save state %s is truncated\n", path.string().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool zelda64::SaveStateReader::read_rdram(uint8_t* rdram, size_t rdram_size) {
+    if (saved_rdram_size != rdram_size) {
+        printf("Save state RDRAM size doesn't match\n");
+        return false;
+    }
+
+    // Read the whole image into a staging copy first. rdram can be write protected by a PageSnapshot or the
+    // DirtyPageTracker, which makes the kernel fail reads straight into it, and a corrupt file shouldn't leave it half
+    // overwritten either. Copying from memory goes through the trackers' fault handlers like any other write.
+    std::vector<uint8_t> staging(rdram_size);
+    std::vector<uint8_t> compressed(max_compressed_size(block_size));
+    for (size_t offset = 0; offset < rdram_size; offset += block_size) {
+        std::span<uint8_t> block{ staging.data() + offset, std::min<size_t>(block_size, rdram_size - offset) };
+        uint32_t header;
+        if (!read_value(file, header)) {
+            return false;
+        }
+
+        if ((header & stored_block_flag) != 0) {
+            if ((header & ~stored_block_flag) != block.size() || !file.read(reinterpret_cast<char*>(block.data()), block.size())) {
+                return false;
+            }
+            continue;
+        }
+
+        if (header > compressed.size() || !file.read(reinterpret_cast<char*>(compressed.data()), header) ||
+            !decompress_block({ compressed.data(), header }, block))
+        {
+            return false;
+        }
+    }
+    std::memcpy(rdram, staging.data(), rdram_size);
+    return true;
+}
@@ -7,6 +7,7 @@
 #include <numeric>
 #include <stdexcept>
 #include <cinttypes>
+#include <cstring>
 
 #include "nfd.h"
 
@@ -34,6 +35,7 @@
 #include "zelda_render.h"
 #include "zelda_support.h"
 #include "zelda_game.h"
+#include "save_states.h"
 // #include "recomp_data.h"
 #include "ovl_patches.hpp"
 #include "librecomp/game.hpp"
@@ -187,6 +189,11 @@ void update_gfx(void*) {
     recomp::handle_events();
 }
 
+void on_vi() {
+    recomp::update_rumble();
+    zelda64::rewind_on_vi();
+}
+
 static SDL_AudioCVT audio_convert;
 static SDL_AudioDeviceID audio_device = 0;
 
@@ -355,7 +362,7 @@ gpr get_entrypoint_address();
 // array of supported GameEntry objects
 std::vector<recomp::GameEntry> supported_games = {
     {
-        .rom_hash = 0x960e3703f29d996dULL,
+        .rom_hash = zelda64::rom_hash,
         .internal_name = "DR.MARIO 64         ",
         .game_id = u8"drmario64.us",
         .mod_game_id = "drmario64",
@@ -558,8 +565,6 @@ void reorder_texture_pack(recomp::mods::ModContext&) {
 #define REGISTER_FUNC(name) recomp::overlays::register_base_export(#name, name)
 
 int main(int argc, char** argv) {
-    (void)argc;
-    (void)argv;
     recomp::Version project_version{};
     if (!recomp::Version::from_string(version_string, project_version)) {
         ultramodern::error_handling::message_box(("Invalid version string: " + version_string).c_str());
@@ -667,15 +672,52 @@ int main(int argc, char** argv) {
         .set_frequency = set_frequency,
     };
 
+    // --record-input <file> records the controller data the game reads, --replay-input <file> plays it back in place of
+    // live input. --measure-input-latency reports input-to-present latency using synthetic L button presses.
+    // --netplay <player> <players> <host:port> <local port> starts netplay as the given player (1-based), sending to the
+    // other player or a netplay_relay at host:port. --netplay-delay <frames> sets its input delay (default 2).
+    const char* netplay_args[4] = {};
+    uint32_t netplay_delay = 2;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc) {
+            recomp::start_input_recording(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--replay-input") == 0 && i + 1 < argc) {
+            recomp::start_input_replay(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--measure-input-latency") == 0) {
+            recomp::start_input_latency_measurement(0x0020);
+        }
+        else if (strcmp(argv[i], "--netplay") == 0 && i + 4 < argc) {
+            for (const char*& arg : netplay_args) {
+                arg = argv[++i];
+            }
+        }
+        else if (strcmp(argv[i], "--netplay-delay") == 0 && i + 1 < argc) {
+            netplay_delay = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+    }
+    if (netplay_args[0] != nullptr) {
+        uint32_t player = (uint32_t)strtoul(netplay_args[0], nullptr, 10);
+        uint32_t num_players = (uint32_t)strtoul(netplay_args[1], nullptr, 10);
+        uint16_t local_port = (uint16_t)strtoul(netplay_args[3], nullptr, 10);
+        // Every player starts from player 1's save, so the games stay in sync from the first frame.
+        const std::u8string& game_id = supported_games[0].game_id;
+        std::vector<uint8_t> save = zelda64::get_eeprom_image(game_id);
+        if (recomp::start_netplay(player - 1, num_players, netplay_args[2], local_port, netplay_delay, save) && player != 1) {
+            zelda64::use_temporary_eeprom_image(game_id, save);
+        }
+    }
+
     ultramodern::input::callbacks_t input_callbacks{
-        .poll_input = recomp::poll_inputs,
-        .get_input = recomp::get_n64_input,
+        .poll_input = recomp::poll_logged_inputs,
+        .get_input = recomp::get_logged_n64_input,
         .set_rumble = recomp::set_rumble,
-        .get_connected_device_info = recomp::get_connected_device_info,
+        .get_connected_device_info = recomp::get_logged_device_info,
     };
 
     ultramodern::events::callbacks_t thread_callbacks{
-        .vi_callback = recomp::update_rumble,
+        .vi_callback = on_vi,
         .gfx_init_callback = recompui::update_supported_options,
     };
 
@@ -716,6 +758,13 @@ int main(int argc, char** argv) {
         threads_callbacks
     );
 
+    recomp::stop_input_latency_measurement();
+    recomp::stop_rumble_worker();
+    recomp::stop_input_log();
+    recomp::stop_netplay();
+    zelda64::stop_eeprom_cache();
+    zelda64::stop_save_state_writer();
+
     if (preloaded) {
         release_preload(preload_context);
     }
@@ -14,6 +14,7 @@
 
 #include "zelda_render.h"
 #include "recomp_ui.h"
+#include "recomp_input.h"
 #include "concurrentqueue.h"
 
 static RT64::UserConfiguration::Antialiasing device_max_msaa = RT64::UserConfiguration::Antialiasing::None;
@@ -329,10 +330,12 @@ void zelda64::renderer::RT64Context::send_dl(const OSTask* task) {
     app->state->rsp->reset();
     app->interpreter->loadUCodeGBI(task->t.ucode & 0x3FFFFFF, task->t.ucode_data & 0x3FFFFFF, true);
     app->processDisplayLists(app->core.RDRAM, task->t.data_ptr & 0x3FFFFFF, 0, true);
+    recomp::input_latency_on_send_dl();
 }
 
 void zelda64::renderer::RT64Context::update_screen() {
     app->updateScreen();
+    recomp::input_latency_on_present();
 }
 
 void zelda64::renderer::RT64Context::shutdown() {
@@ -0,0 +1,138 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "recomp.h"
+#include "librecomp/game.hpp"
+
+#include "zelda_config.h"
+#include "zelda_game.h"
+
+// Crash test for the EEPROM cache's save file writes.
+//
+// A child process fills the whole EEPROM with one value and flushes it, over and over with a new value each time, and
+// gets killed at a random point. After every kill the save file has to hold exactly one of the values the child wrote:
+// a save file of the wrong size or with a mix of two values means a flush was torn. Runs against the real
+// eeprom_cache.cpp, with the save file in a scratch folder instead of the app folder:
+//
+//   eeprom_flush_test /tmp/eeprom_test --trials 500
+
+constexpr uint32_t eeprom_size = 512;
+constexpr gpr buffer_address = 0xFFFFFFFF80001000ULL;
+constexpr size_t rdram_size = 0x2000;
+
+static std::filesystem::path test_folder;
+
+extern "C" void recomp_eeprom_write(uint8_t* rdram, recomp_context* ctx);
+
+// eeprom_cache.cpp gets the save file location from these, normally provided by the config code and the runtime.
+std::filesystem::path zelda64::get_app_folder_path() {
+    return test_folder;
+}
+
+std::u8string recomp::current_game_id() {
+    return u8"eeprom_flush_test";
+}
+
+static void write_eeprom(uint8_t* rdram, uint8_t value) {
+    for (uint32_t i = 0; i < eeprom_size; i++) {
+        MEM_B(i, buffer_address) = value;
+    }
+    recomp_context ctx{};
+    ctx.r4 = 0;
+    ctx.r5 = buffer_address;
+    ctx.r6 = eeprom_size;
+    recomp_eeprom_write(rdram, &ctx);
+}
+
+[[noreturn]] static void run_writer() {
+    std::vector<uint8_t> rdram(rdram_size);
+    for (uint32_t i = 0; ; i++) {
+        write_eeprom(rdram.data(), (uint8_t)(i + 1));
+        // Stopping flushes right away instead of waiting for the debounce, and the next write starts the cache again.
+        zelda64::stop_eeprom_cache();
+    }
+}
+
+static void usage() {
+    printf("Usage: eeprom_flush_test <scratch folder> [--trials n] [--seed n]\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    test_folder = argv[1];
+    int trials = 300;
+    uint32_t seed = 1;
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--trials") == 0) {
+            trials = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(test_folder / "saves", ec);
+    std::filesystem::path save_path = test_folder / "saves" / (recomp::current_game_id() + u8".bin");
+
+    std::mt19937 rng{ seed };
+    std::uniform_int_distribution<int> kill_delay_us{ 1000, 6000 };
+    int torn = 0;
+    int empty = 0;
+    for (int trial = 0; trial < trials; trial++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            printf("Failed to start the writer process\n");
+            return 1;
+        }
+        if (pid == 0) {
+            run_writer();
+        }
+        usleep(kill_delay_us(rng));
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+
+        std::ifstream file{ save_path, std::ios::binary };
+        if (!file.good()) {
+            // Killed before the first flush finished.
+            empty++;
+            continue;
+        }
+        std::vector<uint8_t> data{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+        bool whole = data.size() == eeprom_size;
+        for (size_t i = 1; whole && i < data.size(); i++) {
+            whole = data[i] == data[0];
+        }
+        if (!whole) {
+            printf("Trial %d: torn save file (%zu bytes)\n", trial + 1, data.size());
+            torn++;
+        }
+    }
+
+    printf("%d trials, %d torn, %d killed before the first flush\n", trials, torn, empty);
+    return torn == 0 ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <vector>
+
+// Netplay relay for testing.
+//
+// Forwards every netplay packet to all the other players that have sent a packet so far, identifying players by the
+// player byte in the packet header. Each forwarded copy can be delayed (with optional jitter, which also reorders
+// packets) or dropped, so several instances of the game on one machine can be tested under bad network conditions:
+//
+//   netplay_relay 7000 --delay 40 --jitter 10 --loss 5
+//   drmario64_recomp --netplay 1 2 127.0.0.1:7000 7001
+//   drmario64_recomp --netplay 2 2 127.0.0.1:7000 7002
+
+using relay_clock = std::chrono::steady_clock;
+
+constexpr size_t max_players = 4;
+constexpr size_t max_packet_size = 2048;
+constexpr auto stats_interval = std::chrono::seconds{10};
+
+struct PendingPacket {
+    relay_clock::time_point due;
+    sockaddr_in dest;
+    std::vector<uint8_t> data;
+
+    bool operator>(const PendingPacket& rhs) const {
+        return due > rhs.due;
+    }
+};
+
+static void usage() {
+    printf("Usage: netplay_relay <port> [--delay ms] [--jitter ms] [--loss percent] [--seed n]\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    uint16_t port = (uint16_t)strtoul(argv[1], nullptr, 10);
+    double delay_ms = 0.0;
+    double jitter_ms = 0.0;
+    double loss_percent = 0.0;
+    uint32_t seed = 1;
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--delay") == 0) {
+            delay_ms = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--jitter") == 0) {
+            jitter_ms = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--loss") == 0) {
+            loss_percent = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+    if (sock < 0 || bind(sock, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0) {
+        printf("Failed to bind port %u\n", port);
+        return 1;
+    }
+    printf("Relaying on port %u, delay %.1f ms, jitter %.1f ms, loss %.1f%%\n", port, delay_ms, jitter_ms, loss_percent);
+
+    std::mt19937 rng{ seed };
+    std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+    std::array<sockaddr_in, max_players> players{};
+    std::array<bool, max_players> known{};
+    std::priority_queue<PendingPacket, std::vector<PendingPacket>, std::greater<>> pending;
+    uint64_t received = 0;
+    uint64_t forwarded = 0;
+    uint64_t dropped = 0;
+    auto last_stats = relay_clock::now();
+
+    while (true) {
+        auto now = relay_clock::now();
+        while (!pending.empty() && pending.top().due <= now) {
+            const PendingPacket& packet = pending.top();
+            sendto(sock, packet.data.data(), packet.data.size(), 0, reinterpret_cast<const sockaddr*>(&packet.dest), sizeof(packet.dest));
+            forwarded++;
+            pending.pop();
+        }
+
+        if (now - last_stats >= stats_interval) {
+            printf("%llu received, %llu forwarded, %llu dropped\n", (unsigned long long)received,
+                (unsigned long long)forwarded, (unsigned long long)dropped);
+            last_stats = now;
+        }
+
+        int timeout_ms = 100;
+        if (!pending.empty()) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(pending.top().due - now).count();
+            timeout_ms = (int)std::max<long long>(0, std::min<long long>(wait, timeout_ms));
+        }
+        pollfd fd{ sock, POLLIN, 0 };
+        if (poll(&fd, 1, timeout_ms) <= 0) {
+            continue;
+        }
+
+        uint8_t data[max_packet_size];
+        sockaddr_in from{};
+        socklen_t from_len = sizeof(from);
+        ssize_t size = recvfrom(sock, data, sizeof(data), 0, reinterpret_cast<sockaddr*>(&from), &from_len);
+        // The player index is the sixth byte of the header.
+        if (size < 6 || data[5] >= max_players) {
+            continue;
+        }
+        received++;
+
+        uint8_t sender = data[5];
+        if (!known[sender] || players[sender].sin_port != from.sin_port || players[sender].sin_addr.s_addr != from.sin_addr.s_addr) {
+            printf("Player %u is at %s:%u\n", sender + 1, inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+            players[sender] = from;
+            known[sender] = true;
+        }
+
+        now = relay_clock::now();
+        for (size_t player = 0; player < max_players; player++) {
+            if (player == sender || !known[player]) {
+                continue;
+            }
+            if (unit(rng) * 100.0 < loss_percent) {
+                dropped++;
+                continue;
+            }
+            double packet_delay_ms = std::max(0.0, delay_ms + (unit(rng) * 2.0 - 1.0) * jitter_ms);
+            auto due = now + std::chrono::duration_cast<relay_clock::duration>(std::chrono::duration<double, std::milli>(packet_delay_ms));
+            pending.push(PendingPacket{ due, players[player], std::vector<uint8_t>(data, data + size) });
+        }
+    }
+}
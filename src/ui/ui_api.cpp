@@ -1,4 +1,5 @@
 #include "recomp_ui.h"
+#include "recomp_telemetry.h"
 
 #include "ui_helpers.h"
 #include "ui_api_images.h"
@@ -925,7 +926,7 @@ void recompui_set_nav(uint8_t* rdram, recomp_context* ctx) {
     element->set_nav(static_cast<recompui::NavDirection>(nav_dir), target_element);
 }
 
-#define REGISTER_FUNC(name) recomp::overlays::register_base_export(#name, name)
+#define REGISTER_FUNC(name) recomputil::register_timed_export<name>(#name)
 
 void recompui::register_ui_exports() {
     REGISTER_FUNC(recompui_create_context);
@@ -1,5 +1,8 @@
 #include "recomp_ui.h"
 #include "recomp_input.h"
+#include "recomp_data.h"
+#include "recomp_telemetry.h"
+#include "zelda_game.h"
 #include "zelda_sound.h"
 #include "zelda_config.h"
 #include "zelda_debug.h"
@@ -11,6 +14,12 @@
 #include "RmlUi/Core.h"
 #include "core/ui_context.h"
 
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
 // ...existing code...
 #include "recomp_ui.h"
 #include "recomp_input.h"
@@ -467,6 +476,13 @@ bool zelda64::get_low_health_beeps_enabled() {
     return (bool)sound_options_context.low_health_beeps_enabled.load();
 }
 
+// A row in the debug tab's benchmark list. run prints the full results and returns a short summary for the row.
+struct DebugBenchmark {
+    std::string name;
+    std::string result;
+    std::function<std::string()> run;
+};
+
 struct DebugContext {
     Rml::DataModelHandle model_handle;
     std::vector<std::string> area_names;
@@ -479,12 +495,23 @@ struct DebugContext {
     int set_time_hour = 12;
     int set_time_minute = 0;
     bool debug_enabled = false;
+    std::vector<DebugBenchmark> benchmarks;
+    std::string api_telemetry_result;
+    std::string rewind_result;
 
     DebugContext() {
         for (const auto& area : zelda64::game_warps) {
             area_names.emplace_back(area.name);
         }
         update_warp_names();
+
+        benchmarks = {
+            { "Input benchmark", "", []() { return recomp::benchmark_n64_input(0, 100000); } },
+            { "Data API benchmark", "", recomputil::benchmark_data_containers },
+            { "Data API contention benchmark", "", recomputil::benchmark_data_contention },
+            { "Quicksave benchmark", "", zelda64::benchmark_quicksave },
+            { "Run-ahead snapshot benchmark", "", zelda64::benchmark_run_ahead },
+        };
     }
 
     void update_warp_names() {
@@ -499,6 +526,65 @@ struct DebugContext {
 
 DebugContext debug_context;
 
+// The debug tab's benchmarks can take several seconds, so they run one at a time on a worker thread. The result is
+// handed back to the UI thread through finished_result and shown by update_debug_benchmarks.
+static struct DebugBenchmarkState {
+    std::mutex mutex;
+    std::thread thread;
+    bool running = false; // UI thread only.
+    size_t index = 0; // UI thread only.
+    std::optional<std::string> finished_result; // Protected by mutex.
+
+    ~DebugBenchmarkState() {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+} debug_benchmark_state;
+
+static void run_debug_benchmark(size_t index) {
+    if (debug_benchmark_state.running || index >= debug_context.benchmarks.size()) {
+        return;
+    }
+    if (debug_benchmark_state.thread.joinable()) {
+        debug_benchmark_state.thread.join();
+    }
+
+    DebugBenchmark& benchmark = debug_context.benchmarks[index];
+    benchmark.result = "Running...";
+    debug_context.model_handle.DirtyVariable("debug_benchmarks");
+
+    debug_benchmark_state.running = true;
+    debug_benchmark_state.index = index;
+    debug_benchmark_state.thread = std::thread{ [run = benchmark.run]() {
+        std::string result = run();
+        std::lock_guard lock{ debug_benchmark_state.mutex };
+        debug_benchmark_state.finished_result = std::move(result);
+    } };
+}
+
+void recompui::update_debug_benchmarks() {
+    if (!debug_benchmark_state.running) {
+        return;
+    }
+
+    std::optional<std::string> result;
+    {
+        std::lock_guard lock{ debug_benchmark_state.mutex };
+        result = std::exchange(debug_benchmark_state.finished_result, std::nullopt);
+    }
+    if (!result.has_value()) {
+        return;
+    }
+
+    debug_benchmark_state.thread.join();
+    debug_benchmark_state.running = false;
+    debug_context.benchmarks[debug_benchmark_state.index].result = std::move(*result);
+    if (debug_context.model_handle) {
+        debug_context.model_handle.DirtyVariable("debug_benchmarks");
+    }
+}
+
 recompui::ContextId config_context;
 
 recompui::ContextId recompui::get_config_context_id() {
@@ -685,6 +771,31 @@ public:
             [](const std::string& param, Rml::Event& event) {
                 zelda64::set_time(debug_context.set_time_day, debug_context.set_time_hour, debug_context.set_time_minute);
             });
+
+        recompui::register_event(listener, "toggle_api_telemetry",
+            [](const std::string& param, Rml::Event& event) {
+                if (recomputil::api_telemetry_active.load()) {
+                    debug_context.api_telemetry_result = recomputil::stop_api_telemetry();
+                }
+                else {
+                    recomputil::start_api_telemetry();
+                    debug_context.api_telemetry_result = "Recording, press again to stop";
+                }
+                debug_context.model_handle.DirtyVariable("api_telemetry_result");
+            });
+
+        recompui::register_event(listener, "toggle_rewind",
+            [](const std::string& param, Rml::Event& event) {
+                if (zelda64::get_rewind_enabled()) {
+                    debug_context.rewind_result = "Off, " + zelda64::get_rewind_stats();
+                    zelda64::set_rewind_enabled(false);
+                }
+                else {
+                    zelda64::set_rewind_enabled(true);
+                    debug_context.rewind_result = "On, hold the Rewind input to step back";
+                }
+                debug_context.model_handle.DirtyVariable("rewind_result");
+            });
     }
 
     void bind_config_list_events(Rml::DataModelConstructor &constructor) {
@@ -1084,6 +1195,21 @@ public:
         constructor.Bind("debug_time_hour", &debug_context.set_time_hour);
         constructor.Bind("debug_time_minute", &debug_context.set_time_minute);
 
+        // Bind the benchmark list. Each row's button runs its benchmark on the worker thread.
+        if (auto benchmark_handle = constructor.RegisterStruct<DebugBenchmark>()) {
+            benchmark_handle.RegisterMember("name", &DebugBenchmark::name);
+            benchmark_handle.RegisterMember("result", &DebugBenchmark::result);
+        }
+        constructor.RegisterArray<std::vector<DebugBenchmark>>();
+        constructor.Bind("debug_benchmarks", &debug_context.benchmarks);
+        constructor.BindEventCallback("run_debug_benchmark",
+            [](Rml::DataModelHandle model_handle, Rml::Event& event, const Rml::VariantList& inputs) {
+                run_debug_benchmark(inputs.at(0).Get<size_t>());
+            });
+
+        constructor.Bind("api_telemetry_result", &debug_context.api_telemetry_result);
+        constructor.Bind("rewind_result", &debug_context.rewind_result);
+
         debug_context.model_handle = constructor.GetModelHandle();
     }
 
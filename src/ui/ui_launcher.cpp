@@ -1,5 +1,6 @@
 #include "recomp_ui.h"
 #include "zelda_config.h"
+#include "zelda_game.h"
 #include "zelda_support.h"
 #include "librecomp/game.hpp"
 #include "ultramodern/ultramodern.hpp"
@@ -22,6 +23,7 @@ void select_rom() {
             recomp::RomValidationError rom_error = recomp::select_rom(path, supported_games[0].game_id);
             switch (rom_error) {
                 case recomp::RomValidationError::Good:
+                    zelda64::record_verified_rom(supported_games[0].game_id);
                     mm_rom_valid = true;
                     model_handle.DirtyVariable("mm_rom_valid");
                     break;
@@ -58,7 +60,7 @@ recompui::ContextId recompui::get_launcher_context_id() {
 class LauncherMenu : public recompui::MenuController {
 public:
     LauncherMenu() {
-        mm_rom_valid = recomp::is_rom_valid(supported_games[0].game_id);
+        mm_rom_valid = zelda64::is_stored_rom_valid(supported_games[0].game_id);
     }
     ~LauncherMenu() override {
 
@@ -751,6 +751,8 @@ void draw_hook(RT64::RenderCommandList* command_list, RT64::RenderFramebuffer* s
         recomp::finish_scanning_input(scanned_field);
     }
 
+    recompui::update_debug_benchmarks();
+
     ui_state->update_primary_input(mouse_moved, non_mouse_interacted);
     ui_state->update_focus(mouse_moved, non_mouse_interacted);
 